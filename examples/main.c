@@ -1,7 +1,9 @@
 #include <SDL.h>
 #include <SDL_audio.h>
 #include <SDL_opengles2.h>
+#include <math.h>
 #include <stdio.h>
+#include <string.h>
 
 #define TINYGP_IMPLEMENTATION
 #define TGPGL_IMPLEMENTATION
@@ -33,9 +35,75 @@ void draw(tgp_context* ctx, int width, int height) {
     tgp_draw_convex_polygon(ctx, (const tgp_vec2*)&points2, 6);
     // tgp_set_color(ctx, 1.0f, 1.0f, 0.5f, 1.0f);
     // tgp_draw_convex_polygon(ctx, (const tgp_vec2*)&points, 3);
+    tgp_end(ctx);
 }
 
-int main(void) {
+// many small antialiased polygons, the fringes of edge antialiasing cost the
+// most with small shapes
+void draw_bench(tgp_context* ctx, int width, int height) {
+    tgp_begin(ctx, width, height);
+    tgp_project(ctx, 0, (float)width, 0, (float)height);
+    tgp_set_color(ctx, 0.2f, 0.2f, 0.2f, 1.0f);
+    tgp_clear(ctx);
+    uint32_t seed = 1;
+    for (int i = 0; i < 3000; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        const float x = (float)(seed % (uint32_t)width);
+        const float y = (float)((seed >> 12) % (uint32_t)height);
+        const float r = 4.0f + (float)((seed >> 24) % 12);
+        tgp_vec2    points[6];
+        for (int k = 0; k < 6; k++) {
+            const float a = (float)k * 1.0471976f + (float)i;
+            points[k].x = x + cosf(a) * r;
+            points[k].y = y + sinf(a) * r;
+        }
+        tgp_set_color(ctx, (float)(i % 3) * 0.5f, (float)(i % 5) * 0.25f,
+                      1.0f, 1.0f);
+        tgp_draw_convex_polygon(ctx, points, 6);
+    }
+    tgp_end(ctx);
+}
+
+// renders the benchmark scene with fringe antialiasing (msaa_samples 0) or
+// with MSAA and prints the CPU time per frame of recording it and of
+// tgpgl_render() (without waiting for the GPU). the example includes the
+// GLES2 headers, build it with GLES3 ones to render with MSAA on the GPU
+void bench(SDL_Window* window, uint32_t msaa_samples, int num_frames) {
+    tgp_options opts = tgp_default_options();
+    opts.msaa_samples = msaa_samples;
+    tgp_context* ctx = (tgp_context*)malloc(sizeof(tgp_context));
+    tgp_init_context(ctx, &opts);
+    tgpgl_context* tgpgl_ctx = (tgpgl_context*)malloc(sizeof(tgpgl_context));
+    tgpgl_init_context(tgpgl_ctx, ctx);
+
+    const double ms = 1000.0 / (double)SDL_GetPerformanceFrequency();
+    double       record = 0.0, render = 0.0;
+    for (int i = 0; i < num_frames; i++) {
+        int width, height;
+        SDL_GetWindowSizeInPixels(window, &width, &height);
+        const uint64_t t0 = SDL_GetPerformanceCounter();
+        draw_bench(ctx, width, height);
+        const uint64_t t1 = SDL_GetPerformanceCounter();
+        tgpgl_render(tgpgl_ctx);
+        const uint64_t t2 = SDL_GetPerformanceCounter();
+        record += (double)(t1 - t0) * ms;
+        render += (double)(t2 - t1) * ms;
+        SDL_GL_SwapWindow(window);
+        SDL_PumpEvents();
+    }
+    printf("%s: record %.3f ms, render %.3f ms, %u vertices, %u indices, "
+           "%u dropped\n",
+           msaa_samples > 1 ? "msaa  " : "fringe", record / num_frames,
+           render / num_frames, ctx->cur_vertex, ctx->cur_index,
+           ctx->num_dropped);
+    tgpgl_destroy_context(tgpgl_ctx);
+    tgp_destroy_context(ctx);
+}
+
+int main(int argc, char** argv) {
+    // --bench compares fringe antialiasing against 4x MSAA and exits
+    const bool run_bench = argc > 1 && strcmp(argv[1], "--bench") == 0;
+
     // setup SDL
     if (SDL_Init(SDL_INIT_VIDEO) != 0) {
         fprintf(stderr, "failed to initialize SDL: %s\n", SDL_GetError());
@@ -59,7 +127,16 @@ int main(void) {
         SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE | SDL_WINDOW_ALLOW_HIGHDPI);
     SDL_GLContext glc = SDL_GL_CreateContext(window);
     SDL_GL_MakeCurrent(window, glc);
-    SDL_GL_SetSwapInterval(1); // enable vsync
+    SDL_GL_SetSwapInterval(run_bench ? 0 : 1); // enable vsync
+
+    if (run_bench) {
+        bench(window, 0, 200);
+        bench(window, 4, 200);
+        SDL_GL_DeleteContext(glc);
+        SDL_DestroyWindow(window);
+        SDL_Quit();
+        return 0;
+    }
 
     // initialize tinygp context
     tgp_context ctx;
@@ -82,6 +159,13 @@ int main(void) {
                 event.window.windowID == SDL_GetWindowID(window)) {
                 running = false;
             }
+            if (event.type == SDL_KEYDOWN &&
+                event.key.keysym.sym == SDLK_F12) {
+                // capture the last frame, replay it with tinygp_replay
+                if (tgp_capture_frame(&ctx, "frame.tgpc")) {
+                    printf("captured frame to frame.tgpc\n");
+                }
+            }
         }
 
         int width, height;
@@ -90,9 +174,7 @@ int main(void) {
         // draw the frame
         draw(&ctx, width, height);
 
-        // render
-        glClearColor(0.0, 0.0, 0.0, 1.0);
-        glClear(GL_COLOR_BUFFER_BIT);
+        // render (the frame clears itself with tgp_clear())
         tgpgl_render(&tgpgl_ctx);
         SDL_GL_SwapWindow(window);
     }
@@ -0,0 +1,87 @@
+// replays a frame captured with tgp_capture_frame() and times it
+//
+//   usage: tinygp_replay <capture file> [iterations]
+#include <SDL.h>
+#include <SDL_opengles2.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TINYGP_IMPLEMENTATION
+#define TGPGL_IMPLEMENTATION
+#include "tinygp.h"
+#include "tinygp_gl.h"
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <capture file> [iterations]\n", argv[0]);
+        return 1;
+    }
+    int iterations = argc > 2 ? atoi(argv[2]) : 100;
+
+    // map the capture, it is rendered straight from the mapping
+    int fd = open(argv[1], O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "failed to open %s\n", argv[1]);
+        return 1;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "failed to map %s\n", argv[1]);
+        return 1;
+    }
+
+    tgp_context ctx;
+    if (!tgp_init_replay_context(&ctx, data, (size_t)st.st_size)) {
+        fprintf(stderr, "%s is not a compatible capture\n", argv[1]);
+        return 1;
+    }
+    // the shaders and textures of the recording process are not in the
+    // capture, the pipelines are rendered with the defaults of the backend
+    // (see tgp_map_replay_handles())
+    printf("%d x %d, %u commands, %u vertices, %u indices\n",
+           ctx.screen_size.w, ctx.screen_size.h, ctx.cur_command,
+           ctx.cur_vertex, ctx.cur_index);
+
+    // setup SDL
+    if (SDL_Init(SDL_INIT_VIDEO) != 0) {
+        fprintf(stderr, "failed to initialize SDL: %s\n", SDL_GetError());
+        return 1;
+    }
+    SDL_GL_SetAttribute(SDL_GL_DOUBLEBUFFER, 1);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MAJOR_VERSION, 2);
+    SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
+    SDL_Window* window = SDL_CreateWindow(
+        "tinygp replay", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+        ctx.screen_size.w, ctx.screen_size.h,
+        SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+    SDL_GLContext glc = SDL_GL_CreateContext(window);
+    SDL_GL_MakeCurrent(window, glc);
+    SDL_GL_SetSwapInterval(0);
+
+    tgpgl_context tgpgl_ctx;
+    tgpgl_init_context(&tgpgl_ctx, &ctx);
+
+    // time submission of the captured frame
+    const Uint64 start = SDL_GetPerformanceCounter();
+    for (int i = 0; i < iterations; i++) {
+        tgpgl_render(&tgpgl_ctx);
+    }
+    glFinish();
+    const Uint64 end = SDL_GetPerformanceCounter();
+    const double ms =
+        (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    printf("%d iterations: %.3f ms total, %.3f ms per frame\n", iterations, ms,
+           ms / iterations);
+
+    SDL_GL_DeleteContext(glc);
+    SDL_DestroyWindow(window);
+    SDL_Quit();
+    munmap(data, st.st_size);
+    return 0;
+}
@@ -23,9 +23,19 @@
 #include <float.h>
 #include <math.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#ifndef TINYGP_NO_STDIO
+#include <stdio.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h> // _InterlockedCompareExchange
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sched.h> // sched_yield
+#endif
 
 #ifndef TINYGP_ASSERT
 #ifndef TINYGP_NO_ASSERT
@@ -43,6 +53,11 @@
 #define TINYGP_ENABLE_SSE
 #include <immintrin.h>
 #endif
+#if defined(TINYGP_ENABLE_SSE) &&                                              \
+    (defined __SSE2__ || defined __x86_64__ || defined _M_X64 ||               \
+     (defined(_M_IX86_FP) && (_M_IX86_FP >= 2)))
+#define TINYGP_ENABLE_SSE2
+#endif
 
 #ifndef TINYGP_TRANSFORM_STACK_DEPTH
 #define TINYGP_TRANSFORM_STACK_DEPTH 16
@@ -54,6 +69,13 @@
     (!((a).x2 <= (b).x1 || (b).x2 <= (a).x1 || (a).y2 <= (b).y1 ||             \
        (b).y2 <= (a).y1))
 
+// compound literals are C99 only, C++ (11 and later) uses list initialization
+#ifdef __cplusplus
+#define TGP_LITERAL(T) T
+#else
+#define TGP_LITERAL(T) (T)
+#endif
+
 #ifndef TGPDEF
 #define TGPDEF extern
 #endif
@@ -62,6 +84,75 @@
 #define TGP_BATCH_OPTIMIZER_DEPTH 8
 #endif
 
+// largest polygon that is stored in the tessellation cache, see
+// tgp_options.tess_cache_entries
+#ifndef TGP_TESS_CACHE_MAX_POINTS
+#define TGP_TESS_CACHE_MAX_POINTS 32
+#endif
+
+// number of entries a polygon can be stored in, the least recently used one
+// is replaced on a miss
+#ifndef TGP_TESS_CACHE_WAYS
+#define TGP_TESS_CACHE_WAYS 4
+#endif
+
+#define TGP_TESS_CACHE_MAX_VERTICES (TGP_TESS_CACHE_MAX_POINTS * 2)
+#define TGP_TESS_CACHE_MAX_INDICES                                             \
+    ((TGP_TESS_CACHE_MAX_POINTS - 2) * 3 + TGP_TESS_CACHE_MAX_POINTS * 6)
+
+// define TINYGP_OPAQUE_PASS to give every vertex a depth in painter's order
+// and to mark draw commands that only contain opaque geometry. opaque commands
+// can be merged regardless of overlap, a backend draws them front-to-back
+// with depth testing before the translucent ones. the fill of a single
+// polygon or rect is split from its antialiasing fringe, which stays with the
+// translucent geometry (batches of shapes are not split). TGP_DEPTH_BITS is
+// the precision of the depth buffer the backend renders to
+#ifndef TGP_DEPTH_BITS
+#define TGP_DEPTH_BITS 16
+#endif
+
+// every draw uses two depth buffer steps so that rounding can never make two
+// of them equal. draws after this many are drawn in order on top
+#define TGP_MAX_DRAW_ORDER ((1u << (TGP_DEPTH_BITS - 1)) - 1)
+
+// define TINYGP_BOX_SHADOWS to draw blurred (rounded) rectangles with
+// tgp_draw_box_shadow(). every vertex carries the parameters of the shadow it
+// belongs to, and the backend evaluates the blur per pixel, so shadows do not
+// need offscreen passes and are batched with everything else
+
+// number of points the strided functions convert at once, see
+// tgp_point_layout
+#ifndef TGP_POINT_CHUNK
+#define TGP_POINT_CHUNK 256
+#endif
+
+// number of shapes in a leaf of the hit testing tree, see tgp_set_id()
+#ifndef TGP_HIT_LEAF_SIZE
+#define TGP_HIT_LEAF_SIZE 4
+#endif
+
+// maximum number of cached layers, see tgp_begin_layer()
+#ifndef TGP_MAX_LAYERS
+#define TGP_MAX_LAYERS 16
+#endif
+
+// maximum number of pipelines that can be interned, see tgp_intern_pipeline()
+#ifndef TGP_MAX_PIPELINES
+#define TGP_MAX_PIPELINES 64
+#endif
+
+// number of textures a pipeline can bind
+#define TGP_PIPELINE_TEXTURES 4
+
+// userdata_mask of tgp_submit_draw() that allows merging with any command
+#define TGP_MERGE_ANY 0xffffffffu
+
+// maximum number of damaged rectangles produced by tgp_end() when damage
+// tracking is enabled. more rectangles are merged together
+#ifndef TGP_MAX_DAMAGE_RECTS
+#define TGP_MAX_DAMAGE_RECTS 8
+#endif
+
 // TINYGP_USERDATA_TYPE
 // TINYGP_COMPARE_USERDATA
 
@@ -110,42 +201,188 @@ typedef struct {
 typedef struct {
     tgp_vec2  position, texcoord;
     tgp_color color;
+#ifdef TINYGP_BOX_SHADOWS
+    // half size and corner radius of the box and the standard deviation of
+    // the blur, texcoord is then relative to the center of the box. the
+    // deviation is 0 if the vertex is not part of a shadow
+    float shadow[4];
+#endif
+#ifdef TINYGP_OPAQUE_PASS
+    float depth; // painter's order, later draws are closer
+#endif
 } tgp_vertex;
 
 #ifndef tgp_index
 typedef uint16_t tgp_index;
 #endif
 
+// maximum number of vertices a single draw command can address with tgp_index
+#define TGP_MAX_DRAW_VERTICES                                                  \
+    ((uint32_t)TGP_MIN((uint64_t)1 << (sizeof(tgp_index) * 8), 1u << 30))
+
 typedef enum {
     TGP_COMMAND_NONE = 0,
     TGP_COMMAND_VIEWPORT,
     TGP_COMMAND_SCISSOR,
     TGP_COMMAND_DRAW,
     TGP_COMMAND_CLEAR,
+    TGP_COMMAND_PROJECTION,
+    TGP_COMMAND_BEGIN_LAYER,
+    TGP_COMMAND_END_LAYER,
+    TGP_COMMAND_DRAW_LAYER,
+    TGP_COMMAND_DRAW_RECTS,
+    TGP_COMMAND_FILL_PATH,
 } tgp_command_type;
 
+// decides which parts of a self-intersecting or nested path are inside, see
+// tgp_fill_path()
+typedef enum {
+    TGP_FILL_NONZERO = 0,
+    TGP_FILL_EVEN_ODD,
+} tgp_fill_rule;
+
+// how colors are combined with the framebuffer. backends blend premultiplied
+// colors, so every mode is exact with translucent and antialiased edges
+typedef enum {
+    TGP_BLEND_NORMAL = 0,
+    TGP_BLEND_ADDITIVE,
+    TGP_BLEND_MULTIPLY,
+    TGP_BLEND_SCREEN,
+} tgp_blend_mode;
+
+// how the textures of a pipeline store their colors. colors are blended
+// premultiplied, so textures are expected to be premultiplied too (like
+// layers are). textures with straight alpha, like most images as they are
+// loaded, need TGP_TEXTURE_STRAIGHT_ALPHA or they come out too bright where
+// they are translucent
+typedef enum {
+    TGP_TEXTURE_PREMULTIPLIED = 0,
+    TGP_TEXTURE_STRAIGHT_ALPHA,
+} tgp_texture_alpha;
+
+// the state that draw commands are rendered with, see tgp_intern_pipeline().
+// `shader` and `textures` are handles of the backend (for the GL backend a
+// shader from tgpgl_create_shader() and GL texture names), 0 selects the
+// default of the backend
 typedef struct {
-    uint32_t   vtx_offset;
-    uint32_t   idx_offset;
-    uint32_t   num_vertices;
-    uint32_t   num_indices;
-    tgp_region region;
+    tgp_blend_mode    blend;
+    tgp_texture_alpha texture_alpha;
+    uint32_t          shader;
+    uint32_t          textures[TGP_PIPELINE_TEXTURES];
+} tgp_pipeline;
+
+// a backend handle (see tgp_pipeline) of the process that recorded a capture
+// and the one that replaces it when the capture is replayed, see
+// tgp_map_replay_handles()
+typedef struct {
+    uint32_t recorded, replayed;
+} tgp_handle_map;
+
+// the geometry of a draw command, its region is in tgp_command_key
+typedef struct {
+    uint32_t vtx_offset;
+    uint32_t idx_offset;
+    uint32_t num_vertices;
+    uint32_t num_indices;
 } tgp_draw_command;
 
 typedef struct {
-    tgp_command_type type;
-    union {
-        tgp_irect        viewport;
-        tgp_irect        scissor;
-        tgp_draw_command draw;
-        tgp_color        clear;
-    } data;
+    uint32_t id;
+    int      w, h;
+    uint32_t samples; // samples per pixel, see tgp_begin_layer_samples()
+} tgp_layer_command;
+
+// draws a textured quad with the contents of a layer
+typedef struct {
+    tgp_draw_command draw;
+    uint32_t         id;
+    uint32_t         version; // incremented every time the layer is redrawn
+} tgp_draw_layer_command;
+
+// draws axis-aligned rectangles. no indices are stored: every rectangle uses
+// the same index pattern (see tgp_rect_index_pattern()) offset by the number
+// of vertices of a rectangle, so backends can use a static index buffer.
+// draw.idx_offset is unused and draw.num_indices is the number of indices
+// that the pattern expands to
+typedef struct {
+    tgp_draw_command draw;
+    bool             antialiased;
+} tgp_draw_rects_command;
+
+// fills a path of any shape with the stencil buffer instead of
+// triangulating it. the vertices are the points of the path, drawn as a
+// triangle fan around the first one to count how often every pixel is
+// covered, followed by the 4 corners of a quad that covers them all, which
+// is drawn where the count is inside according to `rule`. no indices are
+// stored and draw.num_indices is 0
+typedef struct {
+    tgp_draw_command draw;
+    tgp_fill_rule    rule;
+} tgp_fill_path_command;
+
+// the part of a command that is read for every command: by the batch
+// optimizer while it looks back for a command to merge with, and by backends
+// to find the commands they have to execute
+typedef struct {
+    tgp_region region; // bounding rect of a draw command in clip space
+    // index of the pipeline of a draw command, commands with the same one
+    // can be merged
+    uint32_t pipeline;
+    uint8_t  type; // tgp_command_type
+    // only with TINYGP_OPAQUE_PASS: every vertex of a draw command is fully
+    // opaque, so it can be drawn in any order with depth testing
+    bool opaque;
+} tgp_command_key;
+
+// the arguments of a command, the member is selected by its type.
+// draw_layer.draw, draw_rects.draw and fill_path.draw alias draw
+typedef union {
+    tgp_irect              viewport;
+    tgp_irect              scissor;
+    tgp_draw_command       draw;
+    tgp_color              clear;
+    tgp_mat2x3             projection;
+    tgp_layer_command      layer;
+    tgp_draw_layer_command draw_layer;
+    tgp_draw_rects_command draw_rects;
+    tgp_fill_path_command  fill_path;
+} tgp_command_data;
+
+// commands are stored as a structure of arrays, command i is keys[i],
+// data[i] and userdata[i]. looking back for a command to merge with and
+// skipping commands only touches the keys
+typedef struct {
+    tgp_command_key*  keys;
+    tgp_command_data* data;
+#ifdef TINYGP_USERDATA_TYPE
+    TINYGP_USERDATA_TYPE* userdata;
+#endif
+} tgp_commands;
 
+// a copy of a whole command, put together from the arrays by
+// tgp_get_command_p(). since commands became a structure of arrays the
+// region of a draw is `region` instead of data.draw.region, and
+// tgp_get_command() is gone. commands are changed through ctx->commands
+typedef struct {
+    tgp_command_type type;
+    tgp_command_data data;
+    tgp_region       region;
+    uint32_t         pipeline;
+    bool             opaque;
 #ifdef TINYGP_USERDATA_TYPE
     TINYGP_USERDATA_TYPE userdata;
 #endif
 } tgp_command;
 
+// walks over a range of commands and skips the removed ones, see
+// tgp_command_range()
+typedef struct {
+    tgp_commands            commands;
+    uint32_t                index, end; // index is the current command
+    const tgp_command_key*  key;
+    const tgp_command_data* data;
+} tgp_command_iter;
+
 typedef struct {
     uint32_t max_vertices;
     uint32_t max_indices;
@@ -153,8 +390,253 @@ typedef struct {
     uint32_t max_commands;
     bool     antialiasing;
     float    fringe_scale;
+    // samples per pixel the backend renders the screen and layers with. with
+    // 2 or more, the geometry has no antialiasing fringes (antialiasing only
+    // applies where there is no MSAA) and the backend renders into a
+    // multisampled framebuffer that it resolves at the end of the frame.
+    // 0 or 1 disables MSAA
+    uint32_t msaa_samples;
+    bool     damage_tracking;
+    // if true, vertices are only multiplied by the transform matrix and the
+    // projection is applied by the backend (see TGP_COMMAND_PROJECTION).
+    // while the transform is the identity (drawing in pixels), positions are
+    // written without any transform on the CPU. other transforms are still
+    // applied per vertex, so that draws with different transforms batch
+    bool gpu_projection;
+    // number of antialiased convex polygons whose tessellation is cached, so
+    // drawing the same shape again only has to transform it. 0 disables the
+    // cache
+    uint32_t tess_cache_entries;
+    // number of frames that can be in flight at once. with 2 or more, one
+    // thread can record a frame while another one renders the previous one,
+    // see tgp_acquire_frame(). tgp_begin() waits while the backend renders
+    // every slot, call tgp_frame_available() first to skip the frame instead
+    uint32_t frame_slots;
+    // number of shapes with an id (see tgp_set_id()) that can be hit tested
+    // per frame. 0 disables hit testing
+    uint32_t max_hit_shapes;
+    // if true the triangles of every shape are kept too, so hit tests are
+    // exact instead of using the bounding rect
+    bool hit_geometry;
 } tgp_options;
 
+typedef struct {
+    uint64_t  hash;
+    tgp_irect rect;
+} tgp_command_hash;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t num_points;
+    uint32_t last_used; // 0 if the entry is empty
+    float    fringe_scale;
+} tgp_tess_cache_entry;
+
+typedef struct {
+    uint32_t hits, misses, evictions;
+} tgp_tess_cache_stats;
+
+// a shape that can be hit tested, see tgp_set_id(). positions are in pixels
+typedef struct {
+    uint32_t   id;
+    tgp_region rect; // clipped to the viewport and the scissor
+    // triangles, see tgp_options.hit_geometry. 0 indices if only the rect
+    // can be tested
+    uint32_t vtx_offset, idx_offset, num_indices;
+} tgp_hit_shape;
+
+// node of the bounding volume hierarchy over the hit shapes, stored in
+// depth-first order. a leaf has `count` shapes starting at hit_order[first],
+// the first child of an inner node is right after it. `skip` is the node
+// after the subtree
+typedef struct {
+    tgp_region bounds;
+    uint32_t   first, count, skip;
+} tgp_hit_node;
+
+typedef enum {
+    TGP_PATH_LOD_NONE,
+    TGP_PATH_LOD_DECIMATE,
+    TGP_PATH_LOD_SIMPLIFY,
+} tgp_path_lod_mode;
+
+// state of the level of detail stage in front of the path, see
+// tgp_path_decimate() and tgp_path_simplify()
+typedef struct {
+    tgp_path_lod_mode mode;
+    uint32_t          count; // points seen by the current mode
+    // decimation: extremes of the pixel column that is being collected and
+    // the index (within the column) of the sample each one came from
+    int32_t  column;
+    uint32_t column_count;
+    tgp_vec2 first, last, min, max;
+    float    min_y, max_y;
+    uint32_t min_i, max_i;
+    // simplification: the last point that was added to the path, the last
+    // point that was seen and the range of directions (in pixels) from the
+    // anchor that keeps every skipped point within the tolerance
+    tgp_vec2 anchor, anchor_px, prev, prev_px;
+    float    cone_min, cone_max, reach;
+    bool     cone_open;
+} tgp_path_lod;
+
+typedef enum {
+    TGP_SCALAR_FLOAT,
+    TGP_SCALAR_DOUBLE,
+} tgp_scalar_type;
+
+// where the coordinates of each point are in caller memory, so points can be
+// read straight from arrays of records (or a mapped file) instead of being
+// copied into a tgp_vec2 array first. point i starts at `data + i * stride`:
+//
+//     typedef struct { double t; float v; } sample;
+//     const tgp_point_layout layout = {
+//         sizeof(sample),    offsetof(sample, t), offsetof(sample, v),
+//         TGP_SCALAR_DOUBLE, TGP_SCALAR_FLOAT,
+//     };
+typedef struct {
+    size_t          stride;
+    size_t          x_offset, y_offset;
+    tgp_scalar_type x_type, y_type;
+} tgp_point_layout;
+
+// state of a polygon that is being streamed in, see tgp_begin_polygon()
+typedef struct {
+    bool       active, failed, antialiased;
+    tgp_color  color;
+    tgp_mat2x3 matrix;
+    uint32_t   count;    // points seen so far
+    tgp_vec2   first[2]; // needed to close the polygon
+    tgp_vec2   prev[2];  // the last two points
+    // every fan triangle shares the head (the first point, or the fringe
+    // pair of the second point with antialiasing). the head and the last
+    // ring vertex are repeated at the start of every draw command
+    tgp_vertex head[2], last[2];
+    bool       last_is_head;
+    uint32_t   cmd_last; // index of the last ring vertex in the command
+    uint32_t   vtx_offset, idx_offset;
+    tgp_region region;
+    // the buffers when the polygon started (or was last flushed), the
+    // polygon is rolled back to them if it does not fit
+    uint32_t   start_command, start_vertex, start_index, start_hits;
+} tgp_polygon_stream;
+
+// an edge of a path rasterized by tgp_rasterize_path(), in pixels of the
+// image. y0 < y1, `dir` is 1 if the path goes down along it and -1 if it
+// goes up
+typedef struct {
+    float x0, y0, y1, dxdy, dir;
+} tgp_raster_edge;
+
+// an RGBA image in memory with the top row first, see tgp_rasterize_path()
+typedef struct {
+    uint8_t* pixels;
+    int      w, h;
+    int      stride; // bytes from the start of one row to the next
+} tgp_image;
+
+typedef struct {
+    uint32_t id;
+    int      w, h;
+    uint32_t samples;
+    uint32_t version;
+    bool     used, valid;
+} tgp_layer;
+
+// state that is replaced while a layer is being recorded
+typedef struct {
+    tgp_size   screen_size;
+    tgp_irect  viewport;
+    tgp_irect  scissor;
+    tgp_mat2x3 proj;
+    tgp_mat2x3 transform;
+    bool       antialiasing;
+} tgp_layer_state;
+
+// a read-only mesh of a tgp_shared registry. positions are untransformed and
+// indices start at 0. every vertex is drawn with the current color, its
+// alpha scaled by `alphas` (0 on the outside of an antialiasing fringe).
+// `alphas` is NULL if the color is used as is
+typedef struct {
+    uint64_t         key; // 0 if the slot is empty
+    uint32_t         num_vertices, num_indices;
+    const tgp_vec2*  positions; // the start of the allocation of the mesh
+    const float*     alphas;
+    const tgp_index* indices;
+} tgp_shared_mesh;
+
+// a version of the meshes of a registry. published tables are never
+// modified, they are open addressing hash tables with `mask + 1` slots
+typedef struct {
+    uint32_t         mask, count;
+    tgp_shared_mesh* meshes; // right after the table in the same allocation
+} tgp_shared_table;
+
+// memory that is freed once no reader can see it anymore. `epoch` is the
+// epoch in which it was unpublished, 0 until the next tgp_shared_publish()
+typedef struct {
+    void*    ptr;
+    uint32_t epoch;
+} tgp_shared_retired;
+
+// meshes that are built once and drawn by many contexts, which may record on
+// different threads, see tgp_init_shared().
+//
+// contexts look meshes up in the table that was current at their
+// tgp_begin() without taking locks. updates go into a private copy that
+// tgp_shared_publish() swaps in, the old version is freed once every
+// context that could still read it has called tgp_end() (epoch based
+// reclamation)
+typedef struct tgp_shared {
+    tgp_shared_table* current; // shared between threads
+    uint32_t          epoch;   // shared between threads, starts at 1
+    // reader slots of the contexts that use the registry. the epoch a slot
+    // saw in tgp_begin(), 0 outside of a frame, and 1 in `reader_used` if
+    // the slot belongs to a context. both are shared between threads
+    uint32_t  max_readers;
+    uint32_t* reader_epochs;
+    uint32_t* reader_used;
+    // only used by the thread that updates the registry
+    tgp_shared_table*   pending;
+    uint32_t            num_retired, max_retired;
+    tgp_shared_retired* retired;
+} tgp_shared;
+
+#define TGP_CAPTURE_MAGIC   0x43504754u // "TGPC"
+#define TGP_CAPTURE_VERSION 6u
+#define TGP_CAPTURE_ALIGN   16u
+
+// header of a frame capture. the header is followed by the arrays of
+// tgp_commands, the vertices, indices and pipelines stored exactly as they
+// are in memory (native byte order, each array aligned to TGP_CAPTURE_ALIGN
+// bytes), so a mapped capture can be rendered without copying anything. the
+// backend handles of the pipelines are the ones of the recording process,
+// see tgp_map_replay_handles()
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t byte_order; // 0x01020304 in the byte order of the writer
+    uint32_t header_size;
+    uint32_t command_key_size;  // sizeof(tgp_command_key)
+    uint32_t command_data_size; // sizeof(tgp_command_data)
+    uint32_t userdata_size;     // sizeof(TINYGP_USERDATA_TYPE), 0 without
+    uint32_t vertex_size;
+    uint32_t index_size;
+    int32_t  screen_w, screen_h;
+    uint32_t num_commands;
+    uint32_t num_vertices;
+    uint32_t num_indices;
+    uint32_t num_pipelines;
+    uint32_t msaa_samples; // of the screen, see tgp_options.msaa_samples
+    uint64_t command_keys_offset;
+    uint64_t command_data_offset;
+    uint64_t userdata_offset;
+    uint64_t vertices_offset;
+    uint64_t indices_offset;
+    uint64_t pipelines_offset;
+    uint64_t total_size;
+} tgp_capture_header;
+
 typedef struct {
     tgp_size  screen_size;
     tgp_irect viewport;
@@ -166,11 +648,23 @@ typedef struct {
     tgp_index*   indices;
     uint32_t     max_path, cur_path;
     tgp_vec2*    path;
+    tgp_path_lod path_lod;
     uint32_t     max_commands, cur_command;
-    tgp_command* commands;
+    tgp_commands commands;
+    // true if the buffers above are not owned by the context (for example
+    // when replaying a capture, see tgp_init_replay_context())
+    bool external_buffers;
 
-    bool  antialiasing;
+    // convex polygon that is being streamed in, see tgp_begin_polygon()
+    tgp_polygon_stream polygon_stream;
+
+    bool  antialiasing; // current, false where MSAA is used
     float fringe_scale;
+    bool  gpu_projection;
+    // tgp_options.antialiasing and tgp_options.msaa_samples, layers can use
+    // other samples (see tgp_begin_layer_samples())
+    bool     fringe_antialiasing;
+    uint32_t msaa_samples;
 
     tgp_mat2x3 proj;
     tgp_mat2x3 transform;
@@ -178,19 +672,160 @@ typedef struct {
     uint8_t    cur_transform;
     tgp_mat2x3 transform_stack[TINYGP_TRANSFORM_STACK_DEPTH];
     tgp_color  color;
+    uint32_t   draw_order; // number of draws that got a depth
+#ifdef TINYGP_OPAQUE_PASS
+    // scratch memory of tgp_split_shape(), grown on demand
+    void*  split_scratch;
+    size_t split_scratch_size;
+#endif
+#ifdef TINYGP_BOX_SHADOWS
+    float shadow[4]; // given to the vertices of every draw, see tgp_vertex
+#endif
+
+    // interned pipelines, see tgp_intern_pipeline(). they are kept across
+    // frames, 0 is the default pipeline
+    tgp_pipeline pipelines[TGP_MAX_PIPELINES];
+    uint32_t     num_pipelines, cur_pipeline;
+    // the pipelines of a replayed capture with the backend handles they were
+    // recorded with, see tgp_map_replay_handles()
+    const tgp_pipeline* recorded_pipelines;
+
+    // layers, see tgp_begin_layer()
+    tgp_layer       layers[TGP_MAX_LAYERS];
+    int32_t         cur_layer; // index into layers, -1 if not in a layer
+    bool            skip_layer;
+    tgp_layer_state layer_state;
+
+    // damage tracking, see tgp_end()
+    bool              damage_tracking, damage_all;
+    tgp_size          prev_screen_size;
+    uint32_t          num_hashes, num_prev_hashes;
+    tgp_command_hash* hashes;
+    tgp_command_hash* prev_hashes;
+    uint32_t          num_damage;
+    tgp_irect         damage[TGP_MAX_DAMAGE_RECTS];
+
+    // tessellation cache, see tgp_options.tess_cache_entries. the points,
+    // positions and indices of entry i start at i * TGP_TESS_CACHE_MAX_*
+    uint32_t              tess_cache_entries, tess_cache_tick;
+    tgp_tess_cache_entry* tess_cache;
+    tgp_vec2*             tess_cache_points;
+    tgp_vec2*             tess_cache_positions;
+    tgp_index*            tess_cache_indices;
+    // scratch memory for the positions of polygons that are not cached,
+    // grown on demand
+    tgp_vec2* tess_positions;
+    uint32_t  tess_positions_capacity;
+    // counted since the last tgp_begin()
+    tgp_tess_cache_stats tess_cache_stats;
+
+    // registry of shared meshes, see tgp_use_shared(). `shared_table` is the
+    // version that was pinned by tgp_begin(), NULL outside of a frame
+    tgp_shared*             shared;
+    uint32_t                shared_reader;
+    const tgp_shared_table* shared_table;
+
+    // renders the frame in parts when the buffers are full, see
+    // tgp_set_flush_backend(). NULL if draws are dropped instead
+    struct tgp_backend* flush_backend;
+    uint32_t            num_flushes; // parts rendered since tgp_begin()
+    // draws (or parts of bulk draws) that were dropped since tgp_begin()
+    // because the buffers were full and could not be flushed
+    uint32_t            num_dropped;
+
+    // frame slots, see tgp_options.frame_slots. the vertices, indices and
+    // commands buffers point into the slot that is being recorded
+    uint32_t          num_frames;
+    struct tgp_frame* frames;
+    struct tgp_frame* cur_frame;
+    uint64_t          frame_sequence;
+
+    // hit testing, see tgp_set_id(). the tree is built by tgp_end()
+    uint32_t       cur_id;
+    uint32_t       max_hit_shapes, num_hit_shapes, num_hit_nodes;
+    tgp_hit_shape* hit_shapes;
+    tgp_hit_node*  hit_nodes;
+    uint32_t*      hit_order; // shapes sorted along a morton curve
+    uint32_t*      hit_keys;  // sort keys, both have 2 * max_hit_shapes
+    bool           hit_geometry;
+    uint32_t       cur_hit_vertex, cur_hit_index;
+    tgp_vec2*      hit_positions;
+    tgp_index*     hit_indices;
+
+    // scratch memory of tgp_rasterize_path(), allocated on first use. the
+    // edges and the active edges have max_path entries
+    tgp_raster_edge* raster_edges;
+    uint32_t*        raster_active;
+    float*           raster_cells;
+    uint32_t         raster_cells_capacity;
 
 #ifdef TINYGP_USERDATA_TYPE
     TINYGP_USERDATA_TYPE current_userdata;
 #endif
 } tgp_context;
 
+// a renderer of recorded frames, driven by tgp_render(). every function gets
+// `user` and the frame, functions that are NULL are skipped. the GL backend
+// returns one from tgpgl_backend(), tgp_null_backend() returns one that
+// only reads the frame
+typedef struct tgp_backend {
+    void* user;
+    // called before anything else is done with the frame
+    void (*begin_frame)(void* user, tgp_context* frame);
+    // makes all vertices and indices of the frame available to the commands
+    void (*upload)(void* user, tgp_context* frame);
+    // executes the commands [first, first + count) of the frame, the state
+    // they leave behind carries over to the next range
+    void (*execute)(void* user, tgp_context* frame, uint32_t first,
+                    uint32_t count);
+    void (*end_frame)(void* user, tgp_context* frame);
+} tgp_backend;
+
+// what the null backend went through, see tgp_null_backend(). `checksum`
+// depends on every byte that was read, so the reads can not be optimized
+// away
+typedef struct {
+    uint32_t frames, commands, draws;
+    uint64_t vertex_bytes, index_bytes;
+    uint64_t checksum;
+} tgp_null_stats;
+
+typedef enum {
+    TGP_FRAME_FREE = 0,
+    TGP_FRAME_RECORDING, // between tgp_begin() and tgp_end()
+    TGP_FRAME_READY,     // recorded, waiting for tgp_acquire_frame()
+    TGP_FRAME_RENDERING, // acquired, waiting for tgp_release_frame()
+} tgp_frame_state;
+
+typedef struct tgp_frame {
+    uint32_t state;    // tgp_frame_state, shared between threads
+    uint64_t sequence; // frames are acquired in the order they were recorded
+    tgp_vertex*  vertices;
+    tgp_index*   indices;
+    tgp_commands commands;
+    // read-only copy of the context at tgp_end(), its buffers are the ones
+    // above. this is what the backend renders
+    tgp_context view;
+} tgp_frame;
+
 TGPDEF tgp_options  tgp_default_options();
 TGPDEF void         tgp_init_context(tgp_context* ctx, tgp_options* opts);
 TGPDEF void         tgp_destroy_context(tgp_context* ctx);
 TGPDEF void         tgp_begin(tgp_context* ctx, int width, int height);
-TGPDEF tgp_command* tgp_get_command(tgp_context* ctx, uint32_t index);
+TGPDEF void         tgp_end(tgp_context* ctx);
+TGPDEF bool         tgp_frame_available(tgp_context* ctx);
+TGPDEF tgp_context* tgp_acquire_frame(tgp_context* ctx);
+TGPDEF void tgp_release_frame(tgp_context* ctx, tgp_context* frame);
 TGPDEF bool         tgp_get_command_p(tgp_context* ctx, tgp_command* cmd,
                                       uint32_t index);
+TGPDEF tgp_command_iter tgp_command_range(tgp_context* ctx, uint32_t first,
+                                          uint32_t count);
+TGPDEF bool             tgp_range_next(tgp_command_iter* it);
+TGPDEF void         tgp_render(const tgp_backend* backend, tgp_context* frame);
+TGPDEF tgp_backend  tgp_null_backend(tgp_null_stats* stats);
+TGPDEF void tgp_set_flush_backend(tgp_context*       ctx,
+                                  const tgp_backend* backend);
+TGPDEF bool tgp_flush(tgp_context* ctx);
 TGPDEF void tgp_project(tgp_context* ctx, float left, float right, float top,
                         float bottom);
 TGPDEF void tgp_reset_projection(tgp_context* ctx);
@@ -205,6 +840,9 @@ TGPDEF void tgp_rotate(tgp_context* ctx, float theta);
 TGPDEF void tgp_rotate_at(tgp_context* ctx, float theta, float x, float y);
 TGPDEF void tgp_set_color(tgp_context* ctx, float r, float g, float b, float a);
 TGPDEF void tgp_reset_color(tgp_context* ctx);
+TGPDEF uint32_t tgp_intern_pipeline(tgp_context*        ctx,
+                                    const tgp_pipeline* pipeline);
+TGPDEF void     tgp_set_pipeline(tgp_context* ctx, uint32_t pipeline);
 TGPDEF void tgp_viewport(tgp_context* ctx, int x, int y, int w, int h);
 TGPDEF void tgp_reset_viewport(tgp_context* ctx);
 TGPDEF void tgp_scissor(tgp_context* ctx, int x, int y, int w, int h);
@@ -213,11 +851,111 @@ TGPDEF void tgp_reset_state(tgp_context* ctx);
 TGPDEF void tgp_clear(tgp_context* ctx);
 TGPDEF void tgp_draw_vertices(tgp_context* ctx, const tgp_vec2* points,
                               uint32_t num_vertices);
+TGPDEF bool tgp_reserve_draw(tgp_context* ctx, uint32_t num_vertices,
+                             uint32_t num_indices, tgp_vertex** vertices,
+                             tgp_index** indices);
+TGPDEF void tgp_submit_draw(tgp_context* ctx, tgp_region region,
+                            uint32_t num_vertices, uint32_t num_indices,
+                            uint32_t userdata_mask);
+TGPDEF void tgp_submit_shape(tgp_context* ctx, tgp_region region,
+                             uint32_t num_vertices, uint32_t num_indices,
+                             uint32_t userdata_mask);
 TGPDEF void tgp_draw_convex_polygon(tgp_context* ctx, const tgp_vec2* points,
                                     uint32_t num_points);
+TGPDEF void tgp_draw_convex_polygons(tgp_context* ctx, const tgp_vec2* points,
+                                     const uint32_t*  offsets,
+                                     const tgp_color* colors,
+                                     uint32_t         num_polygons);
+TGPDEF void tgp_read_points(const tgp_point_layout* layout, const void* data,
+                            uint32_t count, tgp_vec2* out);
+TGPDEF void tgp_begin_polygon(tgp_context* ctx);
+TGPDEF void tgp_polygon_points(tgp_context* ctx, const tgp_vec2* points,
+                               uint32_t count);
+TGPDEF void tgp_polygon_points_strided(tgp_context*            ctx,
+                                       const tgp_point_layout* layout,
+                                       const void* data, uint32_t count);
+TGPDEF void tgp_end_polygon(tgp_context* ctx);
+TGPDEF void tgp_draw_rect(tgp_context* ctx, tgp_rect rect);
+TGPDEF void tgp_draw_rects(tgp_context* ctx, const tgp_rect* rects,
+                           const tgp_color* colors, uint32_t num_rects);
+TGPDEF const tgp_index* tgp_rect_index_pattern(bool      antialiased,
+                                               uint32_t* num_indices,
+                                               uint32_t* num_vertices);
+TGPDEF void             tgp_clear_tess_cache(tgp_context* ctx);
+TGPDEF void tgp_init_shared(tgp_shared* shared, uint32_t max_readers);
+TGPDEF void tgp_destroy_shared(tgp_shared* shared);
+TGPDEF bool tgp_shared_put(tgp_shared* shared, uint64_t key,
+                           const tgp_vec2* positions, const float* alphas,
+                           uint32_t num_vertices, const tgp_index* indices,
+                           uint32_t num_indices);
+TGPDEF bool tgp_shared_put_convex_polygon(tgp_shared* shared, uint64_t key,
+                                          const tgp_vec2* points,
+                                          uint32_t        num_points,
+                                          bool            antialiasing,
+                                          float           fringe_scale);
+TGPDEF void     tgp_shared_remove(tgp_shared* shared, uint64_t key);
+TGPDEF void     tgp_shared_publish(tgp_shared* shared);
+TGPDEF uint32_t tgp_shared_collect(tgp_shared* shared);
+TGPDEF bool     tgp_use_shared(tgp_context* ctx, tgp_shared* shared);
+TGPDEF const tgp_shared_mesh* tgp_find_shared(tgp_context* ctx, uint64_t key);
+TGPDEF bool                   tgp_draw_shared(tgp_context* ctx, uint64_t key);
+#ifdef TINYGP_BOX_SHADOWS
+TGPDEF void  tgp_draw_box_shadow(tgp_context* ctx, tgp_rect rect, float radius,
+                                 float blur, float spread, tgp_vec2 offset);
+TGPDEF float tgp_box_shadow_alpha(tgp_vec2 point, tgp_vec2 half_size,
+                                  float radius, float sigma);
+#endif
 TGPDEF void tgp_path_clear(tgp_context* ctx);
 TGPDEF void tgp_path_to(tgp_context* ctx, tgp_vec2 point);
 TGPDEF void tgp_path_to_merge_duplicate(tgp_context* ctx, tgp_vec2 point);
+TGPDEF void tgp_path_decimate(tgp_context* ctx, const tgp_vec2* points,
+                              uint32_t count);
+TGPDEF void tgp_path_simplify(tgp_context* ctx, const tgp_vec2* points,
+                              uint32_t count, float tolerance);
+TGPDEF void tgp_path_decimate_strided(tgp_context*            ctx,
+                                      const tgp_point_layout* layout,
+                                      const void* data, uint32_t count);
+TGPDEF void tgp_path_simplify_strided(tgp_context*            ctx,
+                                      const tgp_point_layout* layout,
+                                      const void* data, uint32_t count,
+                                      float tolerance);
+TGPDEF void tgp_path_flush(tgp_context* ctx);
+TGPDEF void tgp_fill_path(tgp_context* ctx, tgp_fill_rule rule);
+TGPDEF bool tgp_rasterize_path(tgp_context* ctx, tgp_fill_rule rule,
+                               tgp_image* image);
+
+TGPDEF const tgp_irect* tgp_get_damage(tgp_context* ctx, uint32_t* count);
+TGPDEF void             tgp_invalidate_damage(tgp_context* ctx);
+TGPDEF tgp_irect        tgp_region_to_irect(tgp_region region,
+                                            tgp_irect  viewport);
+
+TGPDEF void     tgp_set_id(tgp_context* ctx, uint32_t id);
+TGPDEF uint32_t tgp_hit_test_point(tgp_context* ctx, float x, float y);
+TGPDEF uint32_t tgp_hit_test_rect(tgp_context* ctx, tgp_rect rect,
+                                  uint32_t* ids, uint32_t max_ids);
+
+TGPDEF bool tgp_begin_layer(tgp_context* ctx, uint32_t id, int w, int h);
+TGPDEF bool tgp_begin_layer_samples(tgp_context* ctx, uint32_t id, int w,
+                                    int h, uint32_t samples);
+TGPDEF void tgp_end_layer(tgp_context* ctx);
+TGPDEF void tgp_invalidate_layer(tgp_context* ctx, uint32_t id);
+TGPDEF void tgp_release_layer(tgp_context* ctx, uint32_t id);
+TGPDEF void tgp_draw_layer(tgp_context* ctx, uint32_t id, float x, float y,
+                           float w, float h);
+
+TGPDEF size_t tgp_capture_size(tgp_context* ctx);
+TGPDEF size_t tgp_capture_frame_to_memory(tgp_context* ctx, void* buffer,
+                                          size_t size);
+TGPDEF bool   tgp_init_replay_context(tgp_context* ctx, const void* data,
+                                      size_t size);
+TGPDEF void   tgp_map_replay_handles(tgp_context*          ctx,
+                                     const tgp_handle_map* shaders,
+                                     uint32_t              num_shaders,
+                                     const tgp_handle_map* textures,
+                                     uint32_t              num_textures);
+#ifndef TINYGP_NO_STDIO
+TGPDEF bool tgp_capture_frame(tgp_context* ctx, const char* path);
+#endif
 
 /***** implementation *****/
 // #ifdef TINYGP_IMPLEMENTATION
@@ -227,14 +965,49 @@ static const tgp_mat2x3 tgp_default_transform = {
 };
 
 TGPDEF tgp_options tgp_default_options() {
-    return (tgp_options){
-        .max_vertices = 65536,
-        .max_indices = 65536 * 3,
-        .max_path = 16384,
-        .max_commands = 16384,
-        .antialiasing = true,
-        .fringe_scale = 1.0f,
-    };
+    tgp_options options;
+    memset(&options, 0, sizeof(options));
+    options.max_vertices = 65536;
+    options.max_indices = 65536 * 3;
+    options.max_path = 16384;
+    options.max_commands = 16384;
+    options.antialiasing = true;
+    options.fringe_scale = 1.0f;
+    options.msaa_samples = 0;
+    options.damage_tracking = false;
+    options.gpu_projection = false;
+    options.tess_cache_entries = 0;
+    options.frame_slots = 1;
+    options.max_hit_shapes = 0;
+    options.hit_geometry = false;
+    return options;
+}
+
+static void tgp_alloc_commands(tgp_commands* commands, uint32_t count) {
+    commands->keys =
+        (tgp_command_key*)malloc(count * sizeof(tgp_command_key));
+    commands->data =
+        (tgp_command_data*)malloc(count * sizeof(tgp_command_data));
+    TINYGP_ASSERT(commands->keys != NULL && commands->data != NULL);
+#ifdef TINYGP_USERDATA_TYPE
+    commands->userdata =
+        (TINYGP_USERDATA_TYPE*)malloc(count * sizeof(TINYGP_USERDATA_TYPE));
+    TINYGP_ASSERT(commands->userdata != NULL);
+#endif
+}
+
+static void tgp_free_commands(tgp_commands* commands) {
+    if (commands->keys != NULL) {
+        free(commands->keys);
+    }
+    if (commands->data != NULL) {
+        free(commands->data);
+    }
+#ifdef TINYGP_USERDATA_TYPE
+    if (commands->userdata != NULL) {
+        free(commands->userdata);
+    }
+#endif
 }
 
 TGPDEF void tgp_init_context(tgp_context* ctx, tgp_options* opts) {
@@ -244,28 +1017,147 @@ TGPDEF void tgp_init_context(tgp_context* ctx, tgp_options* opts) {
     ctx->max_indices = opts->max_indices;
     ctx->max_path = opts->max_path;
     ctx->max_commands = opts->max_commands;
-    ctx->antialiasing = opts->antialiasing;
+    ctx->fringe_antialiasing = opts->antialiasing;
+    ctx->msaa_samples = opts->msaa_samples > 1 ? opts->msaa_samples : 0;
+    ctx->antialiasing = opts->antialiasing && ctx->msaa_samples == 0;
     ctx->fringe_scale = opts->fringe_scale;
+    ctx->gpu_projection = opts->gpu_projection;
+    ctx->num_pipelines = 1; // the default one, all zero
 
     // allocate buffers
-    ctx->vertices = malloc(opts->max_vertices * sizeof(tgp_vertex));
-    ctx->indices = malloc(opts->max_indices * sizeof(tgp_index));
-    ctx->path = malloc(opts->max_path * sizeof(tgp_vec2));
-    ctx->commands = malloc(opts->max_commands * sizeof(tgp_command));
-    TINYGP_ASSERT(ctx->vertices != NULL && ctx->indices != NULL &&
-                  ctx->path != NULL && ctx->commands != NULL);
+    ctx->path = (tgp_vec2*)malloc(opts->max_path * sizeof(tgp_vec2));
+    TINYGP_ASSERT(ctx->path != NULL);
+    if (opts->frame_slots > 1) {
+        // every slot has its own buffers, tgp_begin() picks one of them
+        ctx->num_frames = opts->frame_slots;
+        ctx->frames = (tgp_frame*)calloc(opts->frame_slots, sizeof(tgp_frame));
+        TINYGP_ASSERT(ctx->frames != NULL);
+        for (uint32_t i = 0; i < ctx->num_frames; i++) {
+            tgp_frame* frame = &ctx->frames[i];
+            frame->vertices =
+                (tgp_vertex*)malloc(opts->max_vertices * sizeof(tgp_vertex));
+            frame->indices =
+                (tgp_index*)malloc(opts->max_indices * sizeof(tgp_index));
+            tgp_alloc_commands(&frame->commands, opts->max_commands);
+            TINYGP_ASSERT(frame->vertices != NULL && frame->indices != NULL);
+        }
+    } else {
+        ctx->vertices =
+            (tgp_vertex*)malloc(opts->max_vertices * sizeof(tgp_vertex));
+        ctx->indices =
+            (tgp_index*)malloc(opts->max_indices * sizeof(tgp_index));
+        tgp_alloc_commands(&ctx->commands, opts->max_commands);
+        TINYGP_ASSERT(ctx->vertices != NULL && ctx->indices != NULL);
+    }
+
+    ctx->damage_tracking = opts->damage_tracking;
+    ctx->damage_all = true;
+    if (ctx->damage_tracking) {
+        ctx->hashes = (tgp_command_hash*)malloc(opts->max_commands *
+                                                sizeof(tgp_command_hash));
+        ctx->prev_hashes = (tgp_command_hash*)malloc(
+            opts->max_commands * sizeof(tgp_command_hash));
+        TINYGP_ASSERT(ctx->hashes != NULL && ctx->prev_hashes != NULL);
+    }
+
+    if (opts->tess_cache_entries > 0) {
+        // round up to whole sets
+        const uint32_t n =
+            (opts->tess_cache_entries + TGP_TESS_CACHE_WAYS - 1) /
+            TGP_TESS_CACHE_WAYS * TGP_TESS_CACHE_WAYS;
+        ctx->tess_cache_entries = n;
+        ctx->tess_cache =
+            (tgp_tess_cache_entry*)calloc(n, sizeof(tgp_tess_cache_entry));
+        ctx->tess_cache_points =
+            (tgp_vec2*)malloc(n * TGP_TESS_CACHE_MAX_POINTS * sizeof(tgp_vec2));
+        ctx->tess_cache_positions = (tgp_vec2*)malloc(
+            n * TGP_TESS_CACHE_MAX_VERTICES * sizeof(tgp_vec2));
+        ctx->tess_cache_indices = (tgp_index*)malloc(
+            n * TGP_TESS_CACHE_MAX_INDICES * sizeof(tgp_index));
+        TINYGP_ASSERT(ctx->tess_cache != NULL &&
+                      ctx->tess_cache_points != NULL &&
+                      ctx->tess_cache_positions != NULL &&
+                      ctx->tess_cache_indices != NULL);
+    }
+
+    if (opts->max_hit_shapes > 0) {
+        const uint32_t n = opts->max_hit_shapes;
+        ctx->max_hit_shapes = n;
+        ctx->hit_shapes = (tgp_hit_shape*)malloc(n * sizeof(tgp_hit_shape));
+        ctx->hit_nodes = (tgp_hit_node*)malloc(2 * n * sizeof(tgp_hit_node));
+        ctx->hit_order = (uint32_t*)malloc(2 * n * sizeof(uint32_t));
+        ctx->hit_keys = (uint32_t*)malloc(2 * n * sizeof(uint32_t));
+        TINYGP_ASSERT(ctx->hit_shapes != NULL && ctx->hit_nodes != NULL &&
+                      ctx->hit_order != NULL && ctx->hit_keys != NULL);
+        ctx->hit_geometry = opts->hit_geometry;
+        if (ctx->hit_geometry) {
+            ctx->hit_positions =
+                (tgp_vec2*)malloc(opts->max_vertices * sizeof(tgp_vec2));
+            ctx->hit_indices =
+                (tgp_index*)malloc(opts->max_indices * sizeof(tgp_index));
+            TINYGP_ASSERT(ctx->hit_positions != NULL &&
+                          ctx->hit_indices != NULL);
+        }
+    }
 
     ctx->transform = tgp_default_transform;
 }
 
 TGPDEF void tgp_destroy_context(tgp_context* ctx) {
     if (ctx != NULL) {
-        if (ctx->vertices != NULL) {
-            free(ctx->vertices);
+        if (ctx->frames != NULL) {
+            for (uint32_t i = 0; i < ctx->num_frames; i++) {
+                free(ctx->frames[i].vertices);
+                free(ctx->frames[i].indices);
+                tgp_free_commands(&ctx->frames[i].commands);
+            }
+            free(ctx->frames);
+            // the buffers belonged to a slot
+            ctx->vertices = NULL;
+            ctx->indices = NULL;
+            memset(&ctx->commands, 0, sizeof(ctx->commands));
+        }
+        if (!ctx->external_buffers) {
+            if (ctx->vertices != NULL) {
+                free(ctx->vertices);
+            }
+            if (ctx->indices != NULL) {
+                free(ctx->indices);
+            }
+            if (ctx->path != NULL) {
+                free(ctx->path);
+            }
+            tgp_free_commands(&ctx->commands);
+        }
+        if (ctx->hashes != NULL) {
+            free(ctx->hashes);
         }
-        if (ctx->commands != NULL) {
-            free(ctx->commands);
+        if (ctx->prev_hashes != NULL) {
+            free(ctx->prev_hashes);
         }
+        if (ctx->tess_cache != NULL) {
+            free(ctx->tess_cache);
+            free(ctx->tess_cache_points);
+            free(ctx->tess_cache_positions);
+            free(ctx->tess_cache_indices);
+        }
+        if (ctx->hit_shapes != NULL) {
+            free(ctx->hit_shapes);
+            free(ctx->hit_nodes);
+            free(ctx->hit_order);
+            free(ctx->hit_keys);
+            free(ctx->hit_positions);
+            free(ctx->hit_indices);
+        }
+        free(ctx->tess_positions);
+#ifdef TINYGP_OPAQUE_PASS
+        free(ctx->split_scratch);
+#endif
+        free(ctx->raster_edges);
+        free(ctx->raster_active);
+        free(ctx->raster_cells);
+        free(ctx->flush_backend);
+        tgp_use_shared(ctx, NULL);
         free(ctx);
     }
 }
@@ -274,7 +1166,7 @@ static inline tgp_mat2x3 tgp_mult_proj_and_transform_matrices(tgp_mat2x3* p,
                                                               tgp_mat2x3* t) {
     float x = p->v[0][0];
     float y = p->v[1][1];
-    return (tgp_mat2x3){
+    return TGP_LITERAL(tgp_mat2x3){
         {
          {x * t->v[0][0], x * t->v[0][1], x * t->v[0][2] + p->v[0][2]},
          {y * t->v[1][0], y * t->v[1][1], y * t->v[1][2] + p->v[1][2]},
@@ -282,36 +1174,50 @@ static inline tgp_mat2x3 tgp_mult_proj_and_transform_matrices(tgp_mat2x3* p,
     };
 }
 
+static inline tgp_vec2 tgp_mult_mat3_vec2(const tgp_mat2x3* m, tgp_vec2 v) {
+    return TGP_LITERAL(tgp_vec2){
+        m->v[0][0] * v.x + m->v[0][1] * v.y + m->v[0][2],
+        m->v[1][0] * v.x + m->v[1][1] * v.y + m->v[1][2]};
+}
+
 static inline void tgp_update_mvp(tgp_context* ctx) {
     TINYGP_ASSERT(ctx != NULL);
     ctx->mvp =
         tgp_mult_proj_and_transform_matrices(&ctx->proj, &ctx->transform);
 }
 
+static void tgp_update_projection(tgp_context* ctx);
+
 TGPDEF void tgp_project(tgp_context* ctx, float left, float right, float top,
                         float bottom) {
     TINYGP_ASSERT(ctx != NULL);
+    if (ctx->skip_layer) {
+        return;
+    }
     float w = right - left;
     float h = top - bottom;
-    ctx->proj = (tgp_mat2x3){
+    ctx->proj = TGP_LITERAL(tgp_mat2x3){
         {
          {2.0f / w, 0.0f, -(right + left) / w},
          {0.0f, 2.0f / h, -(top + bottom) / h},
          }
     };
-    tgp_update_mvp(ctx);
+    tgp_update_projection(ctx);
 }
 
 static inline tgp_mat2x3 tgp_default_projection(int w, int h) {
     TINYGP_ASSERT(w > 0 && h > 0);
-    return (tgp_mat2x3){
+    return TGP_LITERAL(tgp_mat2x3){
         {{2.0f / (float)w, 0.0f, -1.0f}, {0.0f, -2.0f / (float)h, 1.0f}}
     };
 }
 
 TGPDEF void tgp_reset_projection(tgp_context* ctx) {
+    if (ctx->skip_layer) {
+        return;
+    }
     ctx->proj = tgp_default_projection(ctx->viewport.w, ctx->viewport.h);
-    tgp_update_mvp(ctx);
+    tgp_update_projection(ctx);
 }
 
 TGPDEF void tgp_push_transform(tgp_context* ctx) {
@@ -363,7 +1269,7 @@ TGPDEF void tgp_rotate(tgp_context* ctx, float theta) {
     // c   | -s  | 0.0
     // s   | c   | 0.0
     // 0.0 | 0.0 | 1.0
-    ctx->transform = (tgp_mat2x3){
+    ctx->transform = TGP_LITERAL(tgp_mat2x3){
         {{c * ctx->transform.v[0][0] + s * ctx->transform.v[0][1],
           -s * ctx->transform.v[0][0] + c * ctx->transform.v[0][1],
           ctx->transform.v[0][2]},
@@ -382,7 +1288,7 @@ TGPDEF void tgp_rotate_at(tgp_context* ctx, float theta, float x, float y) {
 
 TGPDEF void tgp_set_color(tgp_context* ctx, float r, float g, float b,
                           float a) {
-    ctx->color = (tgp_color){r, g, b, a};
+    ctx->color = TGP_LITERAL(tgp_color){r, g, b, a};
 }
 
 TGPDEF void tgp_reset_color(tgp_context* ctx) {
@@ -392,13 +1298,64 @@ TGPDEF void tgp_reset_color(tgp_context* ctx) {
     ctx->color.a = 1.0f;
 }
 
+// returns the index of `pipeline` for tgp_set_pipeline(), adding it if it
+// was not interned before. indices stay the same for the lifetime of the
+// context, so this is meant to be called once per pipeline and not every
+// frame. returns 0 (the default pipeline) if TGP_MAX_PIPELINES are in use
+TGPDEF uint32_t tgp_intern_pipeline(tgp_context*        ctx,
+                                    const tgp_pipeline* pipeline) {
+    TINYGP_ASSERT(ctx != NULL && pipeline != NULL);
+    for (uint32_t i = 0; i < ctx->num_pipelines; i++) {
+        if (memcmp(&ctx->pipelines[i], pipeline, sizeof(tgp_pipeline)) == 0) {
+            return i;
+        }
+    }
+    TINYGP_ASSERT(ctx->num_pipelines < TGP_MAX_PIPELINES);
+    if (ctx->num_pipelines >= TGP_MAX_PIPELINES) {
+        return 0;
+    }
+    ctx->pipelines[ctx->num_pipelines] = *pipeline;
+    return ctx->num_pipelines++;
+}
+
+// draws after this use the pipeline returned by tgp_intern_pipeline()
+TGPDEF void tgp_set_pipeline(tgp_context* ctx, uint32_t pipeline) {
+    TINYGP_ASSERT(ctx != NULL && pipeline < ctx->num_pipelines);
+    ctx->cur_pipeline = pipeline;
+}
+
+static bool tgp_flush_part(tgp_context* ctx);
+
+// true if a draw of this size fits into the buffers. with a flush backend
+// its command has to fit too, so the draw is never dropped after its
+// geometry was written
+static inline bool tgp_fits(tgp_context* ctx, uint32_t vtx_count,
+                            uint32_t idx_count) {
+    return ctx->cur_vertex + vtx_count <= ctx->max_vertices &&
+           ctx->cur_index + idx_count <= ctx->max_indices &&
+           (ctx->flush_backend == NULL || ctx->cur_command < ctx->max_commands);
+}
+
+// like tgp_fits(), but flushes the buffers to make room if there is a flush
+// backend (see tgp_flush()). polygons that are being streamed in flush
+// themselves, see tgp_polygon_stream_add()
+static inline bool tgp_has_room(tgp_context* ctx, uint32_t vtx_count,
+                                uint32_t idx_count) {
+    if (tgp_fits(ctx, vtx_count, idx_count)) {
+        return true;
+    }
+    return !ctx->polygon_stream.active && tgp_flush_part(ctx) &&
+           tgp_fits(ctx, vtx_count, idx_count);
+}
+
+// the buffers may be flushed to make room, so offsets into them are only
+// valid after this
 static inline bool tgp_reserve(tgp_context* ctx, uint32_t vtx_count,
                                uint32_t idx_count, tgp_vertex** vtx_write_ptr,
                                tgp_index** idx_write_ptr) {
     TINYGP_ASSERT(ctx != NULL);
-    if (ctx->cur_vertex + vtx_count > ctx->max_vertices ||
-        ctx->cur_index + idx_count > ctx->max_indices) {
-        // TODO: add an error here
+    if (!tgp_has_room(ctx, vtx_count, idx_count)) {
+        ctx->num_dropped++;
         return false;
     }
 
@@ -411,26 +1368,80 @@ static inline bool tgp_reserve(tgp_context* ctx, uint32_t vtx_count,
     return true;
 }
 
-static inline tgp_command* tgp_peek_prev_commands(tgp_context* ctx,
-                                                  uint32_t     count) {
+// commands are referred to by their key while they are recorded, see
+// tgp_command_data_of()
+static inline tgp_command_key* tgp_peek_prev_commands(tgp_context* ctx,
+                                                      uint32_t     count) {
     TINYGP_ASSERT(ctx != NULL);
     if (count <= ctx->cur_command) {
-        return &ctx->commands[ctx->cur_command - count];
+        return &ctx->commands.keys[ctx->cur_command - count];
     }
     return NULL;
 }
 
-static inline tgp_command* tgp_next_command(tgp_context* ctx) {
+static inline tgp_command_key* tgp_next_command(tgp_context*     ctx,
+                                                tgp_command_type type) {
     TINYGP_ASSERT(ctx != NULL);
-    if (ctx->cur_command < ctx->max_commands) {
+    // draws make sure their command fits before they write any geometry
+    // (see tgp_fits()), so only state commands get here with full buffers
+    if (ctx->cur_command < ctx->max_commands ||
+        (!ctx->polygon_stream.active && tgp_flush_part(ctx))) {
         ctx->cur_cmd_vertex = 0;
         ctx->cur_cmd_index = 0;
-        return &ctx->commands[ctx->cur_command++];
+        tgp_command_key* key = &ctx->commands.keys[ctx->cur_command++];
+        memset(key, 0, sizeof(*key));
+        key->type = (uint8_t)type;
+        return key;
     }
-    // TODO: add an error here
+    ctx->num_dropped++;
     return NULL;
 }
 
+static inline uint32_t tgp_command_index(tgp_context*           ctx,
+                                         const tgp_command_key* key) {
+    return (uint32_t)(key - ctx->commands.keys);
+}
+
+static inline tgp_command_data*
+tgp_command_data_of(tgp_context* ctx, const tgp_command_key* key) {
+    return &ctx->commands.data[tgp_command_index(ctx, key)];
+}
+
+#ifdef TINYGP_USERDATA_TYPE
+static inline TINYGP_USERDATA_TYPE*
+tgp_command_userdata_of(tgp_context* ctx, const tgp_command_key* key) {
+    return &ctx->commands.userdata[tgp_command_index(ctx, key)];
+}
+#endif
+
+// gives a new draw command the current pipeline and userdata
+static inline void tgp_set_draw_state(tgp_context* ctx, tgp_command_key* key) {
+    key->pipeline = ctx->cur_pipeline;
+#ifdef TINYGP_USERDATA_TYPE
+    *tgp_command_userdata_of(ctx, key) = ctx->current_userdata;
+#endif
+}
+
+// must be called after changing ctx->proj
+static void tgp_update_projection(tgp_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL);
+    tgp_update_mvp(ctx);
+    if (!ctx->gpu_projection) {
+        return;
+    }
+
+    // the backend needs to know about the new projection, reuse the
+    // previous command if it was a projection command too
+    tgp_command_key* key = tgp_peek_prev_commands(ctx, 1);
+    if (key == NULL || key->type != TGP_COMMAND_PROJECTION) {
+        key = tgp_next_command(ctx, TGP_COMMAND_PROJECTION);
+        if (key == NULL) {
+            return;
+        }
+    }
+    tgp_command_data_of(ctx, key)->projection = ctx->proj;
+}
+
 TGPDEF void tgp_viewport(tgp_context* ctx, int x, int y, int w, int h) {
     TINYGP_ASSERT(ctx != NULL);
     // don't do anything if the viewport is already the same
@@ -438,22 +1449,24 @@ TGPDEF void tgp_viewport(tgp_context* ctx, int x, int y, int w, int h) {
         ctx->viewport.h == h) {
         return;
     }
+    // the layer is not recorded, its state must not leak to the screen
+    if (ctx->skip_layer) {
+        return;
+    }
 
     // if the previous command was an another viewport command, we can just
-    tgp_command* cmd = tgp_peek_prev_commands(ctx, 1);
+    tgp_command_key* key = tgp_peek_prev_commands(ctx, 1);
 
-    if (cmd == NULL || cmd->type != TGP_COMMAND_VIEWPORT) {
+    if (key == NULL || key->type != TGP_COMMAND_VIEWPORT) {
         // not a viewport command, create a new one
-        cmd = tgp_next_command(ctx);
-        if (cmd == NULL) {
+        key = tgp_next_command(ctx, TGP_COMMAND_VIEWPORT);
+        if (key == NULL) {
             return;
         }
     }
 
     tgp_irect viewport = {x, y, w, h};
-    memset(cmd, 0, sizeof(*cmd));
-    cmd->type = TGP_COMMAND_VIEWPORT;
-    cmd->data.viewport = viewport;
+    tgp_command_data_of(ctx, key)->viewport = viewport;
 
     // offset the scissor position
     if (ctx->scissor.w >= 0 && ctx->scissor.h >= 0) {
@@ -463,7 +1476,7 @@ TGPDEF void tgp_viewport(tgp_context* ctx, int x, int y, int w, int h) {
 
     ctx->viewport = viewport;
     ctx->proj = tgp_default_projection(w, h);
-    tgp_update_mvp(ctx);
+    tgp_update_projection(ctx);
 }
 
 TGPDEF void tgp_reset_viewport(tgp_context* ctx) {
@@ -478,6 +1491,9 @@ TGPDEF void tgp_scissor(tgp_context* ctx, int x, int y, int w, int h) {
         ctx->scissor.h == h) {
         return;
     }
+    if (ctx->skip_layer) {
+        return;
+    }
 
     // offset the scissor x and y coordinates by the viewport coordinates
     tgp_irect offset_scissor = {ctx->viewport.x + x, ctx->viewport.y + y, w, h};
@@ -489,18 +1505,16 @@ TGPDEF void tgp_scissor(tgp_context* ctx, int x, int y, int w, int h) {
     }
 
     // try to reuse previous command
-    tgp_command* cmd = tgp_peek_prev_commands(ctx, 1);
-    if (cmd == NULL || cmd->type != TGP_COMMAND_SCISSOR) {
-        cmd = tgp_next_command(ctx);
-        if (cmd == NULL) {
+    tgp_command_key* key = tgp_peek_prev_commands(ctx, 1);
+    if (key == NULL || key->type != TGP_COMMAND_SCISSOR) {
+        key = tgp_next_command(ctx, TGP_COMMAND_SCISSOR);
+        if (key == NULL) {
             return;
         }
     }
-    memset(cmd, 0, sizeof(*cmd));
-    cmd->type = TGP_COMMAND_SCISSOR;
-    cmd->data.scissor = offset_scissor;
+    tgp_command_data_of(ctx, key)->scissor = offset_scissor;
 
-    ctx->scissor = (tgp_irect){x, y, w, h};
+    ctx->scissor = TGP_LITERAL(tgp_irect){x, y, w, h};
 }
 
 TGPDEF void tgp_reset_scissor(tgp_context* ctx) {
@@ -511,16 +1525,215 @@ TGPDEF void tgp_reset_scissor(tgp_context* ctx) {
 TGPDEF void tgp_reset_state(tgp_context* ctx) {
     TINYGP_ASSERT(ctx != NULL);
     tgp_reset_color(ctx);
+    tgp_set_pipeline(ctx, 0);
     tgp_reset_projection(ctx);
     tgp_reset_scissor(ctx);
     tgp_reset_transform(ctx);
     tgp_reset_viewport(ctx);
 }
 
+// frame slot states are shared between the recording and the rendering
+// thread
+static inline uint32_t tgp_atomic_load(uint32_t* p) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+#else
+    // volatile accesses have acquire/release semantics with MSVC
+    return *(volatile uint32_t*)p;
+#endif
+}
+
+static inline void tgp_atomic_store(uint32_t* p, uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+#else
+    *(volatile uint32_t*)p = value;
+#endif
+}
+
+static inline bool tgp_atomic_cas(uint32_t* p, uint32_t expected,
+                                  uint32_t desired) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_compare_exchange_n(p, &expected, desired, false,
+                                       __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+#elif defined(_MSC_VER)
+    return _InterlockedCompareExchange((volatile long*)p, (long)desired,
+                                       (long)expected) == (long)expected;
+#else
+    // no atomics, the frames can only be used from a single thread
+    if (*p != expected) {
+        return false;
+    }
+    *p = desired;
+    return true;
+#endif
+}
+
+// the shared mesh registry also needs pointers and stores that are ordered
+// before later loads
+static inline void* tgp_atomic_load_ptr(void** p) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+#else
+    return *(void* volatile*)p;
+#endif
+}
+
+static inline void tgp_atomic_store_ptr(void** p, void* value) {
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+#elif defined(_MSC_VER)
+    _InterlockedExchangePointer(p, value);
+#else
+    *p = value;
+#endif
+}
+
+// adds `value` to `*p` and returns the new value
+static inline uint32_t tgp_atomic_add(uint32_t* p, uint32_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+    return __atomic_add_fetch(p, value, __ATOMIC_SEQ_CST);
+#elif defined(_MSC_VER)
+    return (uint32_t)_InterlockedExchangeAdd((volatile long*)p, (long)value) +
+           value;
+#else
+    return *p += value;
+#endif
+}
+
+// orders the stores before it before the loads after it
+static inline void tgp_atomic_fence(void) {
+#if defined(__GNUC__) || defined(__clang__)
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+#elif defined(_MSC_VER)
+    // interlocked functions are full barriers
+    long barrier = 0;
+    _InterlockedExchange(&barrier, 0);
+#endif
+}
+
+// called between the passes of tgp_begin() over the frame slots while every
+// slot is being rendered. it spins briefly for a release that is about to
+// happen, then gives the core to the rendering thread
+static inline void tgp_wait_for_frame(uint32_t pass) {
+    if (pass < 64) {
+#ifdef TINYGP_ENABLE_SSE
+        _mm_pause();
+#endif
+        return;
+    }
+#if defined(__unix__) || defined(__APPLE__)
+    sched_yield();
+#elif defined(TINYGP_ENABLE_SSE)
+    _mm_pause();
+#endif
+}
+
+// returns true if tgp_begin() can get a free frame slot. if there is none,
+// tgp_begin() drops the oldest frame that was not acquired yet, or blocks
+// until tgp_release_frame() if every slot is being rendered
+TGPDEF bool tgp_frame_available(tgp_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL);
+    if (ctx->frames == NULL || ctx->cur_frame != NULL) {
+        return true;
+    }
+    for (uint32_t i = 0; i < ctx->num_frames; i++) {
+        if (tgp_atomic_load(&ctx->frames[i].state) == TGP_FRAME_FREE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// layers are recorded once and drawn from the backend's copy afterwards, so
+// the ones a dropped frame would have rendered have to be recorded again
+static void tgp_invalidate_frame_layers(tgp_context* ctx, tgp_frame* frame) {
+    tgp_context* view = &frame->view;
+    for (uint32_t i = 0; i < view->cur_command; i++) {
+        const tgp_command_key* key = &view->commands.keys[i];
+        if (key->type == TGP_COMMAND_BEGIN_LAYER) {
+            tgp_invalidate_layer(ctx, tgp_command_data_of(view, key)->layer.id);
+        }
+    }
+}
+
+// picks the slot the next frame is recorded into, waiting for the backend
+// if it renders every slot
+static void tgp_begin_frame(tgp_context* ctx) {
+    for (uint32_t pass = 0; ctx->cur_frame == NULL; pass++) {
+        if (pass > 0) {
+            tgp_wait_for_frame(pass);
+        }
+        // only this thread makes free slots used, so no need for a cas. the
+        // backend may release one at any time, so look again on every try
+        for (uint32_t i = 0; i < ctx->num_frames; i++) {
+            tgp_frame* frame = &ctx->frames[i];
+            if (tgp_atomic_load(&frame->state) == TGP_FRAME_FREE) {
+                tgp_atomic_store(&frame->state, TGP_FRAME_RECORDING);
+                ctx->cur_frame = frame;
+                break;
+            }
+        }
+        if (ctx->cur_frame != NULL) {
+            break;
+        }
+
+        // every slot is in use, drop the oldest frame the backend did not
+        // acquire yet. it may be acquired (and released) while we look, or
+        // every slot may be rendered, so try again then
+        tgp_frame* oldest = NULL;
+        for (uint32_t i = 0; i < ctx->num_frames; i++) {
+            tgp_frame* frame = &ctx->frames[i];
+            if (tgp_atomic_load(&frame->state) == TGP_FRAME_READY &&
+                (oldest == NULL || frame->sequence < oldest->sequence)) {
+                oldest = frame;
+            }
+        }
+        if (oldest != NULL && tgp_atomic_cas(&oldest->state, TGP_FRAME_READY,
+                                             TGP_FRAME_RECORDING)) {
+            ctx->cur_frame = oldest;
+            // the damage of the next frame was going to be relative to the
+            // dropped one
+            ctx->damage_all = true;
+            tgp_invalidate_frame_layers(ctx, oldest);
+        }
+#if !defined(__GNUC__) && !defined(__clang__) && !defined(_MSC_VER)
+        // without atomics there is no other thread that could release a
+        // slot, tgp_release_frame() has to be called before tgp_begin()
+        TINYGP_ASSERT(ctx->cur_frame != NULL);
+#endif
+    }
+
+    ctx->vertices = ctx->cur_frame->vertices;
+    ctx->indices = ctx->cur_frame->indices;
+    ctx->commands = ctx->cur_frame->commands;
+}
+
+// pins the current table of the registry until tgp_end()
+static void tgp_pin_shared(tgp_context* ctx) {
+    tgp_shared*    shared = ctx->shared;
+    const uint32_t epoch = tgp_atomic_load(&shared->epoch);
+    tgp_atomic_store(&shared->reader_epochs[ctx->shared_reader], epoch);
+    // either tgp_shared_collect() sees the epoch or this sees the table that
+    // was published after it
+    tgp_atomic_fence();
+    ctx->shared_table = (const tgp_shared_table*)tgp_atomic_load_ptr(
+        (void**)&shared->current);
+}
+
+static void tgp_unpin_shared(tgp_context* ctx) {
+    ctx->shared_table = NULL;
+    tgp_atomic_store(&ctx->shared->reader_epochs[ctx->shared_reader], 0);
+}
+
 TGPDEF void tgp_begin(tgp_context* ctx, int width, int height) {
     TINYGP_ASSERT(ctx != NULL);
     static const tgp_color default_color = {1.0, 1.0, 1.0, 1.0};
 
+    if (ctx->frames != NULL) {
+        tgp_begin_frame(ctx);
+    }
+
     ctx->screen_size.w = width;
     ctx->screen_size.h = height;
     ctx->viewport.x = 0;
@@ -534,78 +1747,1002 @@ TGPDEF void tgp_begin(tgp_context* ctx, int width, int height) {
     ctx->mvp = ctx->proj = tgp_default_projection(width, height);
     ctx->transform = tgp_default_transform;
     ctx->color = default_color;
+    ctx->cur_pipeline = 0;
     ctx->cur_command = 0;
     ctx->cur_vertex = 0;
     ctx->cur_cmd_index = 0;
     ctx->cur_cmd_vertex = 0;
     ctx->cur_transform = 0;
     ctx->cur_path = 0;
+    memset(&ctx->path_lod, 0, sizeof(ctx->path_lod));
+    memset(&ctx->polygon_stream, 0, sizeof(ctx->polygon_stream));
     ctx->cur_index = 0;
+    ctx->cur_layer = -1;
+    ctx->skip_layer = false;
+    ctx->draw_order = 0;
+    ctx->cur_id = 0;
+    ctx->num_flushes = 0;
+    ctx->num_dropped = 0;
+    ctx->num_hit_shapes = 0;
+    ctx->num_hit_nodes = 0;
+    ctx->cur_hit_vertex = 0;
+    ctx->cur_hit_index = 0;
+    memset(&ctx->tess_cache_stats, 0, sizeof(ctx->tess_cache_stats));
+    if (ctx->shared != NULL) {
+        tgp_pin_shared(ctx);
+    }
 
     // push a viewport command
     tgp_viewport(ctx, 0, 0, width, height);
 }
 
-TGPDEF tgp_command* tgp_get_command(tgp_context* ctx, uint32_t index) {
+#define TGP_HASH_SEED  0xcbf29ce484222325ull
+#define TGP_HASH_PRIME 0x100000001b3ull
+
+// FNV-1a style hash, consumes 8 bytes at a time
+static inline uint64_t tgp_hash_bytes(uint64_t h, const void* data,
+                                      size_t size) {
+    const uint8_t* p = (const uint8_t*)data;
+    while (size >= 8) {
+        uint64_t k;
+        memcpy(&k, p, 8);
+        h = (h ^ k) * TGP_HASH_PRIME;
+        h ^= h >> 32;
+        p += 8;
+        size -= 8;
+    }
+    while (size-- > 0) {
+        h = (h ^ *p++) * TGP_HASH_PRIME;
+    }
+    return h;
+}
+
+TGPDEF tgp_irect tgp_region_to_irect(tgp_region region, tgp_irect viewport) {
+    // clip space -> window coordinates (same convention as the scissor)
+    const float hw = (float)viewport.w * 0.5f;
+    const float hh = (float)viewport.h * 0.5f;
+    int         x1 = viewport.x + (int)floorf((region.x1 + 1.0f) * hw);
+    int         y1 = viewport.y + (int)floorf((region.y1 + 1.0f) * hh);
+    int         x2 = viewport.x + (int)ceilf((region.x2 + 1.0f) * hw);
+    int         y2 = viewport.y + (int)ceilf((region.y2 + 1.0f) * hh);
+    x1 = TGP_MAX(x1, viewport.x);
+    y1 = TGP_MAX(y1, viewport.y);
+    x2 = TGP_MIN(x2, viewport.x + viewport.w);
+    y2 = TGP_MIN(y2, viewport.y + viewport.h);
+    return TGP_LITERAL(tgp_irect){x1, y1, TGP_MAX(x2 - x1, 0),
+                                  TGP_MAX(y2 - y1, 0)};
+}
+
+static inline tgp_irect tgp_irect_union(tgp_irect a, tgp_irect b) {
+    const int x1 = TGP_MIN(a.x, b.x);
+    const int y1 = TGP_MIN(a.y, b.y);
+    const int x2 = TGP_MAX(a.x + a.w, b.x + b.w);
+    const int y2 = TGP_MAX(a.y + a.h, b.y + b.h);
+    return TGP_LITERAL(tgp_irect){x1, y1, x2 - x1, y2 - y1};
+}
+
+static inline tgp_irect tgp_irect_intersect(tgp_irect a, tgp_irect b) {
+    const int x1 = TGP_MAX(a.x, b.x);
+    const int y1 = TGP_MAX(a.y, b.y);
+    const int x2 = TGP_MIN(a.x + a.w, b.x + b.w);
+    const int y2 = TGP_MIN(a.y + a.h, b.y + b.h);
+    return TGP_LITERAL(tgp_irect){x1, y1, TGP_MAX(x2 - x1, 0),
+                                  TGP_MAX(y2 - y1, 0)};
+}
+
+static inline bool tgp_irects_overlap(tgp_irect a, tgp_irect b) {
+    return a.x < b.x + b.w && b.x < a.x + a.w && a.y < b.y + b.h &&
+           b.y < a.y + a.h;
+}
+
+static void tgp_add_damage(tgp_context* ctx, tgp_irect rect) {
+    if (rect.w <= 0 || rect.h <= 0) {
+        return;
+    }
+
+    // merge with every rectangle that overlaps the new one
+    for (uint32_t i = 0; i < ctx->num_damage;) {
+        if (tgp_irects_overlap(ctx->damage[i], rect)) {
+            rect = tgp_irect_union(ctx->damage[i], rect);
+            ctx->damage[i] = ctx->damage[--ctx->num_damage];
+            i = 0;
+        } else {
+            i++;
+        }
+    }
+
+    if (ctx->num_damage < TGP_MAX_DAMAGE_RECTS) {
+        ctx->damage[ctx->num_damage++] = rect;
+        return;
+    }
+
+    // out of rectangles, merge with the one that grows the least
+    uint32_t best = 0;
+    int64_t  best_growth = INT64_MAX;
+    for (uint32_t i = 0; i < ctx->num_damage; i++) {
+        const tgp_irect u = tgp_irect_union(ctx->damage[i], rect);
+        const int64_t   growth = (int64_t)u.w * u.h -
+                               (int64_t)ctx->damage[i].w * ctx->damage[i].h;
+        if (growth < best_growth) {
+            best_growth = growth;
+            best = i;
+        }
+    }
+    rect = tgp_irect_union(ctx->damage[best], rect);
+    ctx->damage[best] = ctx->damage[--ctx->num_damage];
+    tgp_add_damage(ctx, rect);
+}
+
+static int tgp_compare_command_hashes(const void* a, const void* b) {
+    const uint64_t ha = ((const tgp_command_hash*)a)->hash;
+    const uint64_t hb = ((const tgp_command_hash*)b)->hash;
+    return (ha > hb) - (ha < hb);
+}
+
+static inline uint64_t tgp_hash_vertices(uint64_t h, const tgp_vertex* vertices,
+                                         uint32_t num_vertices) {
+#ifdef TINYGP_OPAQUE_PASS
+    // the depth only depends on how many draws came before, it does not
+    // change what ends up on the screen
+    for (uint32_t i = 0; i < num_vertices; i++) {
+        h = tgp_hash_bytes(h, &vertices[i], offsetof(tgp_vertex, depth));
+    }
+    return h;
+#else
+    return tgp_hash_bytes(h, vertices, num_vertices * sizeof(tgp_vertex));
+#endif
+}
+
+// number of bytes of the data of a state command
+static inline size_t tgp_state_data_size(uint8_t type) {
+    return type == TGP_COMMAND_PROJECTION ? sizeof(tgp_mat2x3)
+                                          : sizeof(tgp_irect);
+}
+
+static uint64_t tgp_hash_command(tgp_context* ctx, uint32_t index,
+                                 tgp_irect rect) {
+    const tgp_command_key*  key = &ctx->commands.keys[index];
+    const tgp_command_data* data = &ctx->commands.data[index];
+    uint64_t h = tgp_hash_bytes(TGP_HASH_SEED, &key->type, sizeof(key->type));
+    h = tgp_hash_bytes(h, &rect, sizeof(rect));
+    switch (key->type) {
+    case TGP_COMMAND_VIEWPORT:
+    case TGP_COMMAND_SCISSOR:
+    case TGP_COMMAND_PROJECTION:
+        h = tgp_hash_bytes(h, data, tgp_state_data_size(key->type));
+        break;
+    case TGP_COMMAND_CLEAR:
+        h = tgp_hash_bytes(h, &data->clear, sizeof(tgp_color));
+        break;
+    case TGP_COMMAND_DRAW_LAYER:
+        // the version changes whenever the contents of the layer do
+        h = tgp_hash_bytes(h, &data->draw_layer.id, sizeof(uint32_t));
+        h = tgp_hash_bytes(h, &data->draw_layer.version, sizeof(uint32_t));
+        // fallthrough
+    case TGP_COMMAND_DRAW: {
+        const tgp_draw_command* draw = &data->draw;
+        h = tgp_hash_vertices(h, &ctx->vertices[draw->vtx_offset],
+                              draw->num_vertices);
+        h = tgp_hash_bytes(h, &ctx->indices[draw->idx_offset],
+                           draw->num_indices * sizeof(tgp_index));
+        break;
+    }
+    case TGP_COMMAND_DRAW_RECTS: {
+        // the indices are implicit
+        const tgp_draw_command* draw = &data->draw_rects.draw;
+        h = tgp_hash_bytes(h, &data->draw_rects.antialiased, sizeof(bool));
+        h = tgp_hash_vertices(h, &ctx->vertices[draw->vtx_offset],
+                              draw->num_vertices);
+        break;
+    }
+    case TGP_COMMAND_FILL_PATH: {
+        const tgp_draw_command* draw = &data->fill_path.draw;
+        h = tgp_hash_bytes(h, &data->fill_path.rule, sizeof(tgp_fill_rule));
+        h = tgp_hash_vertices(h, &ctx->vertices[draw->vtx_offset],
+                              draw->num_vertices);
+        break;
+    }
+    default: break;
+    }
+    h = tgp_hash_bytes(h, &key->pipeline, sizeof(key->pipeline));
+#ifdef TINYGP_USERDATA_TYPE
+    h = tgp_hash_bytes(h, &ctx->commands.userdata[index],
+                       sizeof(TINYGP_USERDATA_TYPE));
+#endif
+    return h;
+}
+
+// the screen is split into this many cells per side to keep track of the
+// order of overlapping commands
+#define TGP_DAMAGE_GRID 16
+
+// folds what was drawn under `rect` before into `h`, then adds `h` to it. the
+// cells remember every command that touched them in order, so commands that
+// swap places do not hash the same as before
+static uint64_t tgp_hash_cells(uint64_t* cells, tgp_irect screen,
+                               tgp_irect rect, uint64_t h) {
+    const int cw = (screen.w + TGP_DAMAGE_GRID - 1) / TGP_DAMAGE_GRID;
+    const int ch = (screen.h + TGP_DAMAGE_GRID - 1) / TGP_DAMAGE_GRID;
+    rect = tgp_irect_intersect(rect, screen);
+    if (rect.w <= 0 || rect.h <= 0) {
+        return h;
+    }
+    const int x1 = rect.x / cw, x2 = (rect.x + rect.w - 1) / cw;
+    const int y1 = rect.y / ch, y2 = (rect.y + rect.h - 1) / ch;
+    const uint64_t own = h;
+    for (int y = y1; y <= y2; y++) {
+        for (int x = x1; x <= x2; x++) {
+            h = tgp_hash_bytes(h, &cells[y * TGP_DAMAGE_GRID + x], 8);
+        }
+    }
+    for (int y = y1; y <= y2; y++) {
+        for (int x = x1; x <= x2; x++) {
+            uint64_t* cell = &cells[y * TGP_DAMAGE_GRID + x];
+            *cell = tgp_hash_bytes(*cell, &own, 8);
+        }
+    }
+    return h;
+}
+
+// hashes every command and compares them against the previous frame to find
+// out which parts of the screen have changed
+static void tgp_update_damage(tgp_context* ctx) {
+    const tgp_irect screen = {0, 0, ctx->screen_size.w, ctx->screen_size.h};
+    tgp_irect       viewport = screen;
+    bool            in_layer = false;
+    // last viewport, scissor and projection
+    tgp_command_data state[3];
+    bool             state_set[3] = {false, true, false};
+    // no scissor is the same as a scissor covering the screen
+    state[1].scissor = screen;
+    uint64_t cells[TGP_DAMAGE_GRID * TGP_DAMAGE_GRID];
+    for (uint32_t i = 0; i < TGP_DAMAGE_GRID * TGP_DAMAGE_GRID; i++) {
+        cells[i] = TGP_HASH_SEED;
+    }
+    ctx->num_hashes = 0;
+    for (uint32_t i = 0; i < ctx->cur_command; i++) {
+        const tgp_command_key* key = &ctx->commands.keys[i];
+        tgp_irect              rect = screen;
+        bool                   draws = true;
+        if (in_layer && key->type != TGP_COMMAND_END_LAYER) {
+            // layer contents are not on the screen, only the draw layer
+            // command that shows them is
+            continue;
+        }
+        switch (key->type) {
+        case TGP_COMMAND_NONE: continue;
+        case TGP_COMMAND_BEGIN_LAYER: in_layer = true; continue;
+        case TGP_COMMAND_END_LAYER: in_layer = false; continue;
+        case TGP_COMMAND_VIEWPORT:
+        case TGP_COMMAND_SCISSOR:
+        case TGP_COMMAND_PROJECTION: {
+            // state commands only matter if they change the state (layers
+            // push commands that restore it)
+            const int s = key->type == TGP_COMMAND_VIEWPORT  ? 0
+                          : key->type == TGP_COMMAND_SCISSOR ? 1
+                                                             : 2;
+            const tgp_command_data* data = &ctx->commands.data[i];
+            const size_t            size = tgp_state_data_size(key->type);
+            if (state_set[s] && memcmp(&state[s], data, size) == 0) {
+                continue;
+            }
+            memcpy(&state[s], data, size);
+            state_set[s] = true;
+            draws = false;
+            if (key->type == TGP_COMMAND_VIEWPORT) {
+                viewport = data->viewport;
+            }
+            break;
+        }
+        case TGP_COMMAND_DRAW:
+        case TGP_COMMAND_DRAW_LAYER:
+        case TGP_COMMAND_DRAW_RECTS:
+        case TGP_COMMAND_FILL_PATH:
+            rect = tgp_region_to_irect(key->region, viewport);
+            break;
+        default: break;
+        }
+        tgp_command_hash* entry = &ctx->hashes[ctx->num_hashes++];
+        entry->hash = tgp_hash_command(ctx, i, rect);
+        entry->rect = rect;
+        if (draws) {
+            // draws and clears depend on what is under them
+            entry->hash = tgp_hash_cells(cells, screen, rect, entry->hash);
+        }
+    }
+    qsort(ctx->hashes, ctx->num_hashes, sizeof(tgp_command_hash),
+          tgp_compare_command_hashes);
+
+    ctx->num_damage = 0;
+    if (ctx->damage_all || ctx->screen_size.w != ctx->prev_screen_size.w ||
+        ctx->screen_size.h != ctx->prev_screen_size.h) {
+        tgp_add_damage(ctx, screen);
+    } else {
+        // both lists are sorted, every command that only exists in one of
+        // the frames damages its rectangle. state commands cover the whole
+        // screen, so changing them damages everything
+        uint32_t a = 0, b = 0;
+        while (a < ctx->num_hashes || b < ctx->num_prev_hashes) {
+            if (b >= ctx->num_prev_hashes ||
+                (a < ctx->num_hashes &&
+                 ctx->hashes[a].hash < ctx->prev_hashes[b].hash)) {
+                tgp_add_damage(ctx, ctx->hashes[a++].rect);
+            } else if (a >= ctx->num_hashes ||
+                       ctx->prev_hashes[b].hash < ctx->hashes[a].hash) {
+                tgp_add_damage(ctx, ctx->prev_hashes[b++].rect);
+            } else {
+                a++;
+                b++;
+            }
+        }
+    }
+
+    // the current frame becomes the previous one
+    tgp_command_hash* tmp = ctx->prev_hashes;
+    ctx->prev_hashes = ctx->hashes;
+    ctx->hashes = tmp;
+    ctx->num_prev_hashes = ctx->num_hashes;
+    ctx->num_hashes = 0;
+    ctx->prev_screen_size = ctx->screen_size;
+    ctx->damage_all = false;
+}
+
+// maps vertex positions (see tgp_vertex_matrix()) to pixels with the origin
+// at the top left of the screen
+static tgp_mat2x3 tgp_pixel_matrix(tgp_context* ctx) {
+    const float hw = (float)ctx->viewport.w * 0.5f;
+    const float hh = (float)ctx->viewport.h * 0.5f;
+    tgp_mat2x3  m = {
+        {{hw, 0.0f, (float)ctx->viewport.x + hw},
+         {0.0f, -hh, (float)(ctx->screen_size.h - ctx->viewport.y) - hh}}
+    };
+    if (ctx->gpu_projection) {
+        m = tgp_mult_proj_and_transform_matrices(&m, &ctx->proj);
+    }
+    return m;
+}
+
+// records the geometry at `vtx_offset` as a shape with the current id, so it
+// can be found by tgp_hit_test_point() and tgp_hit_test_rect(). `indices`
+// are relative to `vtx_offset`. if `stride` is not 0 they are a pattern
+// that is repeated for every `stride` vertices
+static void tgp_record_hit(tgp_context* ctx, tgp_region region,
+                           uint32_t vtx_offset, uint32_t num_vertices,
+                           const tgp_index* indices, uint32_t num_indices,
+                           uint32_t stride) {
+    if (ctx->cur_id == 0 || ctx->cur_layer >= 0 ||
+        ctx->num_hit_shapes >= ctx->max_hit_shapes) {
+        return;
+    }
+
+    // clip space -> pixels, clipped to the viewport and the scissor
+    const tgp_irect vp = ctx->viewport;
+    const float     hw = (float)vp.w * 0.5f;
+    const float     hh = (float)vp.h * 0.5f;
+    const float     top = (float)(ctx->screen_size.h - vp.y - vp.h);
+    tgp_region      rect = {
+        (float)vp.x + (TGP_MAX(region.x1, -1.0f) + 1.0f) * hw,
+        top + (1.0f - TGP_MIN(region.y2, 1.0f)) * hh,
+        (float)vp.x + (TGP_MIN(region.x2, 1.0f) + 1.0f) * hw,
+        top + (1.0f - TGP_MAX(region.y1, -1.0f)) * hh,
+    };
+    if (ctx->scissor.w >= 0 && ctx->scissor.h >= 0) {
+        // the scissor is relative to the viewport
+        const tgp_irect s = {vp.x + ctx->scissor.x, vp.y + ctx->scissor.y,
+                             ctx->scissor.w, ctx->scissor.h};
+        rect.x1 = TGP_MAX(rect.x1, (float)s.x);
+        rect.y1 = TGP_MAX(rect.y1, (float)(ctx->screen_size.h - s.y - s.h));
+        rect.x2 = TGP_MIN(rect.x2, (float)(s.x + s.w));
+        rect.y2 = TGP_MIN(rect.y2, (float)(ctx->screen_size.h - s.y));
+    }
+    if (rect.x1 >= rect.x2 || rect.y1 >= rect.y2) {
+        return;
+    }
+
+    tgp_hit_shape* shape = &ctx->hit_shapes[ctx->num_hit_shapes++];
+    shape->id = ctx->cur_id;
+    shape->rect = rect;
+    shape->vtx_offset = ctx->cur_hit_vertex;
+    shape->idx_offset = ctx->cur_hit_index;
+    shape->num_indices = 0;
+
+    const uint32_t total_indices =
+        stride != 0 ? num_vertices / stride * num_indices : num_indices;
+    if (!ctx->hit_geometry || total_indices == 0 ||
+        ctx->cur_hit_vertex + num_vertices > ctx->max_vertices ||
+        ctx->cur_hit_index + total_indices > ctx->max_indices) {
+        // only the rect can be tested
+        return;
+    }
+    const tgp_mat2x3 m = tgp_pixel_matrix(ctx);
+    tgp_vec2*        positions = &ctx->hit_positions[ctx->cur_hit_vertex];
+    for (uint32_t i = 0; i < num_vertices; i++) {
+        positions[i] =
+            tgp_mult_mat3_vec2(&m, ctx->vertices[vtx_offset + i].position);
+    }
+    tgp_index* idx = &ctx->hit_indices[ctx->cur_hit_index];
+    if (stride != 0) {
+        for (uint32_t base = 0; base < num_vertices; base += stride) {
+            for (uint32_t i = 0; i < num_indices; i++) {
+                *idx++ = (tgp_index)(indices[i] + base);
+            }
+        }
+    } else {
+        memcpy(idx, indices, num_indices * sizeof(tgp_index));
+    }
+    shape->num_indices = total_indices;
+    ctx->cur_hit_vertex += num_vertices;
+    ctx->cur_hit_index += total_indices;
+}
+
+// interleaves the bits of two 16-bit numbers
+static inline uint32_t tgp_morton2(uint32_t x, uint32_t y) {
+    x = (x | (x << 8)) & 0x00ff00ffu;
+    x = (x | (x << 4)) & 0x0f0f0f0fu;
+    x = (x | (x << 2)) & 0x33333333u;
+    x = (x | (x << 1)) & 0x55555555u;
+    y = (y | (y << 8)) & 0x00ff00ffu;
+    y = (y | (y << 4)) & 0x0f0f0f0fu;
+    y = (y | (y << 2)) & 0x33333333u;
+    y = (y | (y << 1)) & 0x55555555u;
+    return x | (y << 1);
+}
+
+static uint32_t tgp_build_hit_node(tgp_context* ctx, uint32_t first,
+                                   uint32_t count) {
+    const uint32_t index = ctx->num_hit_nodes++;
+    tgp_hit_node*  node = &ctx->hit_nodes[index];
+    if (count <= TGP_HIT_LEAF_SIZE) {
+        tgp_region bounds = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+        for (uint32_t i = first; i < first + count; i++) {
+            const tgp_region r = ctx->hit_shapes[ctx->hit_order[i]].rect;
+            bounds.x1 = TGP_MIN(bounds.x1, r.x1);
+            bounds.y1 = TGP_MIN(bounds.y1, r.y1);
+            bounds.x2 = TGP_MAX(bounds.x2, r.x2);
+            bounds.y2 = TGP_MAX(bounds.y2, r.y2);
+        }
+        *node = TGP_LITERAL(tgp_hit_node){bounds, first, count, index + 1};
+        return index;
+    }
+
+    // the shapes are sorted along a space filling curve, so both halves are
+    // close together
+    const uint32_t   half = count / 2;
+    const uint32_t   left = tgp_build_hit_node(ctx, first, half);
+    const uint32_t   right =
+        tgp_build_hit_node(ctx, first + half, count - half);
+    const tgp_region a = ctx->hit_nodes[left].bounds;
+    const tgp_region b = ctx->hit_nodes[right].bounds;
+    *node = TGP_LITERAL(tgp_hit_node){
+        {TGP_MIN(a.x1, b.x1), TGP_MIN(a.y1, b.y1), TGP_MAX(a.x2, b.x2),
+         TGP_MAX(a.y2, b.y2)},
+        0, 0, ctx->num_hit_nodes
+    };
+    return index;
+}
+
+// builds the bounding volume hierarchy the hit test queries use
+static void tgp_build_hit_tree(tgp_context* ctx) {
+    const uint32_t n = ctx->num_hit_shapes;
+    ctx->num_hit_nodes = 0;
+    if (n == 0) {
+        return;
+    }
+
+    // sort the shapes by the morton code of their center (radix sort, 8 bits
+    // per pass)
+    const float sx = 65535.0f / (float)TGP_MAX(ctx->screen_size.w, 1);
+    const float sy = 65535.0f / (float)TGP_MAX(ctx->screen_size.h, 1);
+    uint32_t*   keys = ctx->hit_keys;
+    uint32_t*   order = ctx->hit_order;
+    uint32_t*   tmp_keys = ctx->hit_keys + ctx->max_hit_shapes;
+    uint32_t*   tmp_order = ctx->hit_order + ctx->max_hit_shapes;
+    for (uint32_t i = 0; i < n; i++) {
+        const tgp_region r = ctx->hit_shapes[i].rect;
+        const float      cx = (r.x1 + r.x2) * 0.5f * sx;
+        const float      cy = (r.y1 + r.y2) * 0.5f * sy;
+        keys[i] = tgp_morton2((uint32_t)TGP_MIN(TGP_MAX(cx, 0.0f), 65535.0f),
+                              (uint32_t)TGP_MIN(TGP_MAX(cy, 0.0f), 65535.0f));
+        order[i] = i;
+    }
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+        uint32_t offsets[256] = {0};
+        for (uint32_t i = 0; i < n; i++) {
+            offsets[(keys[i] >> shift) & 0xff]++;
+        }
+        for (uint32_t i = 0, sum = 0; i < 256; i++) {
+            const uint32_t c = offsets[i];
+            offsets[i] = sum;
+            sum += c;
+        }
+        for (uint32_t i = 0; i < n; i++) {
+            const uint32_t dst = offsets[(keys[i] >> shift) & 0xff]++;
+            tmp_keys[dst] = keys[i];
+            tmp_order[dst] = order[i];
+        }
+        uint32_t* t = keys;
+        keys = tmp_keys;
+        tmp_keys = t;
+        t = order;
+        order = tmp_order;
+        tmp_order = t;
+    }
+    // after an even number of passes the result is back in the first half
+    TINYGP_ASSERT(order == ctx->hit_order);
+    tgp_build_hit_node(ctx, 0, n);
+}
+
+// finishes recording the frame. if damage tracking is enabled, this finds
+// out which parts of the screen have changed (see tgp_get_damage()). with
+// frame slots, the frame is handed over to tgp_acquire_frame() and must not
+// be drawn to until the next tgp_begin()
+TGPDEF void tgp_end(tgp_context* ctx) {
     TINYGP_ASSERT(ctx != NULL);
-    if (index >= ctx->cur_command) {
-        return NULL;
+    if (ctx->damage_tracking) {
+        tgp_update_damage(ctx);
+        if (ctx->num_flushes > 0) {
+            // the hashes only cover the last part of the frame
+            ctx->damage_all = true;
+        }
+    }
+    tgp_build_hit_tree(ctx);
+    if (ctx->shared != NULL) {
+        tgp_unpin_shared(ctx);
+    }
+    if (ctx->cur_frame == NULL) {
+        return;
+    }
+
+    // the buffers are not copied, the view just points to them
+    tgp_frame* frame = ctx->cur_frame;
+    frame->view = *ctx;
+    frame->view.external_buffers = true;
+    frame->view.num_frames = 0;
+    frame->view.frames = NULL;
+    frame->view.cur_frame = NULL;
+    frame->view.hashes = NULL;
+    frame->view.prev_hashes = NULL;
+    frame->view.tess_cache_entries = 0;
+    frame->view.tess_cache = NULL;
+    frame->view.shared = NULL;
+    frame->view.max_hit_shapes = 0;
+    frame->view.num_hit_shapes = 0;
+    frame->view.num_hit_nodes = 0;
+    frame->view.hit_shapes = NULL;
+    frame->view.hit_nodes = NULL;
+    frame->view.hit_order = NULL;
+    frame->view.hit_keys = NULL;
+    frame->view.hit_positions = NULL;
+    frame->view.hit_indices = NULL;
+    frame->sequence = ++ctx->frame_sequence;
+    tgp_atomic_store(&frame->state, TGP_FRAME_READY);
+    ctx->cur_frame = NULL;
+}
+
+// returns the oldest recorded frame that was not acquired yet, or NULL.
+// this can be called from another thread than the one recording frames,
+// the returned context can be rendered by a backend until it is passed to
+// tgp_release_frame()
+TGPDEF tgp_context* tgp_acquire_frame(tgp_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL);
+    if (ctx->frames == NULL) {
+        // without frame slots, the context is the frame
+        return ctx;
+    }
+    for (;;) {
+        tgp_frame* oldest = NULL;
+        for (uint32_t i = 0; i < ctx->num_frames; i++) {
+            tgp_frame* frame = &ctx->frames[i];
+            if (tgp_atomic_load(&frame->state) == TGP_FRAME_READY &&
+                (oldest == NULL || frame->sequence < oldest->sequence)) {
+                oldest = frame;
+            }
+        }
+        if (oldest == NULL) {
+            return NULL;
+        }
+        // tgp_begin() may have dropped it in the meantime
+        if (tgp_atomic_cas(&oldest->state, TGP_FRAME_READY,
+                           TGP_FRAME_RENDERING)) {
+            return &oldest->view;
+        }
+    }
+}
+
+// gives a frame returned by tgp_acquire_frame() back to the recording thread
+TGPDEF void tgp_release_frame(tgp_context* ctx, tgp_context* frame) {
+    TINYGP_ASSERT(ctx != NULL && frame != NULL);
+    for (uint32_t i = 0; i < ctx->num_frames; i++) {
+        if (&ctx->frames[i].view == frame) {
+            TINYGP_ASSERT(tgp_atomic_load(&ctx->frames[i].state) ==
+                          TGP_FRAME_RENDERING);
+            tgp_atomic_store(&ctx->frames[i].state, TGP_FRAME_FREE);
+            return;
+        }
     }
-    return &ctx->commands[index];
 }
 
+// returns the damaged rectangles computed by the last tgp_end() call, in
+// window coordinates. a count of 0 means nothing has to be redrawn
+TGPDEF const tgp_irect* tgp_get_damage(tgp_context* ctx, uint32_t* count) {
+    TINYGP_ASSERT(ctx != NULL && count != NULL);
+    *count = ctx->num_damage;
+    return ctx->damage;
+}
+
+// forces the next frame to be fully damaged (e.g. when the contents of the
+// framebuffer were lost, or when a texture referenced by userdata changed)
+TGPDEF void tgp_invalidate_damage(tgp_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL);
+    ctx->damage_all = true;
+}
+
+// copies command `index` into `cmd`, returns false if there is no such
+// command. backends that go through every command should use
+// tgp_command_range() instead
 TGPDEF bool tgp_get_command_p(tgp_context* ctx, tgp_command* cmd,
                               uint32_t index) {
-    TINYGP_ASSERT(ctx != NULL);
-    tgp_command* cmd_p = tgp_get_command(ctx, index);
-    if (cmd_p != NULL) {
-        *cmd = *cmd_p;
-        return true;
+    TINYGP_ASSERT(ctx != NULL && cmd != NULL);
+    if (index >= ctx->cur_command) {
+        return false;
+    }
+    const tgp_command_key* key = &ctx->commands.keys[index];
+    cmd->type = (tgp_command_type)key->type;
+    cmd->data = ctx->commands.data[index];
+    cmd->region = key->region;
+    cmd->pipeline = key->pipeline;
+    cmd->opaque = key->opaque;
+#ifdef TINYGP_USERDATA_TYPE
+    cmd->userdata = ctx->commands.userdata[index];
+#endif
+    return true;
+}
+
+// iterates over the commands [first, first + count) of a frame:
+//
+//   tgp_command_iter it = tgp_command_range(frame, first, count);
+//   while (tgp_range_next(&it)) {
+//       switch (it.key->type) { ... it.data->draw ... }
+//   }
+//
+// removed commands are skipped without reading anything but their key, the
+// userdata of the current command is it.commands.userdata[it.index]
+TGPDEF tgp_command_iter tgp_command_range(tgp_context* ctx, uint32_t first,
+                                          uint32_t count) {
+    TINYGP_ASSERT(ctx != NULL && first + count <= ctx->cur_command);
+    tgp_command_iter it;
+    it.commands = ctx->commands;
+    // the first tgp_range_next() moves to `first`
+    it.index = first - 1;
+    it.end = first + count;
+    it.key = NULL;
+    it.data = NULL;
+    return it;
+}
+
+// moves to the next command that was not removed, returns false after the
+// last one
+TGPDEF bool tgp_range_next(tgp_command_iter* it) {
+    TINYGP_ASSERT(it != NULL);
+    const tgp_command_key* keys = it->commands.keys;
+    uint32_t               i = it->index + 1;
+    while (i < it->end && keys[i].type == TGP_COMMAND_NONE) {
+        i++;
+    }
+    it->index = i;
+    if (i >= it->end) {
+        it->index = it->end;
+        return false;
+    }
+    it->key = &keys[i];
+    it->data = &it->commands.data[i];
+    return true;
+}
+
+// renders a frame (the context after tgp_end(), or one returned by
+// tgp_acquire_frame()) with `backend` in a single range of commands. if
+// parts of the frame were flushed already (see tgp_flush()), this renders
+// the last part and finishes the frame they were rendered in
+TGPDEF void tgp_render(const tgp_backend* backend, tgp_context* frame) {
+    TINYGP_ASSERT(backend != NULL && frame != NULL);
+    if (backend->begin_frame != NULL && frame->num_flushes == 0) {
+        backend->begin_frame(backend->user, frame);
+    }
+    if (backend->upload != NULL) {
+        backend->upload(backend->user, frame);
+    }
+    if (backend->execute != NULL && frame->cur_command > 0) {
+        backend->execute(backend->user, frame, 0, frame->cur_command);
+    }
+    if (backend->end_frame != NULL) {
+        backend->end_frame(backend->user, frame);
+    }
+}
+
+// adds up `size` bytes, standing in for copying them somewhere
+static uint64_t tgp_touch_bytes(uint64_t sum, const void* data, size_t size) {
+    const unsigned char* p = (const unsigned char*)data;
+    size_t               i = 0;
+    for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, &p[i], sizeof(word));
+        sum += word;
+    }
+    for (; i < size; i++) {
+        sum += p[i];
+    }
+    return sum;
+}
+
+static void tgp_null_begin_frame(void* user, tgp_context* frame) {
+    (void)frame;
+    ((tgp_null_stats*)user)->frames++;
+}
+
+static void tgp_null_upload(void* user, tgp_context* frame) {
+    tgp_null_stats* stats = (tgp_null_stats*)user;
+    const size_t    vertex_bytes = frame->cur_vertex * sizeof(tgp_vertex);
+    const size_t    index_bytes = frame->cur_index * sizeof(tgp_index);
+    stats->checksum =
+        tgp_touch_bytes(stats->checksum, frame->vertices, vertex_bytes);
+    stats->checksum =
+        tgp_touch_bytes(stats->checksum, frame->indices, index_bytes);
+    stats->vertex_bytes += vertex_bytes;
+    stats->index_bytes += index_bytes;
+}
+
+static void tgp_null_execute(void* user, tgp_context* frame, uint32_t first,
+                             uint32_t count) {
+    tgp_null_stats*  stats = (tgp_null_stats*)user;
+    tgp_command_iter it = tgp_command_range(frame, first, count);
+    while (tgp_range_next(&it)) {
+        const tgp_command_data* data = it.data;
+        stats->commands++;
+        switch (it.key->type) {
+        case TGP_COMMAND_DRAW:
+        case TGP_COMMAND_DRAW_LAYER:
+        case TGP_COMMAND_DRAW_RECTS:
+        case TGP_COMMAND_FILL_PATH:
+            // the other draw commands start with a tgp_draw_command too
+            stats->draws++;
+            stats->checksum += data->draw.vtx_offset +
+                               data->draw.num_vertices +
+                               data->draw.num_indices;
+            break;
+        default:
+            stats->checksum =
+                tgp_touch_bytes(stats->checksum, data, sizeof(*data));
+            break;
+        }
+    }
+}
+
+// a backend that goes through a frame like a real one (reading the vertices,
+// indices and commands) without rendering anything. comparing the time it
+// takes with the time of a real backend separates the cost of recording
+// from the cost of submitting a frame. `stats` is reset here and adds up over
+// all frames rendered with the backend
+TGPDEF tgp_backend tgp_null_backend(tgp_null_stats* stats) {
+    TINYGP_ASSERT(stats != NULL);
+    memset(stats, 0, sizeof(*stats));
+    tgp_backend backend;
+    memset(&backend, 0, sizeof(backend));
+    backend.user = stats;
+    backend.begin_frame = tgp_null_begin_frame;
+    backend.upload = tgp_null_upload;
+    backend.execute = tgp_null_execute;
+    return backend;
+}
+
+// renders frames in parts with `backend` whenever the buffers are full,
+// instead of dropping the draws that do not fit (they are counted in
+// tgp_context.num_dropped, see tgp_flush()). the backend is copied, NULL
+// turns flushing off. the parts are rendered on the recording thread, so this
+// can not be used with frame slots
+TGPDEF void tgp_set_flush_backend(tgp_context*       ctx,
+                                  const tgp_backend* backend) {
+    TINYGP_ASSERT(ctx != NULL && ctx->frames == NULL);
+    if (backend == NULL) {
+        free(ctx->flush_backend);
+        ctx->flush_backend = NULL;
+        return;
+    }
+    if (ctx->flush_backend == NULL) {
+        ctx->flush_backend = (tgp_backend*)malloc(sizeof(tgp_backend));
+        TINYGP_ASSERT(ctx->flush_backend != NULL);
+    }
+    *ctx->flush_backend = *backend;
+}
+
+// renders the commands recorded since the last flush and starts over with
+// empty buffers
+static bool tgp_flush_part(tgp_context* ctx) {
+    const tgp_backend* backend = ctx->flush_backend;
+    if (backend == NULL || (ctx->cur_command == 0 && ctx->cur_vertex == 0)) {
+        return false;
+    }
+    if (ctx->num_flushes == 0) {
+        if (ctx->damage_tracking) {
+            // damage is found by comparing whole frames, redraw everything
+            const tgp_size size = ctx->cur_layer >= 0 && !ctx->skip_layer
+                                      ? ctx->layer_state.screen_size
+                                      : ctx->screen_size;
+            ctx->damage_all = true;
+            ctx->num_damage = 0;
+            tgp_add_damage(ctx, TGP_LITERAL(tgp_irect){0, 0, size.w, size.h});
+        }
+        if (backend->begin_frame != NULL) {
+            backend->begin_frame(backend->user, ctx);
+        }
+    }
+    if (backend->upload != NULL) {
+        backend->upload(backend->user, ctx);
+    }
+    if (backend->execute != NULL && ctx->cur_command > 0) {
+        backend->execute(backend->user, ctx, 0, ctx->cur_command);
+    }
+    ctx->num_flushes++;
+    ctx->cur_command = 0;
+    ctx->cur_vertex = 0;
+    ctx->cur_index = 0;
+    ctx->cur_cmd_vertex = 0;
+    ctx->cur_cmd_index = 0;
+    return true;
+}
+
+// renders what was recorded since tgp_begin() (or the previous flush) with
+// the backend given to tgp_set_flush_backend(), then empties the vertex,
+// index and command buffers. the transform, color, pipeline, viewport,
+// scissor, projection and layer are kept: the backend carries its state
+// over to the commands recorded next, which are rendered by the next flush
+// or by tgp_render() after tgp_end(). this happens by itself when the
+// buffers are full, so small buffers (that stay in the cache) can render
+// scenes of any size.
+//
+// the depth of TINYGP_OPAQUE_PASS keeps counting across the parts of a
+// frame. damage tracking redraws the whole screen in a flushed frame, and
+// captures and tgpgl_export() only see the last part of it. returns false if
+// there is no flush backend or nothing to flush
+TGPDEF bool tgp_flush(tgp_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL && !ctx->polygon_stream.active);
+    return tgp_flush_part(ctx);
+}
+
+// forgets the shapes recorded after the first `num_shapes`
+static inline void tgp_drop_hits(tgp_context* ctx, uint32_t num_shapes) {
+    if (ctx->num_hit_shapes > num_shapes) {
+        ctx->cur_hit_vertex = ctx->hit_shapes[num_shapes].vtx_offset;
+        ctx->cur_hit_index = ctx->hit_shapes[num_shapes].idx_offset;
+        ctx->num_hit_shapes = num_shapes;
+    }
+}
+
+#ifdef TINYGP_OPAQUE_PASS
+// true if draws with opaque vertex colors are opaque in the current state
+static bool tgp_opaque_state(const tgp_context* ctx) {
+    // other pipelines blend differently or may be translucent
+    bool opaque = ctx->cur_pipeline == 0;
+#ifdef TINYGP_BOX_SHADOWS
+    // shadows fade out
+    opaque = opaque && ctx->shadow[3] <= 0.0f;
+#endif
+#ifdef TINYGP_USERDATA_TYPE
+#ifdef TINYGP_USERDATA_IS_OPAQUE
+    opaque = opaque && TINYGP_USERDATA_IS_OPAQUE(ctx->current_userdata);
+#else
+    // the userdata may make it translucent (e.g. a texture)
+    opaque = false;
+#endif
+#endif
+    return opaque;
+}
+
+// gives the vertices of a draw the next depth in painter's order, returns
+// true if all of them are opaque
+static bool tgp_assign_depth(tgp_context* ctx, uint32_t vtx_offset,
+                             uint32_t num_vertices) {
+    // clip space depth, -1 is the closest
+    float depth = -1.0f;
+    bool  opaque = tgp_opaque_state(ctx);
+    if (ctx->draw_order < TGP_MAX_DRAW_ORDER) {
+        ctx->draw_order++;
+        depth = 1.0f - (float)ctx->draw_order /
+                           (float)(1u << (TGP_DEPTH_BITS - 2));
+    } else {
+        // out of depth values, everything from now on is drawn in order on
+        // top of what came before
+        opaque = false;
+    }
+
+    tgp_vertex* vtx = &ctx->vertices[vtx_offset];
+    for (uint32_t i = 0; i < num_vertices; i++) {
+        vtx[i].depth = depth;
+        opaque = opaque && vtx[i].color.a >= 1.0f;
+    }
+    return opaque;
+}
+#endif
+
+#ifdef TINYGP_BOX_SHADOWS
+static void tgp_assign_shadow(tgp_context* ctx, uint32_t vtx_offset,
+                              uint32_t num_vertices) {
+    tgp_vertex* vtx = &ctx->vertices[vtx_offset];
+    for (uint32_t i = 0; i < num_vertices; i++) {
+        memcpy(vtx[i].shadow, ctx->shadow, sizeof(ctx->shadow));
+    }
+}
+#endif
+
+// adds `base` to `count` indices, used when the vertices they refer to are
+// appended to another command
+static inline void tgp_rebase_indices(tgp_index* indices, uint32_t count,
+                                      uint32_t base) {
+    for (uint32_t i = 0; i < count; i++) {
+        indices[i] += base;
     }
-    return false;
 }
 
+// indices of the new geometry are relative to its first vertex. opaque
+// geometry is only merged with opaque commands, translucent geometry with
+// translucent ones (see TINYGP_OPAQUE_PASS). if `userdata_mask` is not NULL
+// it decides which commands have the same userdata instead of
+// TINYGP_COMPARE_USERDATA, see tgp_submit_draw()
 static bool tgp_merge_command(tgp_context* ctx, tgp_region region,
                               uint32_t vtx_offset, uint32_t idx_offset,
-                              uint32_t num_vertices, uint32_t num_indices) {
+                              uint32_t num_vertices, uint32_t num_indices,
+                              bool opaque, const uint32_t* userdata_mask) {
     TINYGP_ASSERT(ctx != NULL);
 #if TGP_BATCH_OPTIMIZER_DEPTH > 0
-    tgp_command* prev_cmd = NULL;
-    tgp_command* inter_cmds[TGP_BATCH_OPTIMIZER_DEPTH];
-    uint32_t     inter_cmd_count = 0;
-    uint32_t     lookup_depth = TGP_BATCH_OPTIMIZER_DEPTH;
+    // only the keys are read while looking back, the data of the command
+    // that is merged with is read once it is found
+    tgp_command_key* prev_key = NULL;
+    tgp_command_key* inter_keys[TGP_BATCH_OPTIMIZER_DEPTH];
+    uint32_t         inter_cmd_count = 0;
+    uint32_t         lookup_depth = TGP_BATCH_OPTIMIZER_DEPTH;
 
     for (uint32_t depth = 0; depth < lookup_depth; depth++) {
-        tgp_command* cmd = tgp_peek_prev_commands(ctx, depth + 1);
-        if (cmd == NULL) {
+        tgp_command_key* key = tgp_peek_prev_commands(ctx, depth + 1);
+        if (key == NULL) {
             // we don't have any commands left, stop searching
             break;
         }
-        if (cmd->type == TGP_COMMAND_NONE) {
+        if (key->type == TGP_COMMAND_NONE) {
             // the command was removed, continue searching
             lookup_depth++;
             continue;
         }
-        if (cmd->type != TGP_COMMAND_DRAW) {
+        if (key->type != TGP_COMMAND_DRAW) {
             // not a draw command, stop searching
             break;
         }
 
+        // make sure the commands have the same pipeline and userdata.
+        // without userdata only the pipelines have to match
+        bool same_state = key->pipeline == ctx->cur_pipeline;
+        if (userdata_mask != NULL) {
+            same_state = same_state && inter_cmd_count < 32 &&
+                         ((*userdata_mask >> inter_cmd_count) & 1u);
+        }
 #if defined(TINYGP_USERDATA_TYPE) && defined(TINYGP_COMPARE_USERDATA)
-        // make sure the commands have the same userdata
-        if (TINYGP_COMPARE_USERDATA(cmd->userdata, ctx->current_userdata)) {
-            prev_cmd = cmd;
-            break;
-        } else {
-            inter_cmds[inter_cmd_count++] = cmd;
+        else {
+            same_state = same_state &&
+                         TINYGP_COMPARE_USERDATA(
+                             *tgp_command_userdata_of(ctx, key),
+                             ctx->current_userdata);
         }
-#else
-        // no userdata provided, we can always merge them
-        inter_cmds[inter_cmd_count++] = cmd;
 #endif
+        if (key->opaque == opaque && same_state) {
+            prev_key = key;
+            break;
+        }
+        inter_keys[inter_cmd_count++] = key;
     } // for (uint32_t depth = 0; depth < lookup_depth; depth++)
 
-    if (prev_cmd == NULL) {
+    if (prev_key == NULL) {
+        return false;
+    }
+    tgp_draw_command* prev_draw = &tgp_command_data_of(ctx, prev_key)->draw;
+    if (prev_draw->num_vertices + num_vertices > TGP_MAX_DRAW_VERTICES) {
         return false;
     }
 
@@ -613,9 +2750,14 @@ static bool tgp_merge_command(tgp_context* ctx, tgp_region region,
     // current or the previous command
     bool       overlaps_next = false;
     bool       overlaps_prev = false;
-    tgp_region prev_region = prev_cmd->data.draw.region;
+    tgp_region prev_region = prev_key->region;
     for (uint32_t i = 0; i < inter_cmd_count; i++) {
-        tgp_region inter_region = inter_cmds[i]->data.draw.region;
+        if (opaque || inter_keys[i]->opaque) {
+            // opaque commands are drawn before the translucent ones with
+            // depth testing, their order does not matter
+            continue;
+        }
+        tgp_region inter_region = inter_keys[i]->region;
 
         if (TGP_REGIONS_OVERLAP(region, inter_region)) {
             overlaps_next = true;
@@ -631,9 +2773,18 @@ static bool tgp_merge_command(tgp_context* ctx, tgp_region region,
         }
     }
 
+    const uint32_t prev_num_vertices = prev_draw->num_vertices;
+    const uint32_t prev_num_indices = prev_draw->num_indices;
+
     if (!overlaps_next) {
         // batch the previous command
-        if (inter_cmd_count > 0) {
+        const uint32_t prev_end_vertex =
+            prev_draw->vtx_offset + prev_num_vertices;
+        const uint32_t prev_end_index =
+            prev_draw->idx_offset + prev_num_indices;
+        if (prev_end_vertex != vtx_offset || prev_end_index != idx_offset) {
+            // the geometry is not right after the previous command, move it
+            // there. the end of the buffers is used as scratch space
             if (ctx->cur_vertex + num_vertices > ctx->max_vertices ||
                 ctx->cur_index + num_indices > ctx->max_indices) {
                 // not enough space
@@ -642,10 +2793,7 @@ static bool tgp_merge_command(tgp_context* ctx, tgp_region region,
             }
 
             // rearrange vertices
-            const uint32_t prev_end_vertex = prev_cmd->data.draw.vtx_offset +
-                                             prev_cmd->data.draw.num_vertices;
             uint32_t move_count = ctx->cur_vertex - prev_end_vertex;
-
             memmove(&ctx->vertices[prev_end_vertex + num_vertices],
                     &ctx->vertices[prev_end_vertex],
                     move_count * sizeof(tgp_vertex));
@@ -654,44 +2802,36 @@ static bool tgp_merge_command(tgp_context* ctx, tgp_region region,
                    num_vertices * sizeof(tgp_vertex));
 
             // rearrange indices
-            const uint32_t prev_end_index = prev_cmd->data.draw.idx_offset +
-                                            prev_cmd->data.draw.num_indices;
             move_count = ctx->cur_index - prev_end_index;
-
             memmove(&ctx->indices[prev_end_index + num_indices],
-                    &ctx->vertices[prev_end_index],
+                    &ctx->indices[prev_end_index],
                     move_count * sizeof(tgp_index));
             memcpy(&ctx->indices[prev_end_index],
                    &ctx->indices[idx_offset + num_indices],
                    num_indices * sizeof(tgp_index));
 
             for (uint32_t i = 0; i < inter_cmd_count; i++) {
-                inter_cmds[i]->data.draw.vtx_offset += num_vertices;
-                inter_cmds[i]->data.draw.idx_offset += num_indices;
+                tgp_draw_command* draw =
+                    &tgp_command_data_of(ctx, inter_keys[i])->draw;
+                draw->vtx_offset += num_vertices;
+                draw->idx_offset += num_indices;
             }
         }
+        tgp_rebase_indices(&ctx->indices[prev_end_index], num_indices,
+                           prev_num_vertices);
 
         // update draw region
         prev_region.x1 = TGP_MIN(prev_region.x1, region.x1);
         prev_region.y1 = TGP_MIN(prev_region.y1, region.y1);
         prev_region.x2 = TGP_MAX(prev_region.x2, region.x2);
         prev_region.y2 = TGP_MAX(prev_region.y2, region.y2);
-        prev_cmd->data.draw.num_vertices += num_vertices;
-        prev_cmd->data.draw.num_indices += num_indices;
-        prev_cmd->data.draw.region = prev_region;
+        prev_draw->num_vertices += num_vertices;
+        prev_draw->num_indices += num_indices;
+        prev_key->region = prev_region;
     } else {
         // batch the next command
         TINYGP_ASSERT(inter_cmd_count > 0);
 
-        // add a new command
-        tgp_command* cmd = tgp_next_command(ctx);
-        if (cmd == NULL) {
-            return false;
-        }
-
-        const uint32_t prev_num_vertices = prev_cmd->data.draw.num_vertices;
-        const uint32_t prev_num_indices = prev_cmd->data.draw.num_indices;
-
         if (ctx->cur_vertex + prev_num_vertices > ctx->max_vertices ||
             ctx->cur_index + prev_num_indices > ctx->max_indices) {
             // not enough space
@@ -699,19 +2839,27 @@ static bool tgp_merge_command(tgp_context* ctx, tgp_region region,
             return false;
         }
 
+        // add a new command
+        tgp_command_key* key = tgp_next_command(ctx, TGP_COMMAND_DRAW);
+        if (key == NULL) {
+            return false;
+        }
+
         // rearrange vertices
         memmove(&ctx->vertices[vtx_offset + prev_num_vertices],
                 &ctx->vertices[vtx_offset], num_vertices * sizeof(tgp_vertex));
         memcpy(&ctx->vertices[vtx_offset],
-               &ctx->vertices[prev_cmd->data.draw.vtx_offset],
+               &ctx->vertices[prev_draw->vtx_offset],
                prev_num_vertices * sizeof(tgp_vertex));
 
         // rearrange indices
         memmove(&ctx->indices[idx_offset + prev_num_indices],
                 &ctx->indices[idx_offset], num_indices * sizeof(tgp_index));
         memcpy(&ctx->indices[idx_offset],
-               &ctx->indices[prev_cmd->data.draw.idx_offset],
+               &ctx->indices[prev_draw->idx_offset],
                prev_num_indices * sizeof(tgp_index));
+        tgp_rebase_indices(&ctx->indices[idx_offset + prev_num_indices],
+                           num_indices, prev_num_vertices);
 
         // update draw region
         prev_region.x1 = TGP_MIN(prev_region.x1, region.x1);
@@ -724,18 +2872,14 @@ static bool tgp_merge_command(tgp_context* ctx, tgp_region region,
         num_vertices += prev_num_vertices;
         num_indices += prev_num_indices;
 
-        cmd->type = TGP_COMMAND_DRAW;
-        cmd->data.draw.region = prev_region;
-        cmd->data.draw.vtx_offset = vtx_offset;
-        cmd->data.draw.idx_offset = idx_offset;
-        cmd->data.draw.num_vertices = num_vertices;
-        cmd->data.draw.num_indices = num_indices;
-#ifdef TINYGP_USERDATA_TYPE
-        cmd->userdata = ctx->current_userdata;
-#endif
+        key->region = prev_region;
+        key->opaque = opaque;
+        tgp_set_draw_state(ctx, key);
+        tgp_command_data_of(ctx, key)->draw = TGP_LITERAL(tgp_draw_command){
+            vtx_offset, idx_offset, num_vertices, num_indices};
 
         // make sure we skip the previous command
-        prev_cmd->type = TGP_COMMAND_NONE;
+        prev_key->type = TGP_COMMAND_NONE;
     }
     return true;
 #else
@@ -743,45 +2887,166 @@ static bool tgp_merge_command(tgp_context* ctx, tgp_region region,
 #endif // #if TGP_BATCH_OPTIMIZER_DEPTH > 0
 }
 
-static void tgp_queue_draw(tgp_context* ctx, tgp_region region,
-                           uint32_t vtx_offset, uint32_t idx_offset,
-                           uint32_t num_vertices, uint32_t num_indices) {
+static void tgp_queue_draw_masked(tgp_context* ctx, tgp_region region,
+                                  uint32_t vtx_offset, uint32_t idx_offset,
+                                  uint32_t num_vertices, uint32_t num_indices,
+                                  const uint32_t* userdata_mask, bool merge) {
     TINYGP_ASSERT(ctx != NULL);
     if (region.x1 > 1.0f || region.y1 > 1.0f || region.x2 < -1.0f ||
-        region.y2 < -1.0f) {
-        // region is outside the screen
+        region.y2 < -1.0f || ctx->skip_layer) {
+        // region is outside the screen (or inside of a cached layer)
         ctx->cur_vertex -= num_vertices;
         ctx->cur_index -= num_indices;
         return;
     }
+    const uint32_t num_hit_shapes = ctx->num_hit_shapes;
+    tgp_record_hit(ctx, region, vtx_offset, num_vertices,
+                   &ctx->indices[idx_offset], num_indices, 0);
+#ifdef TINYGP_BOX_SHADOWS
+    tgp_assign_shadow(ctx, vtx_offset, num_vertices);
+#endif
+#ifdef TINYGP_OPAQUE_PASS
+    const bool opaque = tgp_assign_depth(ctx, vtx_offset, num_vertices);
+#else
+    const bool opaque = false;
+#endif
 
     // try to merge with previous draw command
-    if (tgp_merge_command(ctx, region, vtx_offset, idx_offset, num_vertices,
-                          num_indices)) {
+    if (merge && tgp_merge_command(ctx, region, vtx_offset, idx_offset,
+                                   num_vertices, num_indices, opaque,
+                                   userdata_mask)) {
         return;
     }
 
     // couldn't merge, create new draw command
-    tgp_command* cmd = tgp_next_command(ctx);
-    if (cmd == NULL) {
+    tgp_command_key* key = tgp_next_command(ctx, TGP_COMMAND_DRAW);
+    if (key == NULL) {
         ctx->cur_vertex -= num_vertices;
+        ctx->cur_index -= num_indices;
+        tgp_drop_hits(ctx, num_hit_shapes);
         return;
     }
+    key->region = region;
+    key->opaque = opaque;
+    tgp_set_draw_state(ctx, key);
+    tgp_command_data_of(ctx, key)->draw = TGP_LITERAL(tgp_draw_command){
+        vtx_offset, idx_offset, num_vertices, num_indices};
+}
 
-    cmd->type = TGP_COMMAND_DRAW;
-    cmd->data.draw.vtx_offset = vtx_offset;
-    cmd->data.draw.idx_offset = idx_offset;
-    cmd->data.draw.num_vertices = num_vertices;
-    cmd->data.draw.num_indices = num_indices;
-    cmd->data.draw.region = region;
-#ifdef TINYGP_USERDATA_TYPE
-    cmd->userdata = ctx->current_userdata;
-#endif
+static inline void tgp_queue_draw(tgp_context* ctx, tgp_region region,
+                                  uint32_t vtx_offset, uint32_t idx_offset,
+                                  uint32_t num_vertices,
+                                  uint32_t num_indices) {
+    tgp_queue_draw_masked(ctx, region, vtx_offset, idx_offset, num_vertices,
+                          num_indices, NULL, true);
 }
 
-static inline tgp_vec2 tgp_mult_mat3_vec2(const tgp_mat2x3* m, tgp_vec2 v) {
-    return (tgp_vec2){m->v[0][0] * v.x + m->v[0][1] * v.y + m->v[0][2],
-                      m->v[1][0] * v.x + m->v[1][1] * v.y + m->v[1][2]};
+#ifdef TINYGP_OPAQUE_PASS
+static inline bool tgp_triangle_opaque(const tgp_vertex* vtx,
+                                       const tgp_index*  idx) {
+    return vtx[idx[0]].color.a >= 1.0f && vtx[idx[1]].color.a >= 1.0f &&
+           vtx[idx[2]].color.a >= 1.0f;
+}
+
+// splits the tessellation of a shape that is partly opaque into its opaque
+// triangles (the fill), which are drawn in the opaque pass, and the others
+// (the antialiasing fringe), which stay in order with the translucent
+// geometry. the fill gets a copy of its vertices. both parts get the same
+// depth, so the fringe is still drawn over the fill. returns false if the
+// shape is not split
+static bool tgp_split_shape(tgp_context* ctx, tgp_region region,
+                            uint32_t vtx_offset, uint32_t idx_offset,
+                            uint32_t num_vertices, uint32_t num_indices,
+                            const uint32_t* userdata_mask, bool merge) {
+    if (!tgp_opaque_state(ctx) || ctx->draw_order >= TGP_MAX_DRAW_ORDER) {
+        return false;
+    }
+    tgp_vertex* vtx = &ctx->vertices[vtx_offset];
+    tgp_index*  idx = &ctx->indices[idx_offset];
+    uint32_t    num_fill_indices = 0;
+    for (uint32_t i = 0; i < num_indices; i += 3) {
+        num_fill_indices += tgp_triangle_opaque(vtx, &idx[i]) ? 3 : 0;
+    }
+    if (num_fill_indices == 0 || num_fill_indices == num_indices) {
+        return false;
+    }
+
+    const size_t size = num_vertices * (sizeof(tgp_vertex) + sizeof(uint32_t)) +
+                        num_fill_indices * sizeof(tgp_index);
+    if (ctx->split_scratch_size < size) {
+        free(ctx->split_scratch);
+        ctx->split_scratch = malloc(size);
+        ctx->split_scratch_size = ctx->split_scratch ? size : 0;
+        if (ctx->split_scratch == NULL) {
+            return false;
+        }
+    }
+    tgp_vertex* fill_vtx = (tgp_vertex*)ctx->split_scratch;
+    uint32_t*   remap = (uint32_t*)(fill_vtx + num_vertices);
+    tgp_index*  fill_idx = (tgp_index*)(remap + num_vertices);
+
+    // move the fill out, the fringe keeps the indices it had
+    memset(remap, 0xff, num_vertices * sizeof(uint32_t));
+    uint32_t num_fill_vertices = 0, num_fringe_indices = 0;
+    for (uint32_t i = 0, f = 0; i < num_indices; i += 3) {
+        if (!tgp_triangle_opaque(vtx, &idx[i])) {
+            memmove(&idx[num_fringe_indices], &idx[i], 3 * sizeof(tgp_index));
+            num_fringe_indices += 3;
+            continue;
+        }
+        for (uint32_t j = 0; j < 3; j++) {
+            const tgp_index v = idx[i + j];
+            if (remap[v] == UINT32_MAX) {
+                remap[v] = num_fill_vertices;
+                fill_vtx[num_fill_vertices++] = vtx[v];
+            }
+            fill_idx[f++] = (tgp_index)remap[v];
+        }
+    }
+    ctx->cur_index = idx_offset + num_fringe_indices;
+    const uint32_t draw_order = ctx->draw_order;
+    const uint32_t num_dropped = ctx->num_dropped;
+    tgp_queue_draw_masked(ctx, region, vtx_offset, idx_offset, num_vertices,
+                          num_fringe_indices, userdata_mask, merge);
+    if (ctx->num_dropped != num_dropped) {
+        return true;
+    }
+
+    // the fringe may have become a command of its own, so the userdata of
+    // the commands before the fill is not known anymore
+    static const uint32_t no_merge = 0;
+    ctx->draw_order = draw_order;
+    tgp_vertex* fill_write_ptr;
+    tgp_index*  fill_idx_write_ptr;
+    if (!tgp_reserve(ctx, num_fill_vertices, num_fill_indices, &fill_write_ptr,
+                     &fill_idx_write_ptr)) {
+        return true;
+    }
+    memcpy(fill_write_ptr, fill_vtx, num_fill_vertices * sizeof(tgp_vertex));
+    memcpy(fill_idx_write_ptr, fill_idx, num_fill_indices * sizeof(tgp_index));
+    tgp_queue_draw_masked(ctx, region, ctx->cur_vertex - num_fill_vertices,
+                          ctx->cur_index - num_fill_indices, num_fill_vertices,
+                          num_fill_indices,
+                          userdata_mask != NULL ? &no_merge : NULL, merge);
+    return true;
+}
+#endif
+
+// queues the tessellation of a single shape. its opaque triangles must not
+// overlap the translucent ones, like the fill and the fringe of a convex
+// polygon, so that they can be drawn apart (see tgp_split_shape())
+static void tgp_queue_shape(tgp_context* ctx, tgp_region region,
+                            uint32_t vtx_offset, uint32_t idx_offset,
+                            uint32_t num_vertices, uint32_t num_indices,
+                            const uint32_t* userdata_mask, bool merge) {
+#ifdef TINYGP_OPAQUE_PASS
+    if (tgp_split_shape(ctx, region, vtx_offset, idx_offset, num_vertices,
+                        num_indices, userdata_mask, merge)) {
+        return;
+    }
+#endif
+    tgp_queue_draw_masked(ctx, region, vtx_offset, idx_offset, num_vertices,
+                          num_indices, userdata_mask, merge);
 }
 
 static inline void tgp_transform_vec2(tgp_mat2x3* m, tgp_vec2* to,
@@ -793,27 +3058,72 @@ static inline void tgp_transform_vec2(tgp_mat2x3* m, tgp_vec2* to,
 
 TGPDEF void tgp_clear(tgp_context* ctx) {
     TINYGP_ASSERT(ctx != NULL);
-    tgp_command* cmd = tgp_next_command(ctx);
-    if (cmd == NULL) {
+    if (ctx->skip_layer) {
+        return;
+    }
+    tgp_command_key* key = tgp_next_command(ctx, TGP_COMMAND_CLEAR);
+    if (key == NULL) {
         return;
     }
-    cmd->type = TGP_COMMAND_CLEAR;
-    cmd->data.clear = ctx->color;
+    tgp_command_data_of(ctx, key)->clear = ctx->color;
 }
 
-static inline void
-tgp_queue_draw_transform(tgp_context* ctx, uint32_t vtx_offset,
-                         uint32_t idx_offset, uint32_t num_vertices,
-                         uint32_t num_indices, bool init_texcoord,
-                         bool set_color) {
+// the matrix that is applied to vertices on the CPU
+static inline const tgp_mat2x3* tgp_vertex_matrix(tgp_context* ctx) {
+    return ctx->gpu_projection ? &ctx->transform : &ctx->mvp;
+}
+
+// like tgp_vertex_matrix(), but NULL if it does not change the positions:
+// with gpu_projection and the identity transform (drawing in pixels) the
+// positions are written as they are, without a transform per vertex. any
+// other transform is still applied on the CPU, so that draws with different
+// transforms can be batched
+static inline const tgp_mat2x3* tgp_cpu_matrix(tgp_context* ctx) {
+    if (ctx->gpu_projection &&
+        memcmp(&ctx->transform, &tgp_default_transform,
+               sizeof(tgp_mat2x3)) == 0) {
+        return NULL;
+    }
+    return tgp_vertex_matrix(ctx);
+}
+
+static inline tgp_vec2 tgp_apply_cpu_matrix(const tgp_mat2x3* m,
+                                            tgp_vec2          v) {
+    return m != NULL ? tgp_mult_mat3_vec2(m, v) : v;
+}
+
+// converts a region of vertices transformed by tgp_vertex_matrix() to clip
+// space
+static inline tgp_region tgp_clip_region(tgp_context* ctx, tgp_region region) {
+    if (!ctx->gpu_projection) {
+        return region;
+    }
+    // the projection only scales and translates, so projecting the corners
+    // is enough
+    const tgp_mat2x3* p = &ctx->proj;
+    const float       x1 = region.x1 * p->v[0][0] + p->v[0][2];
+    const float       x2 = region.x2 * p->v[0][0] + p->v[0][2];
+    const float       y1 = region.y1 * p->v[1][1] + p->v[1][2];
+    const float       y2 = region.y2 * p->v[1][1] + p->v[1][2];
+    return TGP_LITERAL(tgp_region){TGP_MIN(x1, x2), TGP_MIN(y1, y2),
+                                   TGP_MAX(x1, x2), TGP_MAX(y1, y2)};
+}
+
+// transforms vertices by the current matrix and returns their region in clip
+// space
+static inline tgp_region tgp_transform_vertices(tgp_context* ctx,
+                                                uint32_t     vtx_offset,
+                                                uint32_t     num_vertices,
+                                                bool         init_texcoord,
+                                                bool         set_color) {
     TINYGP_ASSERT(ctx != NULL);
-    const tgp_mat2x3 mvp = ctx->mvp;
-    tgp_region       region = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
-    const tgp_color  color = ctx->color;
+    const tgp_mat2x3* m = tgp_cpu_matrix(ctx);
+    tgp_region        region = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+    const tgp_color   color = ctx->color;
 
     for (uint32_t i = vtx_offset; i < vtx_offset + num_vertices; i++) {
         tgp_vertex*    vertex = &ctx->vertices[i];
-        const tgp_vec2 pos = tgp_mult_mat3_vec2(&mvp, vertex->position);
+        const tgp_vec2 pos = tgp_apply_cpu_matrix(m, vertex->position);
         region.x1 = TGP_MIN(region.x1, pos.x);
         region.y1 = TGP_MIN(region.y1, pos.y);
         region.x2 = TGP_MAX(region.x2, pos.x);
@@ -829,6 +3139,16 @@ tgp_queue_draw_transform(tgp_context* ctx, uint32_t vtx_offset,
         }
     }
 
+    return tgp_clip_region(ctx, region);
+}
+
+static inline void
+tgp_queue_draw_transform(tgp_context* ctx, uint32_t vtx_offset,
+                         uint32_t idx_offset, uint32_t num_vertices,
+                         uint32_t num_indices, bool init_texcoord,
+                         bool set_color) {
+    const tgp_region region = tgp_transform_vertices(
+        ctx, vtx_offset, num_vertices, init_texcoord, set_color);
     tgp_queue_draw(ctx, region, vtx_offset, idx_offset, num_vertices,
                    num_indices);
 }
@@ -837,18 +3157,62 @@ static inline bool tgp_is_transparent(tgp_context* ctx) {
     return ctx->color.a <= 0.0f;
 }
 
+// reserves room for geometry that is written by the caller instead of being
+// tessellated by a tgp_draw_* function (this is what tinygp.hpp builds on).
+// positions have to be multiplied by ctx->transform if ctx->gpu_projection
+// is set and by ctx->mvp otherwise, indices are relative to the first vertex.
+// returns false if the buffers are full (and can not be flushed, see
+// tgp_flush())
+TGPDEF bool tgp_reserve_draw(tgp_context* ctx, uint32_t num_vertices,
+                             uint32_t num_indices, tgp_vertex** vertices,
+                             tgp_index** indices) {
+    TINYGP_ASSERT(ctx != NULL && vertices != NULL && indices != NULL);
+    return tgp_reserve(ctx, num_vertices, num_indices, vertices, indices);
+}
+
+// queues the geometry written after tgp_reserve_draw(), `region` is the
+// bounding rect of its positions. bit i of `userdata_mask` is set if the
+// userdata of the i-th last draw command (not counting removed ones) is the
+// same as the current one, only those can be merged with it. pass
+// TGP_MERGE_ANY if every draw can be merged
+TGPDEF void tgp_submit_draw(tgp_context* ctx, tgp_region region,
+                            uint32_t num_vertices, uint32_t num_indices,
+                            uint32_t userdata_mask) {
+    TINYGP_ASSERT(ctx != NULL && num_vertices <= ctx->cur_vertex &&
+                  num_indices <= ctx->cur_index);
+    tgp_queue_draw_masked(ctx, tgp_clip_region(ctx, region),
+                          ctx->cur_vertex - num_vertices,
+                          ctx->cur_index - num_indices, num_vertices,
+                          num_indices, &userdata_mask, true);
+}
+
+// like tgp_submit_draw(), for the tessellation of a single shape whose
+// opaque triangles do not overlap its translucent ones (like the fill and
+// the antialiasing fringe of a convex polygon). with TINYGP_OPAQUE_PASS the
+// opaque triangles are drawn in the opaque pass
+TGPDEF void tgp_submit_shape(tgp_context* ctx, tgp_region region,
+                             uint32_t num_vertices, uint32_t num_indices,
+                             uint32_t userdata_mask) {
+    TINYGP_ASSERT(ctx != NULL && num_vertices <= ctx->cur_vertex &&
+                  num_indices <= ctx->cur_index);
+    tgp_queue_shape(ctx, tgp_clip_region(ctx, region),
+                    ctx->cur_vertex - num_vertices,
+                    ctx->cur_index - num_indices, num_vertices, num_indices,
+                    &userdata_mask, true);
+}
+
 TGPDEF void tgp_draw_vertices(tgp_context* ctx, const tgp_vec2* points,
                               uint32_t num_vertices) {
     TINYGP_ASSERT(ctx != NULL);
-    const uint32_t vtx_offset = ctx->cur_vertex;
-    const uint32_t idx_offset = ctx->cur_index;
-    tgp_vertex*    vtx_write_ptr;
-    tgp_index*     idx_write_ptr;
+    tgp_vertex* vtx_write_ptr;
+    tgp_index*  idx_write_ptr;
     if (!tgp_reserve(ctx, num_vertices, num_vertices * 3, &vtx_write_ptr,
                      &idx_write_ptr) ||
         tgp_is_transparent(ctx)) {
         return;
     }
+    const uint32_t vtx_offset = ctx->cur_vertex - num_vertices;
+    const uint32_t idx_offset = ctx->cur_index - num_vertices * 3;
 
     for (uint32_t i = 0; i < num_vertices; i++) {
         vtx_write_ptr[i].position = points[i];
@@ -893,59 +3257,63 @@ static inline float tgp_rsqrt(float x) {
         }                                                                      \
     } while (false)
 
-// make sure to use the clockwise winding order. the anti-aliasing fringe will
-// not work otherwise.
-// (counter-clockwise shapes will have anti-aliasing "inside" of them)
-TGPDEF void tgp_draw_convex_polygon(tgp_context* ctx, const tgp_vec2* points,
-                                    uint32_t num_points) {
-    if (num_points < 3 || tgp_is_transparent(ctx)) {
-        return;
+// number of vertices and indices a tessellated convex polygon has
+static inline void tgp_convex_polygon_size(bool      antialiased,
+                                           uint32_t  num_points,
+                                           uint32_t* num_vertices,
+                                           uint32_t* num_indices) {
+    if (antialiased) {
+        *num_vertices = num_points * 2;
+        *num_indices = (num_points - 2) * 3 + num_points * 6;
+    } else {
+        *num_vertices = num_points;
+        *num_indices = (num_points - 2) * 3;
     }
+}
+
+static inline void tgp_region_add(tgp_region* region, tgp_vec2 pos) {
+    region->x1 = TGP_MIN(region->x1, pos.x);
+    region->y1 = TGP_MIN(region->y1, pos.y);
+    region->x2 = TGP_MAX(region->x2, pos.x);
+    region->y2 = TGP_MAX(region->y2, pos.y);
+}
 
-    const uint32_t vtx_offset = ctx->cur_vertex;
-    const uint32_t idx_offset = ctx->cur_index;
-    const uint32_t cmd_vtx_offset = ctx->cur_cmd_vertex;
-    // const uint32_t cmd_idx_offset = ctx->cur_cmd_index;
+static inline tgp_vec2 tgp_edge_normal(tgp_vec2 p0, tgp_vec2 p1) {
+    float dx = p1.x - p0.x;
+    float dy = p1.y - p0.y;
+    TGP_NORMALIZE2F_OVER_ZERO(dx, dy);
+    const tgp_vec2 normal = {dy, -dx};
+    return normal;
+}
 
-    if (ctx->antialiasing) {
+// tessellates a convex polygon into untransformed vertex positions and
+// indices starting at `base`
+static void tgp_tessellate_convex_polygon(const tgp_vec2* points,
+                                          uint32_t        num_points,
+                                          bool antialiased, float aa_size,
+                                          tgp_vec2* positions, tgp_index* idx,
+                                          uint32_t base) {
+    if (antialiased) {
         // with antialiasing
-        const uint32_t num_vertices = num_points * 2;
-        const uint32_t num_indices = (num_points - 2) * 3 + num_points * 6;
-        tgp_vertex*    vtx_write_ptr;
-        tgp_index*     idx_write_ptr;
-        if (!tgp_reserve(ctx, num_vertices, num_indices, &vtx_write_ptr,
-                         &idx_write_ptr)) {
-            return;
-        }
-        const float     aa_size = ctx->fringe_scale;
-        const tgp_color color = ctx->color;
-        const tgp_color color_trans = {color.r, color.g, color.b, 0.0f};
 
         // add indices to fill the shape
-        const uint32_t vtx_inner_idx = cmd_vtx_offset;
-        const uint32_t vtx_outer_idx = cmd_vtx_offset + 1;
+        const uint32_t vtx_inner_idx = base;
+        const uint32_t vtx_outer_idx = base + 1;
         for (uint32_t i = 2; i < num_points; i++) {
-            idx_write_ptr[0] = vtx_inner_idx;
-            idx_write_ptr[1] = vtx_inner_idx + ((i - 1) << 1);
-            idx_write_ptr[2] = vtx_inner_idx + (i << 1);
-            idx_write_ptr += 3;
-        }
-
-        // compute normals
-        tgp_vec2 temp_normals[num_points];
-        for (int i0 = num_points - 1, i1 = 0; i1 < num_points; i0 = i1++) {
-            const tgp_vec2 p0 = points[i0];
-            const tgp_vec2 p1 = points[i1];
-            float          dx = p1.x - p0.x;
-            float          dy = p1.y - p0.y;
-            TGP_NORMALIZE2F_OVER_ZERO(dx, dy);
-            temp_normals[i0].x = dy;
-            temp_normals[i0].y = -dx;
-        }
-        for (int i0 = num_points - 1, i1 = 0; i1 < num_points; i0 = i1++) {
+            idx[0] = vtx_inner_idx;
+            idx[1] = vtx_inner_idx + ((i - 1) << 1);
+            idx[2] = vtx_inner_idx + (i << 1);
+            idx += 3;
+        }
+
+        // the normals of the edges before and after the current point, so
+        // that no memory is needed for them
+        tgp_vec2 n0 = tgp_edge_normal(points[num_points - 1], points[0]);
+        for (uint32_t i0 = num_points - 1, i1 = 0; i1 < num_points;
+             i0 = i1++) {
             // average normals
-            const tgp_vec2 n0 = temp_normals[i0];
-            const tgp_vec2 n1 = temp_normals[i1];
+            const uint32_t i2 = i1 + 1 < num_points ? i1 + 1 : 0;
+            const tgp_vec2 n1 = tgp_edge_normal(points[i1], points[i2]);
             float          dm_x = (n0.x + n1.x) * 0.5f;
             float          dm_y = (n0.y + n1.y) * 0.5f;
             TGP_FIXNORMAL2F(dm_x, dm_y);
@@ -953,69 +3321,2502 @@ TGPDEF void tgp_draw_convex_polygon(tgp_context* ctx, const tgp_vec2* points,
             dm_y *= aa_size * 0.5f;
 
             // add vertices
-            vtx_write_ptr[0].position.x = points[i1].x - dm_x;
-            vtx_write_ptr[0].position.y = points[i1].y - dm_y;
-            vtx_write_ptr[0].color = color;
-            vtx_write_ptr[1].position.x = points[i1].x + dm_x;
-            vtx_write_ptr[1].position.y = points[i1].y + dm_y;
-            vtx_write_ptr[1].color = color_trans;
-            vtx_write_ptr += 2;
+            positions[0].x = points[i1].x - dm_x;
+            positions[0].y = points[i1].y - dm_y;
+            positions[1].x = points[i1].x + dm_x;
+            positions[1].y = points[i1].y + dm_y;
+            positions += 2;
 
             // add indices for fringes
-            idx_write_ptr[0] = vtx_inner_idx + (i1 << 1);
-            idx_write_ptr[1] = vtx_inner_idx + (i0 << 1);
-            idx_write_ptr[2] = vtx_outer_idx + (i0 << 1);
-            idx_write_ptr[3] = vtx_outer_idx + (i0 << 1);
-            idx_write_ptr[4] = vtx_outer_idx + (i1 << 1);
-            idx_write_ptr[5] = vtx_inner_idx + (i1 << 1);
-            idx_write_ptr += 6;
-        }
-        tgp_queue_draw_transform(ctx, vtx_offset, idx_offset, num_vertices,
-                                 num_indices, true, false);
+            idx[0] = vtx_inner_idx + (i1 << 1);
+            idx[1] = vtx_inner_idx + (i0 << 1);
+            idx[2] = vtx_outer_idx + (i0 << 1);
+            idx[3] = vtx_outer_idx + (i0 << 1);
+            idx[4] = vtx_outer_idx + (i1 << 1);
+            idx[5] = vtx_inner_idx + (i1 << 1);
+            idx += 6;
+            n0 = n1;
+        }
     } else {
         // without antialiasing
-        const uint32_t num_vertices = num_points;
-        const uint32_t num_indices = (num_points - 2) * 3;
-        tgp_vertex*    vtx_write_ptr;
-        tgp_index*     idx_write_ptr;
+        memcpy(positions, points, num_points * sizeof(tgp_vec2));
+        for (uint32_t i = 2; i < num_points; i++) {
+            idx[0] = base;
+            idx[1] = base + i - 1;
+            idx[2] = base + i;
+            idx += 3;
+        }
+    }
+}
+
+// transforms tessellated polygon positions by `m` (see tgp_cpu_matrix()) into
+// `vtx`. with antialiasing every odd vertex is on the outside of the fringe
+static inline void tgp_write_polygon_vertices(
+    const tgp_vec2* positions, uint32_t num_vertices, tgp_color color,
+    bool antialiased, const tgp_mat2x3* m, tgp_vertex* vtx,
+    tgp_region* region) {
+    const tgp_color color_trans = {color.r, color.g, color.b, 0.0f};
+    const tgp_vec2  zero = {0.0f, 0.0f};
+    for (uint32_t i = 0; i < num_vertices; i++) {
+        vtx[i].position = tgp_apply_cpu_matrix(m, positions[i]);
+        vtx[i].texcoord = zero;
+        vtx[i].color = (antialiased && (i & 1)) ? color_trans : color;
+        tgp_region_add(region, vtx[i].position);
+    }
+}
+
+TGPDEF void tgp_clear_tess_cache(tgp_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL);
+    for (uint32_t i = 0; i < ctx->tess_cache_entries; i++) {
+        ctx->tess_cache[i].last_used = 0;
+    }
+    ctx->tess_cache_tick = 0;
+}
+
+// returns the tessellation cache entry of an antialiased polygon,
+// tessellating it into the least recently used entry of its set on a miss
+static uint32_t tgp_tess_cache_get(tgp_context* ctx, const tgp_vec2* points,
+                                   uint32_t num_points) {
+    const float fringe_scale = ctx->fringe_scale;
+    uint64_t    h = tgp_hash_bytes(TGP_HASH_SEED, points,
+                                   num_points * sizeof(tgp_vec2));
+    h = tgp_hash_bytes(h, &fringe_scale, sizeof(fringe_scale));
+
+    if (++ctx->tess_cache_tick == 0) {
+        // the tick wrapped around, start over
+        tgp_clear_tess_cache(ctx);
+        ctx->tess_cache_tick = 1;
+    }
+
+    const uint32_t set = (uint32_t)(h % (ctx->tess_cache_entries /
+                                         TGP_TESS_CACHE_WAYS)) *
+                         TGP_TESS_CACHE_WAYS;
+    uint32_t victim = set;
+    for (uint32_t i = set; i < set + TGP_TESS_CACHE_WAYS; i++) {
+        tgp_tess_cache_entry* entry = &ctx->tess_cache[i];
+        if (entry->last_used != 0 && entry->hash == h &&
+            entry->num_points == num_points &&
+            entry->fringe_scale == fringe_scale &&
+            memcmp(&ctx->tess_cache_points[i * TGP_TESS_CACHE_MAX_POINTS],
+                   points, num_points * sizeof(tgp_vec2)) == 0) {
+            entry->last_used = ctx->tess_cache_tick;
+            ctx->tess_cache_stats.hits++;
+            return i;
+        }
+        if (entry->last_used < ctx->tess_cache[victim].last_used) {
+            victim = i;
+        }
+    }
+
+    tgp_tess_cache_entry* entry = &ctx->tess_cache[victim];
+    ctx->tess_cache_stats.misses++;
+    if (entry->last_used != 0) {
+        ctx->tess_cache_stats.evictions++;
+    }
+    entry->hash = h;
+    entry->num_points = num_points;
+    entry->fringe_scale = fringe_scale;
+    entry->last_used = ctx->tess_cache_tick;
+    memcpy(&ctx->tess_cache_points[victim * TGP_TESS_CACHE_MAX_POINTS], points,
+           num_points * sizeof(tgp_vec2));
+    tgp_tessellate_convex_polygon(
+        points, num_points, true, fringe_scale,
+        &ctx->tess_cache_positions[victim * TGP_TESS_CACHE_MAX_VERTICES],
+        &ctx->tess_cache_indices[victim * TGP_TESS_CACHE_MAX_INDICES], 0);
+    return victim;
+}
+
+// returns scratch memory for `n` positions, polygons can have any size so
+// it is on the heap
+static tgp_vec2* tgp_tess_scratch(tgp_context* ctx, uint32_t n) {
+    if (ctx->tess_positions_capacity < n) {
+        // grow geometrically, similar polygons tend to come in a row
+        const uint32_t capacity = TGP_MAX(n, ctx->tess_positions_capacity * 2);
+        free(ctx->tess_positions);
+        ctx->tess_positions = (tgp_vec2*)malloc(capacity * sizeof(tgp_vec2));
+        ctx->tess_positions_capacity = ctx->tess_positions ? capacity : 0;
+    }
+    return ctx->tess_positions;
+}
+
+// tessellates a convex polygon into `vtx` and `idx`. vertices are transformed
+// by `m` while they are written and added to `region`, indices start at
+// `base`
+static void tgp_write_convex_polygon(tgp_context* ctx, const tgp_vec2* points,
+                                     uint32_t num_points, tgp_color color,
+                                     const tgp_mat2x3* m, uint32_t base,
+                                     tgp_vertex* vtx, tgp_index* idx,
+                                     tgp_region* region) {
+    const bool aa = ctx->antialiasing;
+    uint32_t   num_vertices, num_indices;
+    tgp_convex_polygon_size(aa, num_points, &num_vertices, &num_indices);
+
+    // without antialiasing the tessellation is just a copy of the points,
+    // there is nothing to cache
+    if (aa && ctx->tess_cache != NULL &&
+        num_points <= TGP_TESS_CACHE_MAX_POINTS) {
+        // only the transform has to be done on a hit
+        const uint32_t   entry = tgp_tess_cache_get(ctx, points, num_points);
+        const tgp_index* cached_idx =
+            &ctx->tess_cache_indices[entry * TGP_TESS_CACHE_MAX_INDICES];
+        for (uint32_t i = 0; i < num_indices; i++) {
+            idx[i] = cached_idx[i] + base;
+        }
+        tgp_write_polygon_vertices(
+            &ctx->tess_cache_positions[entry * TGP_TESS_CACHE_MAX_VERTICES],
+            num_vertices, color, aa, m, vtx, region);
+        return;
+    }
+
+    tgp_vec2* positions = tgp_tess_scratch(ctx, num_vertices);
+    TINYGP_ASSERT(positions != NULL);
+    tgp_tessellate_convex_polygon(points, num_points, aa, ctx->fringe_scale,
+                                  positions, idx, base);
+    tgp_write_polygon_vertices(positions, num_vertices, color, aa, m, vtx,
+                               region);
+}
+
+// make sure to use the clockwise winding order. the anti-aliasing fringe will
+// not work otherwise.
+// (counter-clockwise shapes will have anti-aliasing "inside" of them)
+TGPDEF void tgp_draw_convex_polygon(tgp_context* ctx, const tgp_vec2* points,
+                                    uint32_t num_points) {
+    if (num_points < 3 || tgp_is_transparent(ctx)) {
+        return;
+    }
+
+    uint32_t    num_vertices, num_indices;
+    tgp_vertex* vtx_write_ptr;
+    tgp_index*  idx_write_ptr;
+    tgp_convex_polygon_size(ctx->antialiasing, num_points, &num_vertices,
+                            &num_indices);
+    if (!tgp_reserve(ctx, num_vertices, num_indices, &vtx_write_ptr,
+                     &idx_write_ptr)) {
+        return;
+    }
+    const uint32_t vtx_offset = ctx->cur_vertex - num_vertices;
+    const uint32_t idx_offset = ctx->cur_index - num_indices;
+
+    tgp_region region = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+    tgp_write_convex_polygon(ctx, points, num_points, ctx->color,
+                             tgp_cpu_matrix(ctx), 0, vtx_write_ptr,
+                             idx_write_ptr, &region);
+    tgp_queue_shape(ctx, tgp_clip_region(ctx, region), vtx_offset, idx_offset,
+                    num_vertices, num_indices, NULL, true);
+}
+
+// draws many convex polygons at once. polygon `i` is made of the points
+// `points[offsets[i]]` to `points[offsets[i + 1] - 1]`, so `offsets` has
+// `num_polygons + 1` entries. `colors` has a color for every polygon, the
+// current color is used if it is NULL.
+//
+// space is reserved once for as many polygons as fit into a single draw
+// command, so this is a lot cheaper than calling tgp_draw_convex_polygon()
+// in a loop
+TGPDEF void tgp_draw_convex_polygons(tgp_context* ctx, const tgp_vec2* points,
+                                     const uint32_t*  offsets,
+                                     const tgp_color* colors,
+                                     uint32_t         num_polygons) {
+    TINYGP_ASSERT(ctx != NULL && (offsets != NULL || num_polygons == 0));
+    if (colors == NULL && tgp_is_transparent(ctx)) {
+        return;
+    }
+    const bool        aa = ctx->antialiasing;
+    const tgp_mat2x3* m = tgp_cpu_matrix(ctx);
+
+    uint32_t i = 0;
+    while (i < num_polygons) {
+        // count how many polygons fit into a single command
+        const uint32_t vtx_room = TGP_MIN(ctx->max_vertices - ctx->cur_vertex,
+                                          TGP_MAX_DRAW_VERTICES);
+        const uint32_t idx_room = ctx->max_indices - ctx->cur_index;
+        uint32_t       num_vertices = 0, num_indices = 0;
+        uint32_t       end = i;
+        for (; end < num_polygons; end++) {
+            const uint32_t num_points = offsets[end + 1] - offsets[end];
+            if (num_points < 3 || (colors != NULL && colors[end].a <= 0.0f)) {
+                continue;
+            }
+            uint32_t nv, ni;
+            tgp_convex_polygon_size(aa, num_points, &nv, &ni);
+            if (num_vertices + nv > vtx_room || num_indices + ni > idx_room) {
+                break;
+            }
+            num_vertices += nv;
+            num_indices += ni;
+        }
+        if (end == i) {
+            // not even a single polygon fits, unless the buffers are
+            // flushed (see tgp_flush())
+            if (tgp_flush_part(ctx)) {
+                continue;
+            }
+            ctx->num_dropped++;
+            return;
+        }
+
+        tgp_vertex* vtx_write_ptr;
+        tgp_index*  idx_write_ptr;
         if (!tgp_reserve(ctx, num_vertices, num_indices, &vtx_write_ptr,
                          &idx_write_ptr)) {
             return;
         }
-        for (int i = 0; i < num_vertices; i++) {
-            vtx_write_ptr[i].position = points[i];
+        const uint32_t vtx_offset = ctx->cur_vertex - num_vertices;
+        const uint32_t idx_offset = ctx->cur_index - num_indices;
+
+        tgp_region region = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+        uint32_t   base = 0;
+        for (; i < end; i++) {
+            const uint32_t num_points = offsets[i + 1] - offsets[i];
+            if (num_points < 3 || (colors != NULL && colors[i].a <= 0.0f)) {
+                continue;
+            }
+            uint32_t nv, ni;
+            tgp_convex_polygon_size(aa, num_points, &nv, &ni);
+            tgp_write_convex_polygon(
+                ctx, &points[offsets[i]], num_points,
+                colors != NULL ? colors[i] : ctx->color, m, base,
+                vtx_write_ptr, idx_write_ptr, &region);
+            vtx_write_ptr += nv;
+            idx_write_ptr += ni;
+            base += nv;
         }
-        for (int i = 2; i < num_points; i++) {
-            idx_write_ptr[0] = cmd_vtx_offset;
-            idx_write_ptr[1] = cmd_vtx_offset + i - 1;
-            idx_write_ptr[2] = cmd_vtx_offset + i;
-            idx_write_ptr += 3;
+        if (num_vertices > 0) {
+            tgp_queue_draw(ctx, tgp_clip_region(ctx, region), vtx_offset,
+                           idx_offset, num_vertices, num_indices);
         }
-        tgp_queue_draw_transform(ctx, vtx_offset, idx_offset, num_vertices,
-                                 num_indices, true, true);
     }
 }
 
-TGPDEF void tgp_path_clear(tgp_context* ctx) {
-    TINYGP_ASSERT(ctx != NULL);
-    ctx->cur_path = 0;
+static tgp_shared_table* tgp_alloc_shared_table(uint32_t capacity) {
+    tgp_shared_table* table = (tgp_shared_table*)calloc(
+        1, sizeof(tgp_shared_table) + capacity * sizeof(tgp_shared_mesh));
+    TINYGP_ASSERT(table != NULL);
+    table->mask = capacity - 1;
+    table->meshes = (tgp_shared_mesh*)(table + 1);
+    return table;
 }
 
-TGPDEF void tgp_path_to(tgp_context* ctx, tgp_vec2 point) {
-    TINYGP_ASSERT(ctx != NULL && ctx->cur_path < ctx->max_path);
-    ctx->path[ctx->cur_path++] = point;
+static inline uint32_t tgp_shared_hash(uint64_t key) {
+    return (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> 32);
 }
 
-TGPDEF void tgp_path_to_merge_duplicate(tgp_context* ctx, tgp_vec2 point) {
+// returns the slot of `key`, or the empty slot it would be put into. tables
+// are at most half full, so there always is an empty slot
+static inline uint32_t tgp_shared_slot(const tgp_shared_table* table,
+                                       uint64_t                key) {
+    uint32_t i = tgp_shared_hash(key) & table->mask;
+    while (table->meshes[i].key != 0 && table->meshes[i].key != key) {
+        i = (i + 1) & table->mask;
+    }
+    return i;
+}
+
+// the epoch is always odd, so it is never 0 (which means "not reading")
+// when it wraps around
+TGPDEF void tgp_init_shared(tgp_shared* shared, uint32_t max_readers) {
+    TINYGP_ASSERT(shared != NULL);
+    memset(shared, 0, sizeof(*shared));
+    shared->current = tgp_alloc_shared_table(16);
+    shared->epoch = 1;
+    shared->max_readers = max_readers;
+    shared->reader_epochs = (uint32_t*)calloc(max_readers, sizeof(uint32_t));
+    shared->reader_used = (uint32_t*)calloc(max_readers, sizeof(uint32_t));
+    TINYGP_ASSERT(max_readers == 0 || (shared->reader_epochs != NULL &&
+                                       shared->reader_used != NULL));
+}
+
+// returns true if `mesh` is the published version of its key
+static inline bool tgp_shared_is_published(tgp_shared*            shared,
+                                           const tgp_shared_mesh* mesh) {
+    const tgp_shared_table* current = shared->current;
+    return current->meshes[tgp_shared_slot(current, mesh->key)].positions ==
+           mesh->positions;
+}
+
+// frees the registry and all of its meshes. no context may use it anymore
+TGPDEF void tgp_destroy_shared(tgp_shared* shared) {
+    TINYGP_ASSERT(shared != NULL);
+    // retired meshes that were not unpublished yet are still current
+    for (uint32_t i = 0; i < shared->num_retired; i++) {
+        if (shared->retired[i].epoch != 0) {
+            free(shared->retired[i].ptr);
+        }
+    }
+    if (shared->pending != NULL) {
+        for (uint32_t i = 0; i <= shared->pending->mask; i++) {
+            const tgp_shared_mesh* mesh = &shared->pending->meshes[i];
+            if (mesh->key != 0 && !tgp_shared_is_published(shared, mesh)) {
+                free((void*)mesh->positions);
+            }
+        }
+        free(shared->pending);
+    }
+    for (uint32_t i = 0; i <= shared->current->mask; i++) {
+        if (shared->current->meshes[i].key != 0) {
+            free((void*)shared->current->meshes[i].positions);
+        }
+    }
+    free(shared->current);
+    free(shared->retired);
+    free(shared->reader_epochs);
+    free(shared->reader_used);
+    memset(shared, 0, sizeof(*shared));
+}
+
+static void tgp_shared_retire(tgp_shared* shared, void* ptr) {
+    if (shared->num_retired == shared->max_retired) {
+        shared->max_retired = TGP_MAX(shared->max_retired * 2, 16u);
+        shared->retired = (tgp_shared_retired*)realloc(
+            shared->retired, shared->max_retired * sizeof(tgp_shared_retired));
+        TINYGP_ASSERT(shared->retired != NULL);
+    }
+    shared->retired[shared->num_retired++] =
+        TGP_LITERAL(tgp_shared_retired){ptr, 0};
+}
+
+// frees the memory of a mesh that was taken out of the pending table. if it
+// is published, readers may still be drawing it
+static void tgp_shared_drop(tgp_shared* shared, const tgp_shared_mesh* mesh) {
+    if (tgp_shared_is_published(shared, mesh)) {
+        tgp_shared_retire(shared, (void*)mesh->positions);
+    } else {
+        free((void*)mesh->positions);
+    }
+}
+
+// returns the private copy of the current table that updates go into, with
+// room for at least one more mesh
+static tgp_shared_table* tgp_shared_edit(tgp_shared* shared) {
+    tgp_shared_table* from =
+        shared->pending != NULL ? shared->pending : shared->current;
+    if (from == shared->pending && (from->count + 1) * 2 <= from->mask + 1) {
+        return from;
+    }
+    uint32_t capacity = 16;
+    while ((from->count + 1) * 2 > capacity) {
+        capacity *= 2;
+    }
+    tgp_shared_table* table = tgp_alloc_shared_table(capacity);
+    for (uint32_t i = 0; i <= from->mask; i++) {
+        if (from->meshes[i].key != 0) {
+            table->meshes[tgp_shared_slot(table, from->meshes[i].key)] =
+                from->meshes[i];
+        }
+    }
+    table->count = from->count;
+    if (shared->pending != NULL) {
+        free(shared->pending);
+    }
+    shared->pending = table;
+    return table;
+}
+
+// adds a mesh to the registry or replaces the one with the same key. the
+// arrays are copied, `alphas` may be NULL. contexts see the change after the
+// next tgp_shared_publish(). only one thread may update a registry at a time.
+// returns false if the key is 0 or the mesh can not be drawn
+TGPDEF bool tgp_shared_put(tgp_shared* shared, uint64_t key,
+                           const tgp_vec2* positions, const float* alphas,
+                           uint32_t num_vertices, const tgp_index* indices,
+                           uint32_t num_indices) {
+    TINYGP_ASSERT(shared != NULL && positions != NULL && indices != NULL);
+    if (key == 0 || num_vertices == 0 || num_indices == 0 ||
+        num_vertices > TGP_MAX_DRAW_VERTICES) {
+        return false;
+    }
+    for (uint32_t i = 0; i < num_indices; i++) {
+        if (indices[i] >= num_vertices) {
+            return false;
+        }
+    }
+
+    // the arrays share a single allocation that starts with the positions
+    const size_t positions_size = num_vertices * sizeof(tgp_vec2);
+    const size_t alphas_size =
+        alphas != NULL ? num_vertices * sizeof(float) : 0;
+    uint8_t* mem = (uint8_t*)malloc(positions_size + alphas_size +
+                                    num_indices * sizeof(tgp_index));
+    if (mem == NULL) {
+        return false;
+    }
+    memcpy(mem, positions, positions_size);
+    if (alphas != NULL) {
+        memcpy(mem + positions_size, alphas, alphas_size);
+    }
+    memcpy(mem + positions_size + alphas_size, indices,
+           num_indices * sizeof(tgp_index));
+    const tgp_shared_mesh mesh = {
+        key,
+        num_vertices,
+        num_indices,
+        (const tgp_vec2*)mem,
+        alphas != NULL ? (const float*)(mem + positions_size) : NULL,
+        (const tgp_index*)(mem + positions_size + alphas_size),
+    };
+
+    tgp_shared_table* table = tgp_shared_edit(shared);
+    const uint32_t    i = tgp_shared_slot(table, key);
+    if (table->meshes[i].key != 0) {
+        tgp_shared_drop(shared, &table->meshes[i]);
+    } else {
+        table->count++;
+    }
+    table->meshes[i] = mesh;
+    return true;
+}
+
+// tessellates a convex polygon the way tgp_draw_convex_polygon() does with
+// the given antialiasing settings and puts it into the registry
+TGPDEF bool tgp_shared_put_convex_polygon(tgp_shared* shared, uint64_t key,
+                                          const tgp_vec2* points,
+                                          uint32_t        num_points,
+                                          bool            antialiasing,
+                                          float           fringe_scale) {
+    if (num_points < 3) {
+        return false;
+    }
+    uint32_t num_vertices, num_indices;
+    tgp_convex_polygon_size(antialiasing, num_points, &num_vertices,
+                            &num_indices);
+    if (num_vertices > TGP_MAX_DRAW_VERTICES) {
+        return false;
+    }
+
+    // the polygon is tessellated into a temporary allocation laid out like
+    // the one of tgp_shared_put()
+    uint8_t* mem = (uint8_t*)malloc(
+        num_vertices * (sizeof(tgp_vec2) + sizeof(float)) +
+        num_indices * sizeof(tgp_index));
+    if (mem == NULL) {
+        return false;
+    }
+    tgp_vec2*  positions = (tgp_vec2*)mem;
+    float*     alphas = (float*)(positions + num_vertices);
+    tgp_index* indices = (tgp_index*)(alphas + num_vertices);
+    tgp_tessellate_convex_polygon(points, num_points, antialiasing,
+                                  fringe_scale, positions, indices, 0);
+    // every odd vertex is on the outside of the fringe
+    for (uint32_t i = 0; i < num_vertices; i++) {
+        alphas[i] = (i & 1) ? 0.0f : 1.0f;
+    }
+    const bool ok =
+        tgp_shared_put(shared, key, positions, antialiasing ? alphas : NULL,
+                       num_vertices, indices, num_indices);
+    free(mem);
+    return ok;
+}
+
+// removes a mesh from the registry, contexts see the change after the next
+// tgp_shared_publish()
+TGPDEF void tgp_shared_remove(tgp_shared* shared, uint64_t key) {
+    TINYGP_ASSERT(shared != NULL);
+    const tgp_shared_table* from =
+        shared->pending != NULL ? shared->pending : shared->current;
+    if (key == 0 || from->meshes[tgp_shared_slot(from, key)].key == 0) {
+        return;
+    }
+    tgp_shared_table* table = tgp_shared_edit(shared);
+    uint32_t          i = tgp_shared_slot(table, key);
+    tgp_shared_drop(shared, &table->meshes[i]);
+
+    // move the meshes after it back, so the slots between the slot of their
+    // hash and their slot stay occupied
+    for (uint32_t j = (i + 1) & table->mask; table->meshes[j].key != 0;
+         j = (j + 1) & table->mask) {
+        const uint32_t home =
+            tgp_shared_hash(table->meshes[j].key) & table->mask;
+        if (((j - home) & table->mask) >= ((j - i) & table->mask)) {
+            table->meshes[i] = table->meshes[j];
+            i = j;
+        }
+    }
+    memset(&table->meshes[i], 0, sizeof(tgp_shared_mesh));
+    table->count--;
+}
+
+// frees the retired memory that no context can read anymore and returns the
+// number of allocations that are still in use. tgp_shared_publish() calls
+// this, it only has to be called to free memory sooner
+TGPDEF uint32_t tgp_shared_collect(tgp_shared* shared) {
+    TINYGP_ASSERT(shared != NULL);
+    // see the published table before looking at the readers
+    tgp_atomic_fence();
+    uint32_t oldest = tgp_atomic_load(&shared->epoch);
+    for (uint32_t i = 0; i < shared->max_readers; i++) {
+        const uint32_t epoch = tgp_atomic_load(&shared->reader_epochs[i]);
+        if (epoch != 0 && (int32_t)(epoch - oldest) < 0) {
+            oldest = epoch;
+        }
+    }
+
+    // readers that pinned a table in or after the epoch something was
+    // unpublished in can not have it
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < shared->num_retired; i++) {
+        const tgp_shared_retired retired = shared->retired[i];
+        if (retired.epoch != 0 && (int32_t)(oldest - retired.epoch) >= 0) {
+            free(retired.ptr);
+        } else {
+            shared->retired[count++] = retired;
+        }
+    }
+    shared->num_retired = count;
+    return count;
+}
+
+// makes the changes since the last call visible to the contexts, at their
+// next tgp_begin()
+TGPDEF void tgp_shared_publish(tgp_shared* shared) {
+    TINYGP_ASSERT(shared != NULL);
+    if (shared->pending == NULL) {
+        return;
+    }
+    tgp_shared_table* old = shared->current;
+    tgp_atomic_store_ptr((void**)&shared->current, shared->pending);
+    shared->pending = NULL;
+    const uint32_t epoch = tgp_atomic_add(&shared->epoch, 2);
+
+    tgp_shared_retire(shared, old);
+    for (uint32_t i = 0; i < shared->num_retired; i++) {
+        if (shared->retired[i].epoch == 0) {
+            shared->retired[i].epoch = epoch;
+        }
+    }
+    tgp_shared_collect(shared);
+}
+
+// lets the context draw the meshes of `shared` with tgp_draw_shared(), from
+// the next tgp_begin() on. NULL stops using a registry. returns false if the
+// registry has no free reader slot
+TGPDEF bool tgp_use_shared(tgp_context* ctx, tgp_shared* shared) {
     TINYGP_ASSERT(ctx != NULL);
-    if (ctx->cur_path != 0) {
-        tgp_vec2 prev_point = ctx->path[ctx->cur_path - 1];
-        if (point.x == prev_point.x && point.y == prev_point.y) {
-            return;
+    if (ctx->shared != NULL) {
+        tgp_atomic_store(&ctx->shared->reader_epochs[ctx->shared_reader], 0);
+        tgp_atomic_store(&ctx->shared->reader_used[ctx->shared_reader], 0);
+        ctx->shared = NULL;
+        ctx->shared_table = NULL;
+    }
+    if (shared == NULL) {
+        return true;
+    }
+    for (uint32_t i = 0; i < shared->max_readers; i++) {
+        if (tgp_atomic_cas(&shared->reader_used[i], 0, 1)) {
+            ctx->shared = shared;
+            ctx->shared_reader = i;
+            return true;
         }
     }
-    tgp_path_to(ctx, point);
+    return false;
+}
+
+// returns the mesh `key` of the registry the context uses, or NULL. the mesh
+// can be read until tgp_end()
+TGPDEF const tgp_shared_mesh* tgp_find_shared(tgp_context* ctx, uint64_t key) {
+    TINYGP_ASSERT(ctx != NULL);
+    const tgp_shared_table* table = ctx->shared_table;
+    if (table == NULL || key == 0) {
+        return NULL;
+    }
+    const tgp_shared_mesh* mesh = &table->meshes[tgp_shared_slot(table, key)];
+    return mesh->key != 0 ? mesh : NULL;
+}
+
+// draws a mesh of the registry the context uses with the current transform
+// and color. only the vertices are transformed, so this is as cheap as a hit
+// in the tessellation cache. returns false if there is no mesh `key` or it
+// was dropped because it does not fit into the buffers (see num_dropped)
+TGPDEF bool tgp_draw_shared(tgp_context* ctx, uint64_t key) {
+    const tgp_shared_mesh* mesh = tgp_find_shared(ctx, key);
+    if (mesh == NULL) {
+        return false;
+    }
+    if (tgp_is_transparent(ctx)) {
+        return true;
+    }
+
+    tgp_vertex* vtx;
+    tgp_index*  idx;
+    if (!tgp_reserve(ctx, mesh->num_vertices, mesh->num_indices, &vtx, &idx)) {
+        return false;
+    }
+    const uint32_t vtx_offset = ctx->cur_vertex - mesh->num_vertices;
+    const uint32_t idx_offset = ctx->cur_index - mesh->num_indices;
+
+    const tgp_mat2x3* m = tgp_cpu_matrix(ctx);
+    const tgp_vec2    zero = {0.0f, 0.0f};
+    tgp_region        region = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+    for (uint32_t i = 0; i < mesh->num_vertices; i++) {
+        vtx[i].position = tgp_apply_cpu_matrix(m, mesh->positions[i]);
+        vtx[i].texcoord = zero;
+        vtx[i].color = ctx->color;
+        if (mesh->alphas != NULL) {
+            vtx[i].color.a *= mesh->alphas[i];
+        }
+        tgp_region_add(&region, vtx[i].position);
+    }
+    memcpy(idx, mesh->indices, mesh->num_indices * sizeof(tgp_index));
+    tgp_queue_draw(ctx, tgp_clip_region(ctx, region), vtx_offset, idx_offset,
+                   mesh->num_vertices, mesh->num_indices);
+    return true;
+}
+
+// reads `count` points described by `layout` from `data` into `out`
+TGPDEF void tgp_read_points(const tgp_point_layout* layout, const void* data,
+                            uint32_t count, tgp_vec2* out) {
+    TINYGP_ASSERT(layout != NULL && (data != NULL || count == 0));
+    const unsigned char* x = (const unsigned char*)data + layout->x_offset;
+    const unsigned char* y = (const unsigned char*)data + layout->y_offset;
+    for (uint32_t i = 0; i < count; i++) {
+        if (layout->x_type == TGP_SCALAR_DOUBLE) {
+            double v;
+            memcpy(&v, x, sizeof(v));
+            out[i].x = (float)v;
+        } else {
+            memcpy(&out[i].x, x, sizeof(float));
+        }
+        if (layout->y_type == TGP_SCALAR_DOUBLE) {
+            double v;
+            memcpy(&v, y, sizeof(v));
+            out[i].y = (float)v;
+        } else {
+            memcpy(&out[i].y, y, sizeof(float));
+        }
+        x += layout->stride;
+        y += layout->stride;
+    }
+}
+
+// computes the fringe vertices of point `b` of a polygon going from `a` to
+// `b` to `c`, the same way tgp_tessellate_convex_polygon() does
+static void tgp_polygon_stream_pair(tgp_context* ctx, tgp_vec2 a, tgp_vec2 b,
+                                    tgp_vec2 c, tgp_vertex* vtx) {
+    const tgp_polygon_stream* s = &ctx->polygon_stream;
+    float                     dx0 = b.x - a.x;
+    float                     dy0 = b.y - a.y;
+    float                     dx1 = c.x - b.x;
+    float                     dy1 = c.y - b.y;
+    TGP_NORMALIZE2F_OVER_ZERO(dx0, dy0);
+    TGP_NORMALIZE2F_OVER_ZERO(dx1, dy1);
+
+    // average normals
+    float dm_x = (dy0 + dy1) * 0.5f;
+    float dm_y = (-dx0 - dx1) * 0.5f;
+    TGP_FIXNORMAL2F(dm_x, dm_y);
+    dm_x *= ctx->fringe_scale * 0.5f;
+    dm_y *= ctx->fringe_scale * 0.5f;
+
+    const tgp_vec2 zero = {0.0f, 0.0f};
+    vtx[0].position = tgp_mult_mat3_vec2(
+        &s->matrix, TGP_LITERAL(tgp_vec2){b.x - dm_x, b.y - dm_y});
+    vtx[0].texcoord = zero;
+    vtx[0].color = s->color;
+    vtx[1].position = tgp_mult_mat3_vec2(
+        &s->matrix, TGP_LITERAL(tgp_vec2){b.x + dm_x, b.y + dm_y});
+    vtx[1].texcoord = zero;
+    vtx[1].color =
+        TGP_LITERAL(tgp_color){s->color.r, s->color.g, s->color.b, 0.0f};
+}
+
+// queues the draw command the polygon is being written to, returns false if
+// it was dropped. only the last command of the polygon is merged with the
+// ones before it, so that all others can be rolled back
+static bool tgp_polygon_stream_queue(tgp_context* ctx, bool last) {
+    tgp_polygon_stream* s = &ctx->polygon_stream;
+    const uint32_t      num_vertices = ctx->cur_vertex - s->vtx_offset;
+    const uint32_t      num_indices = ctx->cur_index - s->idx_offset;
+    const uint32_t      num_dropped = ctx->num_dropped;
+    if (num_indices == 0) {
+        // not a single triangle yet
+        ctx->cur_vertex = s->vtx_offset;
+        ctx->cur_index = s->idx_offset;
+        return true;
+    }
+    tgp_queue_shape(ctx, tgp_clip_region(ctx, s->region), s->vtx_offset,
+                    s->idx_offset, num_vertices, num_indices, NULL, last);
+    return ctx->num_dropped == num_dropped;
+}
+
+// remembers where the polygon is rolled back to if it fails
+static void tgp_polygon_stream_mark(tgp_context* ctx) {
+    tgp_polygon_stream* s = &ctx->polygon_stream;
+    s->start_command = ctx->cur_command;
+    s->start_vertex = ctx->cur_vertex;
+    s->start_index = ctx->cur_index;
+    s->start_hits = ctx->num_hit_shapes;
+}
+
+// starts a new draw command with the head and the last ring vertex, so the
+// fan continues where the previous command stopped
+static bool tgp_polygon_stream_start(tgp_context* ctx) {
+    tgp_polygon_stream* s = &ctx->polygon_stream;
+    const uint32_t      n = s->antialiased ? 2 : 1;
+    tgp_vertex*         vtx;
+    tgp_index*          idx;
+    if (!tgp_fits(ctx, n * 3, 9)) {
+        // make room for the command and its first fan triangle and fringe,
+        // the vertices it continues from are kept in the stream. the parts
+        // that were rendered can not be rolled back anymore
+        if (tgp_flush_part(ctx)) {
+            tgp_polygon_stream_mark(ctx);
+        }
+    }
+    s->vtx_offset = ctx->cur_vertex;
+    s->idx_offset = ctx->cur_index;
+    s->region = TGP_LITERAL(tgp_region){FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+    if (!tgp_reserve(ctx, s->last_is_head ? n : n * 2, 0, &vtx, &idx)) {
+        return false;
+    }
+    for (uint32_t i = 0; i < n; i++) {
+        vtx[i] = s->head[i];
+        tgp_region_add(&s->region, vtx[i].position);
+        if (!s->last_is_head) {
+            vtx[n + i] = s->last[i];
+            tgp_region_add(&s->region, vtx[n + i].position);
+        }
+    }
+    s->cmd_last = s->last_is_head ? 0 : n;
+    return true;
+}
+
+// adds a ring vertex (a fringe pair with antialiasing) after the last one,
+// with the fan triangle and the fringe between them. NULL links the last
+// ring vertex back to the head to close the fringe
+static void tgp_polygon_stream_add(tgp_context* ctx, const tgp_vertex* v) {
+    tgp_polygon_stream* s = &ctx->polygon_stream;
+    const bool          aa = s->antialiased;
+    // the triangle is degenerate if one of its sides is the head
+    const bool     fill = v != NULL && !s->last_is_head;
+    const uint32_t num_vertices = v == NULL ? 0 : aa ? 2 : 1;
+    const uint32_t num_indices = (fill ? 3 : 0) + (aa ? 6 : 0);
+
+    // continue in a new command if this one can not address more vertices,
+    // or in empty buffers if these are full and can be flushed
+    if (ctx->cur_vertex - s->vtx_offset + num_vertices >
+            TGP_MAX_DRAW_VERTICES ||
+        (ctx->flush_backend != NULL &&
+         !tgp_fits(ctx, num_vertices, num_indices))) {
+        if (!tgp_polygon_stream_queue(ctx, false) ||
+            !tgp_polygon_stream_start(ctx)) {
+            s->failed = true;
+            return;
+        }
+    }
+
+    tgp_vertex* vtx;
+    tgp_index*  idx;
+    if (!tgp_reserve(ctx, num_vertices, num_indices, &vtx, &idx)) {
+        // counted in num_dropped
+        s->failed = true;
+        return;
+    }
+    const uint32_t cur =
+        v == NULL ? 0 : ctx->cur_vertex - num_vertices - s->vtx_offset;
+    const uint32_t prev = s->cmd_last;
+    if (fill) {
+        idx[0] = 0;
+        idx[1] = prev;
+        idx[2] = cur;
+        idx += 3;
+    }
+    if (aa) {
+        idx[0] = cur;
+        idx[1] = prev;
+        idx[2] = prev + 1;
+        idx[3] = prev + 1;
+        idx[4] = cur + 1;
+        idx[5] = cur;
+    }
+    for (uint32_t i = 0; i < num_vertices; i++) {
+        vtx[i] = v[i];
+        s->last[i] = v[i];
+        tgp_region_add(&s->region, v[i].position);
+    }
+    s->cmd_last = cur;
+    s->last_is_head = v == NULL;
+}
+
+// starts a convex polygon whose points are added with tgp_polygon_points()
+// and tgp_polygon_points_strided(), so it never has to be in memory as a
+// whole. the polygon is tessellated while the points come in and split into
+// as many draw commands as needed, so it can have any number of points.
+//
+// the color, transform and antialiasing setting at this call are used for
+// the whole polygon, nothing else can be drawn until tgp_end_polygon(). a
+// polygon that does not fit into the buffers is dropped as a whole (counted
+// in tgp_context.num_dropped), except for the parts that were flushed
+TGPDEF void tgp_begin_polygon(tgp_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL && !ctx->polygon_stream.active);
+    tgp_polygon_stream* s = &ctx->polygon_stream;
+    memset(s, 0, sizeof(*s));
+    s->active = true;
+    s->failed = tgp_is_transparent(ctx);
+    s->antialiased = ctx->antialiasing;
+    s->color = ctx->color;
+    s->matrix = *tgp_vertex_matrix(ctx);
+    s->vtx_offset = ctx->cur_vertex;
+    s->idx_offset = ctx->cur_index;
+    tgp_polygon_stream_mark(ctx);
+}
+
+TGPDEF void tgp_polygon_points(tgp_context* ctx, const tgp_vec2* points,
+                               uint32_t count) {
+    TINYGP_ASSERT(ctx != NULL && ctx->polygon_stream.active);
+    TINYGP_ASSERT(points != NULL || count == 0);
+    tgp_polygon_stream* s = &ctx->polygon_stream;
+
+    for (uint32_t i = 0; i < count && !s->failed; i++) {
+        const tgp_vec2 p = points[i];
+        if (s->antialiased) {
+            // the fringe of a point depends on the next one, the first
+            // point is only known once the polygon is closed
+            if (s->count < 2) {
+                s->first[s->count] = p;
+            } else {
+                tgp_vertex pair[2];
+                tgp_polygon_stream_pair(ctx, s->prev[0], s->prev[1], p, pair);
+                if (s->count == 2) {
+                    s->head[0] = pair[0];
+                    s->head[1] = pair[1];
+                    s->last_is_head = true;
+                    s->failed = !tgp_polygon_stream_start(ctx);
+                } else {
+                    tgp_polygon_stream_add(ctx, pair);
+                }
+            }
+        } else {
+            tgp_vertex v;
+            memset(&v, 0, sizeof(v));
+            v.position = tgp_mult_mat3_vec2(&s->matrix, p);
+            v.color = s->color;
+            if (s->count == 0) {
+                s->head[0] = v;
+                s->last_is_head = true;
+                s->failed = !tgp_polygon_stream_start(ctx);
+            } else {
+                tgp_polygon_stream_add(ctx, &v);
+            }
+        }
+        s->prev[0] = s->prev[1];
+        s->prev[1] = p;
+        s->count++;
+    }
+}
+
+// like tgp_polygon_points(), but reads the points from caller records
+TGPDEF void tgp_polygon_points_strided(tgp_context*            ctx,
+                                       const tgp_point_layout* layout,
+                                       const void* data, uint32_t count) {
+    tgp_vec2 chunk[TGP_POINT_CHUNK];
+    for (uint32_t i = 0; i < count; i += TGP_POINT_CHUNK) {
+        const uint32_t n = TGP_MIN(count - i, TGP_POINT_CHUNK);
+        tgp_read_points(layout,
+                        (const unsigned char*)data + i * layout->stride, n,
+                        chunk);
+        tgp_polygon_points(ctx, chunk, n);
+    }
+}
+
+TGPDEF void tgp_end_polygon(tgp_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL && ctx->polygon_stream.active);
+    tgp_polygon_stream* s = &ctx->polygon_stream;
+    if (s->antialiased && s->count >= 3 && !s->failed) {
+        // the last and the first point, then close the fringe
+        tgp_vertex pair[2];
+        tgp_polygon_stream_pair(ctx, s->prev[0], s->prev[1], s->first[0],
+                                pair);
+        tgp_polygon_stream_add(ctx, pair);
+        tgp_polygon_stream_pair(ctx, s->prev[1], s->first[0], s->first[1],
+                                pair);
+        tgp_polygon_stream_add(ctx, pair);
+        tgp_polygon_stream_add(ctx, NULL);
+    }
+    if (s->failed || !tgp_polygon_stream_queue(ctx, true)) {
+        // drop the whole polygon instead of drawing the part that fit
+        ctx->cur_command = s->start_command;
+        ctx->cur_vertex = s->start_vertex;
+        ctx->cur_index = s->start_index;
+        ctx->cur_cmd_vertex = 0;
+        ctx->cur_cmd_index = 0;
+        tgp_drop_hits(ctx, s->start_hits);
+    }
+    s->active = false;
+}
+
+// rectangle vertices are stored clockwise starting at the top left corner.
+// with antialiasing every corner has an inner and an outer vertex, in the
+// same layout tgp_draw_convex_polygon() uses
+static const tgp_index tgp_rect_indices[6] = {0, 1, 2, 0, 2, 3};
+static const tgp_index tgp_rect_indices_aa[30] = {
+    0, 2, 4, 0, 4, 6, // fill
+    0, 6, 7, 7, 1, 0, // left fringe
+    2, 0, 1, 1, 3, 2, // top fringe
+    4, 2, 3, 3, 5, 4, // right fringe
+    6, 4, 5, 5, 7, 6, // bottom fringe
+};
+
+// returns the index pattern of a single rectangle of a
+// TGP_COMMAND_DRAW_RECTS command
+TGPDEF const tgp_index* tgp_rect_index_pattern(bool      antialiased,
+                                               uint32_t* num_indices,
+                                               uint32_t* num_vertices) {
+    TINYGP_ASSERT(num_indices != NULL && num_vertices != NULL);
+    if (antialiased) {
+        *num_indices = 30;
+        *num_vertices = 8;
+        return tgp_rect_indices_aa;
+    }
+    *num_indices = 6;
+    *num_vertices = 4;
+    return tgp_rect_indices;
+}
+
+static void tgp_queue_draw_rects(tgp_context* ctx, tgp_region region,
+                                 uint32_t vtx_offset, uint32_t num_vertices,
+                                 uint32_t num_indices, bool antialiased) {
+#ifdef TINYGP_OPAQUE_PASS
+    if (antialiased && num_vertices == 8 &&
+        ctx->vertices[vtx_offset].color.a >= 1.0f && tgp_opaque_state(ctx) &&
+        tgp_fits(ctx, 0, 30)) {
+        // a single opaque rect is a shape of its own, its fill is drawn in
+        // the opaque pass and its fringe with the translucent geometry. that
+        // needs explicit indices
+        memcpy(&ctx->indices[ctx->cur_index], tgp_rect_indices_aa,
+               sizeof(tgp_rect_indices_aa));
+        ctx->cur_index += 30;
+        tgp_queue_shape(ctx, region, vtx_offset, ctx->cur_index - 30, 8, 30,
+                        NULL, true);
+        return;
+    }
+#endif
+    if (region.x1 > 1.0f || region.y1 > 1.0f || region.x2 < -1.0f ||
+        region.y2 < -1.0f || ctx->skip_layer) {
+        ctx->cur_vertex -= num_vertices;
+        return;
+    }
+    // only the fill of each rect is hit tested
+    const uint32_t num_hit_shapes = ctx->num_hit_shapes;
+    tgp_record_hit(ctx, region, vtx_offset, num_vertices,
+                   antialiased ? tgp_rect_indices_aa : tgp_rect_indices, 6,
+                   antialiased ? 8 : 4);
+#ifdef TINYGP_BOX_SHADOWS
+    tgp_assign_shadow(ctx, vtx_offset, num_vertices);
+#endif
+#ifdef TINYGP_OPAQUE_PASS
+    // without fringes (and with opaque colors) rects are opaque, otherwise
+    // the fringes of a batch of rects may overlap the fill of others
+    const bool opaque = tgp_assign_depth(ctx, vtx_offset, num_vertices);
+#else
+    const bool opaque = false;
+#endif
+
+    // append to the previous command if it draws rects right before these
+    tgp_command_key* key = tgp_peek_prev_commands(ctx, 1);
+    if (key != NULL && key->type == TGP_COMMAND_DRAW_RECTS &&
+        key->pipeline == ctx->cur_pipeline && key->opaque == opaque) {
+        tgp_draw_rects_command* prev =
+            &tgp_command_data_of(ctx, key)->draw_rects;
+        if (prev->antialiased == antialiased &&
+            prev->draw.vtx_offset + prev->draw.num_vertices == vtx_offset &&
+            prev->draw.num_vertices + num_vertices <= TGP_MAX_DRAW_VERTICES
+#if defined(TINYGP_USERDATA_TYPE) && defined(TINYGP_COMPARE_USERDATA)
+            && TINYGP_COMPARE_USERDATA(*tgp_command_userdata_of(ctx, key),
+                                       ctx->current_userdata)
+#endif
+        ) {
+            tgp_region* r = &key->region;
+            r->x1 = TGP_MIN(r->x1, region.x1);
+            r->y1 = TGP_MIN(r->y1, region.y1);
+            r->x2 = TGP_MAX(r->x2, region.x2);
+            r->y2 = TGP_MAX(r->y2, region.y2);
+            prev->draw.num_vertices += num_vertices;
+            prev->draw.num_indices += num_indices;
+            return;
+        }
+    }
+
+    key = tgp_next_command(ctx, TGP_COMMAND_DRAW_RECTS);
+    if (key == NULL) {
+        ctx->cur_vertex -= num_vertices;
+        tgp_drop_hits(ctx, num_hit_shapes);
+        return;
+    }
+    key->region = region;
+    key->opaque = opaque;
+    tgp_set_draw_state(ctx, key);
+    tgp_draw_rects_command* cmd = &tgp_command_data_of(ctx, key)->draw_rects;
+    cmd->draw = TGP_LITERAL(tgp_draw_command){vtx_offset, 0, num_vertices,
+                                              num_indices};
+    cmd->antialiased = antialiased;
+}
+
+TGPDEF void tgp_draw_rect(tgp_context* ctx, tgp_rect rect) {
+    tgp_draw_rects(ctx, &rect, NULL, 1);
+}
+
+// draws axis-aligned rectangles (in the current transform), using the
+// current color if `colors` is NULL. this is a lot cheaper than drawing them
+// with tgp_draw_convex_polygon(): the antialiasing fringe does not need any
+// normals, and no indices are written
+TGPDEF void tgp_draw_rects(tgp_context* ctx, const tgp_rect* rects,
+                           const tgp_color* colors, uint32_t num_rects) {
+    TINYGP_ASSERT(ctx != NULL && (rects != NULL || num_rects == 0));
+    if (colors == NULL && tgp_is_transparent(ctx)) {
+        return;
+    }
+    const bool       aa = ctx->antialiasing;
+    const uint32_t   rect_vertices = aa ? 8 : 4;
+    const uint32_t   rect_indices = aa ? 30 : 6;
+    const float       hs = ctx->fringe_scale * 0.5f;
+    const tgp_mat2x3* m = tgp_cpu_matrix(ctx);
+    const tgp_vec2    zero = {0.0f, 0.0f};
+
+    uint32_t i = 0;
+    while (i < num_rects) {
+        // write as many rects as fit into a single command
+        if (!tgp_has_room(ctx, rect_vertices, 0)) {
+            ctx->num_dropped++;
+            return;
+        }
+        const uint32_t room =
+            TGP_MIN(ctx->max_vertices - ctx->cur_vertex,
+                    TGP_MAX_DRAW_VERTICES) / rect_vertices;
+        const uint32_t count = TGP_MIN(num_rects - i, room);
+
+        // vertices are transformed while they are written, so they are only
+        // touched once
+        const uint32_t vtx_offset = ctx->cur_vertex;
+        tgp_vertex*    vtx = &ctx->vertices[vtx_offset];
+        tgp_region     region = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+        uint32_t       written = 0;
+        for (const uint32_t end = i + count; i < end; i++) {
+            const tgp_color color = colors != NULL ? colors[i] : ctx->color;
+            if (color.a <= 0.0f) {
+                continue;
+            }
+            const tgp_rect r = rects[i];
+            const float    x1 = TGP_MIN(r.x, r.x + r.w);
+            const float    y1 = TGP_MIN(r.y, r.y + r.h);
+            const float    x2 = TGP_MAX(r.x, r.x + r.w);
+            const float    y2 = TGP_MAX(r.y, r.y + r.h);
+
+            tgp_vec2 corners[8];
+            if (aa) {
+                // the corner normals of an axis-aligned rect are diagonal,
+                // so the fringe is just offset by half its size on both axes
+                corners[0] = TGP_LITERAL(tgp_vec2){x1 + hs, y1 + hs};
+                corners[1] = TGP_LITERAL(tgp_vec2){x1 - hs, y1 - hs};
+                corners[2] = TGP_LITERAL(tgp_vec2){x2 - hs, y1 + hs};
+                corners[3] = TGP_LITERAL(tgp_vec2){x2 + hs, y1 - hs};
+                corners[4] = TGP_LITERAL(tgp_vec2){x2 - hs, y2 - hs};
+                corners[5] = TGP_LITERAL(tgp_vec2){x2 + hs, y2 + hs};
+                corners[6] = TGP_LITERAL(tgp_vec2){x1 + hs, y2 - hs};
+                corners[7] = TGP_LITERAL(tgp_vec2){x1 - hs, y2 + hs};
+            } else {
+                corners[0] = TGP_LITERAL(tgp_vec2){x1, y1};
+                corners[1] = TGP_LITERAL(tgp_vec2){x2, y1};
+                corners[2] = TGP_LITERAL(tgp_vec2){x2, y2};
+                corners[3] = TGP_LITERAL(tgp_vec2){x1, y2};
+            }
+
+            const tgp_color trans = {color.r, color.g, color.b, 0.0f};
+            for (uint32_t v = 0; v < rect_vertices; v++) {
+                const tgp_vec2 pos = tgp_apply_cpu_matrix(m, corners[v]);
+                region.x1 = TGP_MIN(region.x1, pos.x);
+                region.y1 = TGP_MIN(region.y1, pos.y);
+                region.x2 = TGP_MAX(region.x2, pos.x);
+                region.y2 = TGP_MAX(region.y2, pos.y);
+                vtx[v].position = pos;
+                vtx[v].texcoord = zero;
+                // odd vertices are on the outside of the fringe
+                vtx[v].color = (aa && (v & 1)) ? trans : color;
+            }
+            vtx += rect_vertices;
+            written++;
+        }
+        if (written == 0) {
+            continue;
+        }
+
+        const uint32_t num_vertices = written * rect_vertices;
+        ctx->cur_vertex += num_vertices;
+        tgp_queue_draw_rects(ctx, tgp_clip_region(ctx, region), vtx_offset,
+                             num_vertices, written * rect_indices, aa);
+    }
+}
+
+#ifdef TINYGP_BOX_SHADOWS
+// approximation of erf() with a maximum error of 5e-4, backends evaluate the
+// same one
+static inline float tgp_erf(float x) {
+    const float a = fabsf(x);
+    const float p =
+        1.0f + (0.278393f + (0.230389f + 0.078108f * a * a) * a) * a;
+    const float d = p * p;
+    const float e = 1.0f - 1.0f / (d * d);
+    return x < 0.0f ? -e : e;
+}
+
+// coverage of a row of the box at height `y` (relative to its center),
+// blurred horizontally. the rounded corners make rows near the top and
+// bottom shorter
+static inline float tgp_box_shadow_row(float x, float y, tgp_vec2 half_size,
+                                       float radius, float sigma) {
+    const float delta = TGP_MIN(half_size.y - radius - fabsf(y), 0.0f);
+    const float curved = half_size.x - radius +
+                         sqrtf(TGP_MAX(radius * radius - delta * delta, 0.0f));
+    const float s = 0.70710678f / sigma;
+    return 0.5f * (tgp_erf((x + curved) * s) - tgp_erf((x - curved) * s));
+}
+
+// opacity of a box shadow at `point`, relative to the center of the box. the
+// horizontal blur is exact, the vertical one is integrated with 4 samples
+// (Evan Wallace's approximation of a blurred rounded rect). this is what a
+// backend evaluates for vertices with a shadow, see tgp_vertex
+TGPDEF float tgp_box_shadow_alpha(tgp_vec2 point, tgp_vec2 half_size,
+                                  float radius, float sigma) {
+    // everything further than 3 deviations away is too faint to see
+    const float low = point.y - half_size.y;
+    const float high = point.y + half_size.y;
+    const float start = TGP_MIN(TGP_MAX(-3.0f * sigma, low), high);
+    const float end = TGP_MIN(TGP_MAX(3.0f * sigma, low), high);
+    const float step = (end - start) * 0.25f;
+
+    float y = start + step * 0.5f;
+    float alpha = 0.0f;
+    for (int i = 0; i < 4; i++) {
+        alpha += tgp_box_shadow_row(point.x, point.y - y, half_size, radius,
+                                    sigma) *
+                 expf(-y * y / (2.0f * sigma * sigma)) * step;
+        y += step;
+    }
+    return alpha / (2.5066283f * sigma);
+}
+
+// draws the shadow of a (rounded) rect in the current color. `blur` is the
+// blur radius like in CSS (the standard deviation of the blur is half of it),
+// the box is grown by `spread` and moved by `offset` first. the shadow is a
+// single quad, so any number of them can be batched into one draw call
+TGPDEF void tgp_draw_box_shadow(tgp_context* ctx, tgp_rect rect, float radius,
+                                float blur, float spread, tgp_vec2 offset) {
+    TINYGP_ASSERT(ctx != NULL);
+    const float hw = fabsf(rect.w) * 0.5f + spread;
+    const float hh = fabsf(rect.h) * 0.5f + spread;
+    if (hw <= 0.0f || hh <= 0.0f || tgp_is_transparent(ctx)) {
+        return;
+    }
+    const float    sigma = TGP_MAX(blur * 0.5f, 0.5f);
+    const float    r = TGP_MIN(TGP_MAX(radius + spread, 0.0f), TGP_MIN(hw, hh));
+    const tgp_vec2 center = {rect.x + rect.w * 0.5f + offset.x,
+                             rect.y + rect.h * 0.5f + offset.y};
+
+    tgp_vertex* vtx_write_ptr;
+    tgp_index*  idx_write_ptr;
+    if (!tgp_reserve(ctx, 4, 6, &vtx_write_ptr, &idx_write_ptr)) {
+        return;
+    }
+    const uint32_t vtx_offset = ctx->cur_vertex - 4;
+    const uint32_t idx_offset = ctx->cur_index - 6;
+
+    // the quad covers everything the blur reaches
+    const float    ex = hw + 3.0f * sigma;
+    const float    ey = hh + 3.0f * sigma;
+    const tgp_vec2 corners[4] = {
+        {-ex, -ey},
+        {ex,  -ey},
+        {ex,  ey },
+        {-ex, ey },
+    };
+    for (int i = 0; i < 4; i++) {
+        vtx_write_ptr[i].position = TGP_LITERAL(tgp_vec2){
+            center.x + corners[i].x, center.y + corners[i].y};
+        vtx_write_ptr[i].texcoord = corners[i];
+    }
+    memcpy(idx_write_ptr, tgp_rect_indices, sizeof(tgp_rect_indices));
+
+    ctx->shadow[0] = hw;
+    ctx->shadow[1] = hh;
+    ctx->shadow[2] = r;
+    ctx->shadow[3] = sigma;
+    tgp_queue_draw_transform(ctx, vtx_offset, idx_offset, 4, 6, false, true);
+    memset(ctx->shadow, 0, sizeof(ctx->shadow));
+}
+#endif
+
+TGPDEF void tgp_path_clear(tgp_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL);
+    ctx->cur_path = 0;
+    memset(&ctx->path_lod, 0, sizeof(ctx->path_lod));
+}
+
+TGPDEF void tgp_path_to(tgp_context* ctx, tgp_vec2 point) {
+    TINYGP_ASSERT(ctx != NULL && ctx->cur_path < ctx->max_path);
+    ctx->path[ctx->cur_path++] = point;
+}
+
+TGPDEF void tgp_path_to_merge_duplicate(tgp_context* ctx, tgp_vec2 point) {
+    TINYGP_ASSERT(ctx != NULL);
+    if (ctx->cur_path != 0) {
+        tgp_vec2 prev_point = ctx->path[ctx->cur_path - 1];
+        if (point.x == prev_point.x && point.y == prev_point.y) {
+            return;
+        }
+    }
+    tgp_path_to(ctx, point);
+}
+
+// position of a point in pixels, relative to the viewport
+static inline tgp_vec2 tgp_to_pixels(tgp_context* ctx, tgp_vec2 point) {
+    const tgp_vec2 clip = tgp_mult_mat3_vec2(&ctx->mvp, point);
+    return TGP_LITERAL(tgp_vec2){
+        (clip.x + 1.0f) * 0.5f * (float)ctx->viewport.w,
+        (1.0f - clip.y) * 0.5f * (float)ctx->viewport.h};
+}
+
+static void tgp_path_set_lod_mode(tgp_context* ctx, tgp_path_lod_mode mode) {
+    if (ctx->path_lod.mode != mode) {
+        tgp_path_flush(ctx);
+        ctx->path_lod.mode = mode;
+    }
+}
+
+// adds the first and last sample of the current column and the extremes in
+// between, in the order they were seen, so the line still covers the same
+// pixels
+static void tgp_path_add_column(tgp_context* ctx) {
+    tgp_path_lod*  lod = &ctx->path_lod;
+    const uint32_t last_i = lod->column_count - 1;
+    uint32_t       a = lod->min_i, b = lod->max_i;
+    tgp_vec2       pa = lod->min, pb = lod->max;
+    if (a > b) {
+        const uint32_t i = a;
+        a = b;
+        b = i;
+        const tgp_vec2 p = pa;
+        pa = pb;
+        pb = p;
+    }
+    tgp_path_to_merge_duplicate(ctx, lod->first);
+    if (a != 0 && a != last_i) {
+        tgp_path_to_merge_duplicate(ctx, pa);
+    }
+    if (b != 0 && b != a && b != last_i) {
+        tgp_path_to_merge_duplicate(ctx, pb);
+    }
+    if (last_i != 0) {
+        tgp_path_to_merge_duplicate(ctx, lod->last);
+    }
+}
+
+// adds a series whose x coordinates never decrease (after the transform) to
+// the path, keeping at most 4 points for every pixel column of the viewport.
+// columns left and right of the viewport are collapsed into one on each
+// side, so the size of the output only depends on the viewport width.
+//
+// a long series can be added in consecutive chunks, the last column is only
+// added by tgp_path_flush()
+TGPDEF void tgp_path_decimate(tgp_context* ctx, const tgp_vec2* points,
+                              uint32_t count) {
+    TINYGP_ASSERT(ctx != NULL && (points != NULL || count == 0));
+    tgp_path_set_lod_mode(ctx, TGP_PATH_LOD_DECIMATE);
+    tgp_path_lod* lod = &ctx->path_lod;
+    const float   w = (float)ctx->viewport.w;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const tgp_vec2 p = points[i];
+        const tgp_vec2 px = tgp_to_pixels(ctx, p);
+        const float    x = TGP_MIN(TGP_MAX(floorf(px.x), -1.0f), w);
+        const int32_t  column = (int32_t)x;
+
+        if (lod->count == 0 || column != lod->column) {
+            if (lod->count != 0) {
+                tgp_path_add_column(ctx);
+            }
+            lod->column = column;
+            lod->column_count = 0;
+            lod->first = lod->min = lod->max = p;
+            lod->min_y = lod->max_y = px.y;
+            lod->min_i = lod->max_i = 0;
+        } else if (px.y < lod->min_y) {
+            lod->min = p;
+            lod->min_y = px.y;
+            lod->min_i = lod->column_count;
+        } else if (px.y > lod->max_y) {
+            lod->max = p;
+            lod->max_y = px.y;
+            lod->max_i = lod->column_count;
+        }
+        lod->last = p;
+        lod->column_count++;
+        lod->count++;
+    }
+}
+
+// returns true if a segment from the anchor to `px` can still replace every
+// point skipped so far, and narrows the allowed directions if it can
+static bool tgp_path_cone_fits(tgp_path_lod* lod, tgp_vec2 px,
+                               float tolerance) {
+    const float dx = px.x - lod->anchor_px.x;
+    const float dy = px.y - lod->anchor_px.y;
+    const float dist = sqrtf(dx * dx + dy * dy);
+    // skipped points are at most `t` away from the line and at most `t`
+    // past the end of the segment, so at most `tolerance` from the segment
+    const float t = tolerance * 0.70710678f;
+
+    if (dist <= t) {
+        // too close to the anchor to have a direction, this is only fine
+        // if nothing further away was skipped
+        return !lod->cone_open;
+    }
+    // the path must not fold back over points that were skipped
+    if (dist + t < lod->reach) {
+        return false;
+    }
+
+    // directions from the anchor that pass within `t` of px
+    float       angle = atan2f(dy, dx);
+    const float half = asinf(t / dist);
+    if (!lod->cone_open) {
+        lod->cone_min = angle - half;
+        lod->cone_max = angle + half;
+        lod->cone_open = true;
+        lod->reach = dist;
+        return true;
+    }
+
+    // keep the angle next to the cone so the range never wraps around
+    const float mid = 0.5f * (lod->cone_min + lod->cone_max);
+    if (angle - mid > 3.14159265f) {
+        angle -= 6.28318531f;
+    } else if (angle - mid < -3.14159265f) {
+        angle += 6.28318531f;
+    }
+    if (angle < lod->cone_min || angle > lod->cone_max) {
+        return false;
+    }
+    lod->cone_min = TGP_MAX(lod->cone_min, angle - half);
+    lod->cone_max = TGP_MIN(lod->cone_max, angle + half);
+    lod->reach = TGP_MAX(lod->reach, dist);
+    return true;
+}
+
+// adds a path to the current path, skipping points as long as the result
+// stays within `tolerance` pixels of the original. this is done in a single
+// pass with constant memory (sleeve fitting: a point is only kept when the
+// next one no longer fits into the directions allowed by the points skipped
+// since the last kept one), so a long path can be added in consecutive
+// chunks. the last point is only added by tgp_path_flush()
+TGPDEF void tgp_path_simplify(tgp_context* ctx, const tgp_vec2* points,
+                              uint32_t count, float tolerance) {
+    TINYGP_ASSERT(ctx != NULL && (points != NULL || count == 0));
+    TINYGP_ASSERT(tolerance >= 0.0f);
+    tgp_path_set_lod_mode(ctx, TGP_PATH_LOD_SIMPLIFY);
+    tgp_path_lod* lod = &ctx->path_lod;
+
+    for (uint32_t i = 0; i < count; i++) {
+        const tgp_vec2 p = points[i];
+        const tgp_vec2 px = tgp_to_pixels(ctx, p);
+
+        if (lod->count == 0) {
+            tgp_path_to_merge_duplicate(ctx, p);
+            lod->anchor = p;
+            lod->anchor_px = px;
+        } else if (!tgp_path_cone_fits(lod, px, tolerance)) {
+            // the previous point becomes the new anchor
+            tgp_path_to_merge_duplicate(ctx, lod->prev);
+            lod->anchor = lod->prev;
+            lod->anchor_px = lod->prev_px;
+            lod->cone_open = false;
+            lod->reach = 0.0f;
+            tgp_path_cone_fits(lod, px, tolerance);
+        }
+        lod->prev = p;
+        lod->prev_px = px;
+        lod->count++;
+    }
+}
+
+// like tgp_path_decimate(), but reads the points from caller records
+TGPDEF void tgp_path_decimate_strided(tgp_context*            ctx,
+                                      const tgp_point_layout* layout,
+                                      const void* data, uint32_t count) {
+    tgp_vec2 chunk[TGP_POINT_CHUNK];
+    for (uint32_t i = 0; i < count; i += TGP_POINT_CHUNK) {
+        const uint32_t n = TGP_MIN(count - i, TGP_POINT_CHUNK);
+        tgp_read_points(layout,
+                        (const unsigned char*)data + i * layout->stride, n,
+                        chunk);
+        tgp_path_decimate(ctx, chunk, n);
+    }
+}
+
+// like tgp_path_simplify(), but reads the points from caller records
+TGPDEF void tgp_path_simplify_strided(tgp_context*            ctx,
+                                      const tgp_point_layout* layout,
+                                      const void* data, uint32_t count,
+                                      float tolerance) {
+    tgp_vec2 chunk[TGP_POINT_CHUNK];
+    for (uint32_t i = 0; i < count; i += TGP_POINT_CHUNK) {
+        const uint32_t n = TGP_MIN(count - i, TGP_POINT_CHUNK);
+        tgp_read_points(layout,
+                        (const unsigned char*)data + i * layout->stride, n,
+                        chunk);
+        tgp_path_simplify(ctx, chunk, n, tolerance);
+    }
+}
+
+// adds the points that tgp_path_decimate() or tgp_path_simplify() are still
+// holding back to the path, the next call starts a new series
+TGPDEF void tgp_path_flush(tgp_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL);
+    tgp_path_lod* lod = &ctx->path_lod;
+    if (lod->count != 0) {
+        if (lod->mode == TGP_PATH_LOD_DECIMATE) {
+            tgp_path_add_column(ctx);
+        } else if (lod->mode == TGP_PATH_LOD_SIMPLIFY) {
+            tgp_path_to_merge_duplicate(ctx, lod->prev);
+        }
+    }
+    memset(lod, 0, sizeof(*lod));
+}
+
+// fills the current path (closed implicitly) on the GPU, without
+// triangulating it on the CPU. it can be concave, self-intersecting, or have
+// holes when several closed loops are joined into one path (go back to the
+// start of a loop before moving to the next one). this is much cheaper than
+// triangulating paths with many thousand points, but the edges are not
+// antialiased and the backend needs a stencil buffer. the path needs as many
+// vertices as it has points, plus 4
+TGPDEF void tgp_fill_path(tgp_context* ctx, tgp_fill_rule rule) {
+    TINYGP_ASSERT(ctx != NULL);
+    tgp_path_flush(ctx);
+    const uint32_t num_points = ctx->cur_path;
+    if (num_points < 3 || tgp_is_transparent(ctx)) {
+        return;
+    }
+
+    tgp_vertex* vtx_write_ptr;
+    tgp_index*  idx_write_ptr;
+    if (!tgp_reserve(ctx, num_points + 4, 0, &vtx_write_ptr,
+                     &idx_write_ptr)) {
+        return;
+    }
+    const uint32_t vtx_offset = ctx->cur_vertex - (num_points + 4);
+
+    const tgp_mat2x3* m = tgp_cpu_matrix(ctx);
+    tgp_region        bounds = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+    tgp_vertex        v;
+    memset(&v, 0, sizeof(v));
+    v.color = ctx->color;
+    for (uint32_t i = 0; i < num_points; i++) {
+        v.position = tgp_apply_cpu_matrix(m, ctx->path[i]);
+        tgp_region_add(&bounds, v.position);
+        vtx_write_ptr[i] = v;
+    }
+    const tgp_vec2 corners[4] = {
+        {bounds.x1, bounds.y1},
+        {bounds.x2, bounds.y1},
+        {bounds.x2, bounds.y2},
+        {bounds.x1, bounds.y2},
+    };
+    for (int i = 0; i < 4; i++) {
+        v.position = corners[i];
+        vtx_write_ptr[num_points + i] = v;
+    }
+
+    const tgp_region region = tgp_clip_region(ctx, bounds);
+    tgp_command_key* key = NULL;
+    if (region.x1 <= 1.0f && region.y1 <= 1.0f && region.x2 >= -1.0f &&
+        region.y2 >= -1.0f && !ctx->skip_layer) {
+        key = tgp_next_command(ctx, TGP_COMMAND_FILL_PATH);
+    }
+    if (key == NULL) {
+        ctx->cur_vertex -= num_points + 4;
+        return;
+    }
+    // there are no triangles to test, only the bounding rect
+    tgp_record_hit(ctx, region, vtx_offset, 0, NULL, 0, 0);
+#ifdef TINYGP_BOX_SHADOWS
+    tgp_assign_shadow(ctx, vtx_offset, num_points + 4);
+#endif
+#ifdef TINYGP_OPAQUE_PASS
+    // fills are drawn in order with the translucent geometry
+    tgp_assign_depth(ctx, vtx_offset, num_points + 4);
+#endif
+
+    key->region = region;
+    tgp_set_draw_state(ctx, key);
+    tgp_fill_path_command* cmd = &tgp_command_data_of(ctx, key)->fill_path;
+    cmd->draw = TGP_LITERAL(tgp_draw_command){vtx_offset, 0, num_points + 4, 0};
+    cmd->rule = rule;
+}
+
+// adds the area a line inside of a single row covers to the cells it
+// crosses, and the area to the right of it to the cell after it, so that the
+// prefix sum of the cells is the coverage of every pixel. `x0` and `x1` are
+// relative to the first cell and not negative, `d` is the height of the line
+// in the row, negative if the path goes up
+static inline void tgp_raster_line(float* cells, float x0, float x1,
+                                   float d) {
+    const float xmin = TGP_MIN(x0, x1);
+    const float xmax = TGP_MAX(x0, x1);
+    const int   x0i = (int)xmin;
+    const int   x1i = (int)ceilf(xmax);
+    if (x1i <= x0i + 1) {
+        // within a single cell, the rest of it is to the right of the line
+        const float xm = 0.5f * (x0 + x1) - (float)x0i;
+        cells[x0i] += d - d * xm;
+        cells[x0i + 1] += d * xm;
+        return;
+    }
+
+    // the area to the left of the line grows quadratically in the first and
+    // the last cell, and linearly in between
+    const float s = 1.0f / (xmax - xmin);
+    const float x0f = xmin - (float)x0i;
+    const float a0 = 0.5f * s * (1.0f - x0f) * (1.0f - x0f);
+    const float x1f = xmax - (float)x1i + 1.0f;
+    const float am = 0.5f * s * x1f * x1f;
+    cells[x0i] += d * a0;
+    if (x1i == x0i + 2) {
+        cells[x0i + 1] += d * (1.0f - a0 - am);
+    } else {
+        const float a1 = s * (1.5f - x0f);
+        cells[x0i + 1] += d * (a1 - a0);
+        for (int xi = x0i + 2; xi < x1i - 1; xi++) {
+            cells[xi] += d * s;
+        }
+        const float a2 = a1 + (float)(x1i - x0i - 3) * s;
+        cells[x1i - 1] += d * (1.0f - a2 - am);
+    }
+    cells[x1i] += d * am;
+}
+
+// adds the part of a line inside of a row that is between 0 and `w`. parts
+// to the left cover everything to their right, so they are moved onto the
+// left border, parts to the right do not cover anything
+static void tgp_raster_clip_line(float* cells, float x0, float x1, float d,
+                                 float w) {
+    if ((x0 < 0.0f && x1 > 0.0f) || (x0 > 0.0f && x1 < 0.0f)) {
+        const float t = x0 / (x0 - x1);
+        tgp_raster_clip_line(cells, x0, 0.0f, d * t, w);
+        tgp_raster_clip_line(cells, 0.0f, x1, d - d * t, w);
+        return;
+    }
+    if ((x0 < w && x1 > w) || (x0 > w && x1 < w)) {
+        const float t = (w - x0) / (x1 - x0);
+        tgp_raster_clip_line(cells, x0, w, d * t, w);
+        tgp_raster_clip_line(cells, w, x1, d - d * t, w);
+        return;
+    }
+    if (x0 >= w && x1 >= w) {
+        return;
+    }
+    tgp_raster_line(cells, TGP_MAX(x0, 0.0f), TGP_MAX(x1, 0.0f), d);
+}
+
+// replaces `count` cells with their prefix sum, turned into coverage
+// according to `rule`
+static void tgp_raster_coverage(float* cells, int count, tgp_fill_rule rule) {
+    int   i = 0;
+    float sum = 0.0f;
+#ifdef TINYGP_ENABLE_SSE2
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    __m128       carry = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+        // prefix sum of 4 cells in two shifted adds, plus the sum so far
+        __m128 x = _mm_loadu_ps(&cells[i]);
+        x = _mm_add_ps(x, _mm_castsi128_ps(
+                              _mm_slli_si128(_mm_castps_si128(x), 4)));
+        x = _mm_add_ps(x, _mm_castsi128_ps(
+                              _mm_slli_si128(_mm_castps_si128(x), 8)));
+        x = _mm_add_ps(x, carry);
+        carry = _mm_shuffle_ps(x, x, _MM_SHUFFLE(3, 3, 3, 3));
+
+        __m128 a = _mm_andnot_ps(sign, x);
+        if (rule == TGP_FILL_EVEN_ODD) {
+            // distance to the closest even number
+            const __m128 f = _mm_cvtepi32_ps(
+                _mm_cvttps_epi32(_mm_mul_ps(a, half)));
+            a = _mm_sub_ps(a, _mm_mul_ps(f, two));
+            a = _mm_min_ps(a, _mm_sub_ps(two, a));
+        } else {
+            a = _mm_min_ps(a, one);
+        }
+        _mm_storeu_ps(&cells[i], a);
+    }
+    sum = _mm_cvtss_f32(carry);
+#endif
+    for (; i < count; i++) {
+        sum += cells[i];
+        float a = fabsf(sum);
+        if (rule == TGP_FILL_EVEN_ODD) {
+            a -= 2.0f * (float)(int)(a * 0.5f);
+            a = TGP_MIN(a, 2.0f - a);
+        } else {
+            a = TGP_MIN(a, 1.0f);
+        }
+        cells[i] = a;
+    }
+}
+
+static int tgp_compare_raster_edges(const void* a, const void* b) {
+    const float ya = ((const tgp_raster_edge*)a)->y0;
+    const float yb = ((const tgp_raster_edge*)b)->y0;
+    return (ya > yb) - (ya < yb);
+}
+
+// fills the current path (closed implicitly) with the current color, like
+// tgp_fill_path(), but on the CPU: the exact area of every pixel that is
+// covered is blended into `image`, which is the screen (the top left pixel
+// of the image is the top left pixel of the screen). the blending is the
+// same as in the GL backend.
+//
+// this is meant for rendering complex shapes without a GPU. it only touches
+// the pixels along the edges of the path and the ones in between them, and
+// the quality of the antialiasing does not depend on the size of the shape.
+// where edges cross inside of a pixel its coverage is approximate. returns
+// false if the memory it needs could not be allocated
+TGPDEF bool tgp_rasterize_path(tgp_context* ctx, tgp_fill_rule rule,
+                               tgp_image* image) {
+    TINYGP_ASSERT(ctx != NULL && image != NULL && image->pixels != NULL);
+    tgp_path_flush(ctx);
+    const uint32_t num_points = ctx->cur_path;
+    if (num_points < 3 || tgp_is_transparent(ctx)) {
+        return true;
+    }
+
+    // clip to the viewport, the scissor and the image. window coordinates
+    // have the bottom row first
+    const tgp_irect vp = ctx->viewport;
+    tgp_irect       clip = vp;
+    if (ctx->scissor.w >= 0 && ctx->scissor.h >= 0) {
+        const tgp_irect s = {vp.x + ctx->scissor.x, vp.y + ctx->scissor.y,
+                             ctx->scissor.w, ctx->scissor.h};
+        clip = TGP_LITERAL(tgp_irect){TGP_MAX(clip.x, s.x),
+                                      TGP_MAX(clip.y, s.y),
+                                      TGP_MIN(clip.x + clip.w, s.x + s.w),
+                                      TGP_MIN(clip.y + clip.h, s.y + s.h)};
+        clip.w -= clip.x;
+        clip.h -= clip.y;
+    }
+    const int cx0 = TGP_MAX(clip.x, 0);
+    const int cx1 = TGP_MIN(clip.x + clip.w, image->w);
+    const int cy0 = TGP_MAX(ctx->screen_size.h - clip.y - clip.h, 0);
+    const int cy1 = TGP_MIN(ctx->screen_size.h - clip.y, image->h);
+    if (cx0 >= cx1 || cy0 >= cy1) {
+        return true;
+    }
+    const int cw = cx1 - cx0;
+
+    // cells of one row, with room for the cell to the right of the last
+    // pixel and for the SIMD prefix sum
+    const uint32_t num_cells = (uint32_t)cw + 6;
+    if (ctx->raster_edges == NULL) {
+        ctx->raster_edges = (tgp_raster_edge*)malloc(ctx->max_path *
+                                                     sizeof(tgp_raster_edge));
+        ctx->raster_active =
+            (uint32_t*)malloc(ctx->max_path * sizeof(uint32_t));
+    }
+    if (ctx->raster_cells_capacity < num_cells) {
+        free(ctx->raster_cells);
+        ctx->raster_cells = (float*)calloc(num_cells, sizeof(float));
+        ctx->raster_cells_capacity = ctx->raster_cells ? num_cells : 0;
+    }
+    if (ctx->raster_edges == NULL || ctx->raster_active == NULL ||
+        ctx->raster_cells == NULL) {
+        return false;
+    }
+    tgp_raster_edge* edges = ctx->raster_edges;
+    uint32_t*        active = ctx->raster_active;
+    float*           cells = ctx->raster_cells;
+
+    // transform the points to pixels of the image, x relative to the clip
+    // rect, and keep the edges that are not horizontal and cross it
+    const tgp_mat2x3 m = ctx->mvp;
+    const float      hw = (float)vp.w * 0.5f;
+    const float      hh = (float)vp.h * 0.5f;
+    const float      ox = (float)(vp.x - cx0) + hw;
+    const float      oy = (float)(ctx->screen_size.h - vp.y) - hh;
+    uint32_t         num_edges = 0;
+    tgp_vec2         prev = {0.0f, 0.0f};
+    for (uint32_t i = 0; i <= num_points; i++) {
+        const tgp_vec2 clip_pos =
+            tgp_mult_mat3_vec2(&m, ctx->path[i % num_points]);
+        const tgp_vec2 p = {ox + clip_pos.x * hw, oy - clip_pos.y * hh};
+        if (i != 0 && p.y != prev.y) {
+            const bool     down = p.y > prev.y;
+            const tgp_vec2 a = down ? prev : p;
+            const tgp_vec2 b = down ? p : prev;
+            if (b.y > (float)cy0 && a.y < (float)cy1) {
+                edges[num_edges++] = TGP_LITERAL(tgp_raster_edge){
+                    a.x, a.y, b.y, (b.x - a.x) / (b.y - a.y),
+                    down ? 1.0f : -1.0f};
+            }
+        }
+        prev = p;
+    }
+    qsort(edges, num_edges, sizeof(tgp_raster_edge),
+          tgp_compare_raster_edges);
+
+    // source color, blended like glBlendFuncSeparate(GL_SRC_ALPHA,
+    // GL_ONE_MINUS_SRC_ALPHA, GL_ONE, GL_ONE_MINUS_SRC_ALPHA)
+    const tgp_color c = ctx->color;
+    const float     src[4] = {c.r * 255.0f, c.g * 255.0f, c.b * 255.0f,
+                              255.0f};
+
+    uint32_t next = 0, num_active = 0;
+    for (int y = cy0; y < cy1; y++) {
+        const float top = (float)y;
+        const float bottom = top + 1.0f;
+        while (next < num_edges && edges[next].y0 < bottom) {
+            active[num_active++] = next++;
+        }
+
+        // accumulate the edges crossing the row, remembering which cells
+        // they touched
+        float xmin = FLT_MAX, xmax = -FLT_MAX;
+        for (uint32_t i = 0; i < num_active;) {
+            const tgp_raster_edge* e = &edges[active[i]];
+            if (e->y1 <= top) {
+                active[i] = active[--num_active];
+                continue;
+            }
+            const float ya = TGP_MAX(e->y0, top);
+            const float yb = TGP_MIN(e->y1, bottom);
+            const float xa = e->x0 + (ya - e->y0) * e->dxdy;
+            const float xb = e->x0 + (yb - e->y0) * e->dxdy;
+            tgp_raster_clip_line(cells, xa, xb, e->dir * (yb - ya),
+                                 (float)cw);
+            xmin = TGP_MIN(xmin, TGP_MIN(xa, xb));
+            xmax = TGP_MAX(xmax, TGP_MAX(xa, xb));
+            i++;
+        }
+        if (xmin > xmax) {
+            continue;
+        }
+        const int lo = (int)TGP_MIN(TGP_MAX(xmin, 0.0f), (float)cw);
+        const int hi = (int)TGP_MIN(TGP_MAX(ceilf(xmax) + 2.0f, 0.0f),
+                                    (float)cw + 2.0f);
+        if (hi <= lo) {
+            continue;
+        }
+
+        // right of the touched cells the coverage is 0 again
+        const int end = TGP_MIN(hi, cw);
+        tgp_raster_coverage(&cells[lo], end - lo, rule);
+        uint8_t* px = &image->pixels[(size_t)y * (size_t)image->stride +
+                                     (size_t)(cx0 + lo) * 4];
+        for (int x = lo; x < end; x++, px += 4) {
+            const float a = c.a * cells[x];
+            if (a > 0.0f) {
+                const float ia = 1.0f - a;
+                px[0] = (uint8_t)(src[0] * a + (float)px[0] * ia + 0.5f);
+                px[1] = (uint8_t)(src[1] * a + (float)px[1] * ia + 0.5f);
+                px[2] = (uint8_t)(src[2] * a + (float)px[2] * ia + 0.5f);
+                px[3] = (uint8_t)(src[3] * a + (float)px[3] * ia + 0.5f);
+            }
+        }
+        memset(&cells[lo], 0, (size_t)(hi - lo) * sizeof(float));
+    }
+    return true;
+}
+
+// sets the id of the shapes drawn after this call, so they can be found by
+// tgp_hit_test_point() and tgp_hit_test_rect() once the frame has ended.
+// 0 (the default at the start of a frame) draws shapes that are not
+// recorded. needs tgp_options.max_hit_shapes, shapes drawn into layers are
+// never recorded
+TGPDEF void tgp_set_id(tgp_context* ctx, uint32_t id) {
+    TINYGP_ASSERT(ctx != NULL);
+    ctx->cur_id = id;
+}
+
+static inline bool tgp_point_in_triangle(tgp_vec2 p, tgp_vec2 a, tgp_vec2 b,
+                                         tgp_vec2 c) {
+    // works for both winding orders
+    const float d0 = (b.x - a.x) * (p.y - a.y) - (b.y - a.y) * (p.x - a.x);
+    const float d1 = (c.x - b.x) * (p.y - b.y) - (c.y - b.y) * (p.x - b.x);
+    const float d2 = (a.x - c.x) * (p.y - c.y) - (a.y - c.y) * (p.x - c.x);
+    return (d0 >= 0.0f && d1 >= 0.0f && d2 >= 0.0f) ||
+           (d0 <= 0.0f && d1 <= 0.0f && d2 <= 0.0f);
+}
+
+static bool tgp_triangle_overlaps_rect(const tgp_vec2* p, tgp_region r) {
+    // separating axis test, the rect axes first
+    if (TGP_MAX(TGP_MAX(p[0].x, p[1].x), p[2].x) < r.x1 ||
+        TGP_MIN(TGP_MIN(p[0].x, p[1].x), p[2].x) > r.x2 ||
+        TGP_MAX(TGP_MAX(p[0].y, p[1].y), p[2].y) < r.y1 ||
+        TGP_MIN(TGP_MIN(p[0].y, p[1].y), p[2].y) > r.y2) {
+        return false;
+    }
+    // then the triangle edge normals
+    const float cx = (r.x1 + r.x2) * 0.5f;
+    const float cy = (r.y1 + r.y2) * 0.5f;
+    const float ex = (r.x2 - r.x1) * 0.5f;
+    const float ey = (r.y2 - r.y1) * 0.5f;
+    for (int i = 0; i < 3; i++) {
+        const tgp_vec2 a = p[i];
+        const tgp_vec2 b = p[(i + 1) % 3];
+        const tgp_vec2 c = p[(i + 2) % 3];
+        const float    nx = a.y - b.y;
+        const float    ny = b.x - a.x;
+        const float    d_edge = nx * a.x + ny * a.y;
+        const float    d_opposite = nx * c.x + ny * c.y;
+        const float    d_rect = nx * cx + ny * cy;
+        const float    extent = fabsf(nx) * ex + fabsf(ny) * ey;
+        if (d_rect + extent < TGP_MIN(d_edge, d_opposite) ||
+            d_rect - extent > TGP_MAX(d_edge, d_opposite)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// true if the shape overlaps `r` (a point if r is empty), using its
+// triangles if they were recorded
+static bool tgp_hit_shape_overlaps(tgp_context* ctx, const tgp_hit_shape* s,
+                                   tgp_region r) {
+    if (r.x2 < s->rect.x1 || r.x1 > s->rect.x2 || r.y2 < s->rect.y1 ||
+        r.y1 > s->rect.y2) {
+        return false;
+    }
+    if (s->num_indices == 0) {
+        return true;
+    }
+    const tgp_vec2*  positions = &ctx->hit_positions[s->vtx_offset];
+    const tgp_index* idx = &ctx->hit_indices[s->idx_offset];
+    const bool       point = r.x1 == r.x2 && r.y1 == r.y2;
+    for (uint32_t i = 0; i + 2 < s->num_indices; i += 3) {
+        const tgp_vec2 tri[3] = {positions[idx[i]], positions[idx[i + 1]],
+                                 positions[idx[i + 2]]};
+        if (point ? tgp_point_in_triangle(TGP_LITERAL(tgp_vec2){r.x1, r.y1},
+                                          tri[0], tri[1], tri[2])
+                  : tgp_triangle_overlaps_rect(tri, r)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// returns the id of the topmost shape at (x, y) in the last frame, or 0.
+// coordinates are in pixels with the origin at the top left of the screen
+TGPDEF uint32_t tgp_hit_test_point(tgp_context* ctx, float x, float y) {
+    TINYGP_ASSERT(ctx != NULL);
+    const tgp_region r = {x, y, x, y};
+    uint32_t         best = UINT32_MAX;
+    for (uint32_t i = 0; i < ctx->num_hit_nodes;) {
+        const tgp_hit_node* node = &ctx->hit_nodes[i];
+        if (x < node->bounds.x1 || x > node->bounds.x2 ||
+            y < node->bounds.y1 || y > node->bounds.y2) {
+            i = node->skip;
+            continue;
+        }
+        for (uint32_t j = node->first; j < node->first + node->count; j++) {
+            // later shapes are drawn on top
+            const uint32_t s = ctx->hit_order[j];
+            if ((best == UINT32_MAX || s > best) &&
+                tgp_hit_shape_overlaps(ctx, &ctx->hit_shapes[s], r)) {
+                best = s;
+            }
+        }
+        i++;
+    }
+    return best == UINT32_MAX ? 0 : ctx->hit_shapes[best].id;
+}
+
+// writes the ids of up to `max_ids` shapes of the last frame that overlap
+// `rect` (in pixels) to `ids` and returns how many were written. the order
+// is unspecified, and an id is written once for every shape that used it
+TGPDEF uint32_t tgp_hit_test_rect(tgp_context* ctx, tgp_rect rect,
+                                  uint32_t* ids, uint32_t max_ids) {
+    TINYGP_ASSERT(ctx != NULL && (ids != NULL || max_ids == 0));
+    const tgp_region r = {rect.x, rect.y, rect.x + rect.w, rect.y + rect.h};
+    uint32_t         count = 0;
+    for (uint32_t i = 0; i < ctx->num_hit_nodes && count < max_ids;) {
+        const tgp_hit_node* node = &ctx->hit_nodes[i];
+        if (r.x2 < node->bounds.x1 || r.x1 > node->bounds.x2 ||
+            r.y2 < node->bounds.y1 || r.y1 > node->bounds.y2) {
+            i = node->skip;
+            continue;
+        }
+        for (uint32_t j = node->first;
+             j < node->first + node->count && count < max_ids; j++) {
+            const tgp_hit_shape* s = &ctx->hit_shapes[ctx->hit_order[j]];
+            if (tgp_hit_shape_overlaps(ctx, s, r)) {
+                ids[count++] = s->id;
+            }
+        }
+        i++;
+    }
+    return count;
+}
+
+static tgp_layer* tgp_find_layer(tgp_context* ctx, uint32_t id, bool create) {
+    tgp_layer* free_layer = NULL;
+    for (uint32_t i = 0; i < TGP_MAX_LAYERS; i++) {
+        tgp_layer* layer = &ctx->layers[i];
+        if (layer->used && layer->id == id) {
+            return layer;
+        }
+        if (!layer->used && free_layer == NULL) {
+            free_layer = layer;
+        }
+    }
+    if (!create || free_layer == NULL) {
+        return NULL;
+    }
+    memset(free_layer, 0, sizeof(*free_layer));
+    free_layer->id = id;
+    free_layer->used = true;
+    return free_layer;
+}
+
+// starts recording into the layer `id`, which is an offscreen texture of
+// `w`x`h` pixels that is kept by the backend across frames. returns false if
+// the layer is still valid: nothing has to be drawn until tgp_end_layer()
+// (draws are discarded), and the cached contents are used instead. layers are
+// redrawn after tgp_invalidate_layer() or when their size changes, and kept
+// until tgp_release_layer().
+//
+//     if (tgp_begin_layer(ctx, MAP_LAYER, 1024, 1024)) {
+//         draw_map(ctx);
+//     }
+//     tgp_end_layer(ctx);
+//     tgp_draw_layer(ctx, MAP_LAYER, 0.0f, 0.0f, 1024.0f, 1024.0f);
+TGPDEF bool tgp_begin_layer(tgp_context* ctx, uint32_t id, int w, int h) {
+    TINYGP_ASSERT(ctx != NULL);
+    return tgp_begin_layer_samples(ctx, id, w, h, ctx->msaa_samples);
+}
+
+// same as tgp_begin_layer(), but the layer is rendered with `samples` samples
+// per pixel instead of the ones of the screen (tgp_options.msaa_samples).
+// the geometry of a layer with 2 or more samples has no antialiasing fringes
+TGPDEF bool tgp_begin_layer_samples(tgp_context* ctx, uint32_t id, int w,
+                                    int h, uint32_t samples) {
+    TINYGP_ASSERT(ctx != NULL && w > 0 && h > 0);
+    TINYGP_ASSERT(ctx->cur_layer < 0 && "layers can not be nested");
+    tgp_layer* layer = tgp_find_layer(ctx, id, true);
+    TINYGP_ASSERT(layer != NULL && "too many layers, see tgp_release_layer()");
+    if (layer == NULL) {
+        ctx->skip_layer = true;
+        return false;
+    }
+    ctx->cur_layer = (int32_t)(layer - ctx->layers);
+    samples = samples > 1 ? samples : 0;
+    if (layer->valid && layer->w == w && layer->h == h &&
+        layer->samples == samples) {
+        ctx->skip_layer = true;
+        return false;
+    }
+
+    tgp_command_key* key = tgp_next_command(ctx, TGP_COMMAND_BEGIN_LAYER);
+    if (key == NULL) {
+        ctx->skip_layer = true;
+        return false;
+    }
+    tgp_command_data_of(ctx, key)->layer =
+        TGP_LITERAL(tgp_layer_command){id, w, h, samples};
+    layer->w = w;
+    layer->h = h;
+    layer->samples = samples;
+    layer->version++;
+    layer->valid = true;
+
+    // the layer is a screen of its own
+    ctx->layer_state = TGP_LITERAL(tgp_layer_state){
+        ctx->screen_size, ctx->viewport,  ctx->scissor,
+        ctx->proj,        ctx->transform, ctx->antialiasing,
+    };
+    ctx->screen_size = TGP_LITERAL(tgp_size){w, h};
+    ctx->antialiasing = ctx->fringe_antialiasing && samples == 0;
+    ctx->viewport.w = ctx->viewport.h = -1;
+    ctx->scissor.w = ctx->scissor.h = 0;
+    ctx->transform = tgp_default_transform;
+    tgp_viewport(ctx, 0, 0, w, h);
+    tgp_reset_scissor(ctx);
+    return true;
+}
+
+TGPDEF void tgp_end_layer(tgp_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL && ctx->cur_layer >= 0);
+    ctx->cur_layer = -1;
+    if (ctx->skip_layer) {
+        ctx->skip_layer = false;
+        return;
+    }
+
+    tgp_next_command(ctx, TGP_COMMAND_END_LAYER);
+
+    // restore the state of the screen, the viewport and the scissor are
+    // pushed again since the backend switched them for the layer
+    const tgp_layer_state st = ctx->layer_state;
+    ctx->screen_size = st.screen_size;
+    ctx->viewport.w = ctx->viewport.h = -1;
+    tgp_viewport(ctx, st.viewport.x, st.viewport.y, st.viewport.w,
+                 st.viewport.h);
+    ctx->scissor = TGP_LITERAL(tgp_irect){0, 0, 0, 0};
+    tgp_scissor(ctx, st.scissor.x, st.scissor.y, st.scissor.w, st.scissor.h);
+    ctx->proj = st.proj;
+    ctx->transform = st.transform;
+    ctx->antialiasing = st.antialiasing;
+    tgp_update_projection(ctx);
+}
+
+TGPDEF void tgp_invalidate_layer(tgp_context* ctx, uint32_t id) {
+    TINYGP_ASSERT(ctx != NULL);
+    tgp_layer* layer = tgp_find_layer(ctx, id, false);
+    if (layer != NULL) {
+        layer->valid = false;
+    }
+}
+
+// forgets the layer `id`, so that its slot can be used by another layer (there
+// are at most TGP_MAX_LAYERS). backends free its render target when they need
+// the room for a new layer
+TGPDEF void tgp_release_layer(tgp_context* ctx, uint32_t id) {
+    TINYGP_ASSERT(ctx != NULL);
+    tgp_layer* layer = tgp_find_layer(ctx, id, false);
+    if (layer == NULL) {
+        return;
+    }
+    TINYGP_ASSERT(ctx->cur_layer != (int32_t)(layer - ctx->layers) &&
+                  "the layer is being recorded");
+    layer->used = false;
+    layer->valid = false;
+}
+
+// draws the contents of a layer as a single quad, tinted by the current color
+TGPDEF void tgp_draw_layer(tgp_context* ctx, uint32_t id, float x, float y,
+                           float w, float h) {
+    TINYGP_ASSERT(ctx != NULL && ctx->cur_layer < 0);
+    const tgp_layer* layer = tgp_find_layer(ctx, id, false);
+    if (layer == NULL || !layer->valid || tgp_is_transparent(ctx)) {
+        return;
+    }
+
+    tgp_vertex* vtx_write_ptr;
+    tgp_index*  idx_write_ptr;
+    if (!tgp_reserve(ctx, 4, 6, &vtx_write_ptr, &idx_write_ptr)) {
+        return;
+    }
+    const uint32_t vtx_offset = ctx->cur_vertex - 4;
+    const uint32_t idx_offset = ctx->cur_index - 6;
+
+    // layers are stored with premultiplied alpha (like every color that is
+    // blended, backends premultiply the vertex color) and the texture origin
+    // at the bottom left
+    const tgp_color color = ctx->color;
+    const tgp_vec2  corners[4] = {
+        {x,     y    },
+        {x + w, y    },
+        {x + w, y + h},
+        {x,     y + h},
+    };
+    const tgp_vec2 texcoords[4] = {
+        {0.0f, 1.0f},
+        {1.0f, 1.0f},
+        {1.0f, 0.0f},
+        {0.0f, 0.0f},
+    };
+    for (int i = 0; i < 4; i++) {
+        vtx_write_ptr[i].position = corners[i];
+        vtx_write_ptr[i].texcoord = texcoords[i];
+        vtx_write_ptr[i].color = color;
+    }
+    static const tgp_index quad_indices[6] = {0, 1, 2, 0, 2, 3};
+    memcpy(idx_write_ptr, quad_indices, sizeof(quad_indices));
+
+    const tgp_region region =
+        tgp_transform_vertices(ctx, vtx_offset, 4, false, false);
+    tgp_command_key* key = NULL;
+    if (region.x1 <= 1.0f && region.y1 <= 1.0f && region.x2 >= -1.0f &&
+        region.y2 >= -1.0f) {
+        key = tgp_next_command(ctx, TGP_COMMAND_DRAW_LAYER);
+    }
+    if (key == NULL) {
+        ctx->cur_vertex -= 4;
+        ctx->cur_index -= 6;
+        return;
+    }
+    tgp_record_hit(ctx, region, vtx_offset, 4, quad_indices, 6, 0);
+#ifdef TINYGP_BOX_SHADOWS
+    tgp_assign_shadow(ctx, vtx_offset, 4);
+#endif
+#ifdef TINYGP_OPAQUE_PASS
+    // layers are composited with the translucent geometry
+    tgp_assign_depth(ctx, vtx_offset, 4);
+#endif
+
+    key->region = region;
+    tgp_set_draw_state(ctx, key);
+    tgp_draw_layer_command* cmd = &tgp_command_data_of(ctx, key)->draw_layer;
+    cmd->draw = TGP_LITERAL(tgp_draw_command){vtx_offset, idx_offset, 4, 6};
+    cmd->id = id;
+    cmd->version = layer->version;
+}
+
+static inline uint64_t tgp_capture_align(uint64_t offset) {
+    const uint64_t mask = TGP_CAPTURE_ALIGN - 1;
+    return (offset + mask) & ~mask;
+}
+
+static tgp_capture_header tgp_make_capture_header(tgp_context* ctx) {
+    tgp_capture_header header;
+    memset(&header, 0, sizeof(header));
+    header.magic = TGP_CAPTURE_MAGIC;
+    header.version = TGP_CAPTURE_VERSION;
+    header.byte_order = 0x01020304u;
+    header.header_size = sizeof(tgp_capture_header);
+    header.command_key_size = sizeof(tgp_command_key);
+    header.command_data_size = sizeof(tgp_command_data);
+#ifdef TINYGP_USERDATA_TYPE
+    header.userdata_size = sizeof(TINYGP_USERDATA_TYPE);
+#endif
+    header.vertex_size = sizeof(tgp_vertex);
+    header.index_size = sizeof(tgp_index);
+    header.screen_w = ctx->screen_size.w;
+    header.screen_h = ctx->screen_size.h;
+    header.num_commands = ctx->cur_command;
+    header.num_vertices = ctx->cur_vertex;
+    header.num_indices = ctx->cur_index;
+    header.num_pipelines = ctx->num_pipelines;
+    header.msaa_samples = ctx->msaa_samples;
+    const uint64_t num_commands = header.num_commands;
+    const uint64_t vertices_size =
+        (uint64_t)header.num_vertices * sizeof(tgp_vertex);
+    const uint64_t indices_size =
+        (uint64_t)header.num_indices * sizeof(tgp_index);
+    header.command_keys_offset = tgp_capture_align(sizeof(tgp_capture_header));
+    header.command_data_offset = tgp_capture_align(
+        header.command_keys_offset + num_commands * sizeof(tgp_command_key));
+    header.userdata_offset = tgp_capture_align(
+        header.command_data_offset + num_commands * sizeof(tgp_command_data));
+    header.vertices_offset = tgp_capture_align(
+        header.userdata_offset + num_commands * header.userdata_size);
+    header.indices_offset =
+        tgp_capture_align(header.vertices_offset + vertices_size);
+    header.pipelines_offset =
+        tgp_capture_align(header.indices_offset + indices_size);
+    header.total_size = tgp_capture_align(
+        header.pipelines_offset +
+        (uint64_t)header.num_pipelines * sizeof(tgp_pipeline));
+    return header;
+}
+
+// returns the size of the capture of the current frame in bytes
+TGPDEF size_t tgp_capture_size(tgp_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL);
+    return (size_t)tgp_make_capture_header(ctx).total_size;
+}
+
+// writes the recorded frame into `buffer`. returns the number of bytes
+// written, or 0 if `size` is less than tgp_capture_size()
+TGPDEF size_t tgp_capture_frame_to_memory(tgp_context* ctx, void* buffer,
+                                          size_t size) {
+    TINYGP_ASSERT(ctx != NULL && buffer != NULL);
+    const tgp_capture_header header = tgp_make_capture_header(ctx);
+    if (size < header.total_size) {
+        return 0;
+    }
+
+    uint8_t* data = (uint8_t*)buffer;
+    memset(data, 0, (size_t)header.total_size);
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + header.command_keys_offset, ctx->commands.keys,
+           header.num_commands * sizeof(tgp_command_key));
+    memcpy(data + header.command_data_offset, ctx->commands.data,
+           header.num_commands * sizeof(tgp_command_data));
+#ifdef TINYGP_USERDATA_TYPE
+    memcpy(data + header.userdata_offset, ctx->commands.userdata,
+           header.num_commands * sizeof(TINYGP_USERDATA_TYPE));
+#endif
+    memcpy(data + header.vertices_offset, ctx->vertices,
+           header.num_vertices * sizeof(tgp_vertex));
+    memcpy(data + header.indices_offset, ctx->indices,
+           header.num_indices * sizeof(tgp_index));
+    memcpy(data + header.pipelines_offset, ctx->pipelines,
+           header.num_pipelines * sizeof(tgp_pipeline));
+    return (size_t)header.total_size;
+}
+
+// true if an array of `count` elements of `size` bytes at `offset` is aligned
+// and lies within the capture, after the header
+static inline bool tgp_capture_array_fits(const tgp_capture_header* header,
+                                          uint64_t offset, uint64_t count,
+                                          uint64_t size) {
+    return offset % TGP_CAPTURE_ALIGN == 0 && offset >= header->header_size &&
+           offset <= header->total_size &&
+           count * size <= header->total_size - offset;
+}
+
+// bools are read as bytes, other values can not be loaded into a bool
+static inline bool tgp_capture_bool_valid(const bool* b) {
+    uint8_t byte;
+    memcpy(&byte, b, 1);
+    return byte <= 1;
+}
+
+// true if a draw only reads vertices and indices that are in the capture
+static bool tgp_capture_draw_fits(const tgp_capture_header* header,
+                                  const tgp_index*          indices,
+                                  const tgp_draw_command*   draw) {
+    if ((uint64_t)draw->vtx_offset + draw->num_vertices >
+            header->num_vertices ||
+        (uint64_t)draw->idx_offset + draw->num_indices > header->num_indices) {
+        return false;
+    }
+    // indices are relative to the first vertex of the draw
+    for (uint32_t i = 0; i < draw->num_indices; i++) {
+        if (indices[draw->idx_offset + i] >= draw->num_vertices) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// checks everything a backend reads from a capture, so that a truncated or
+// corrupt file is rejected instead of being read out of bounds
+static bool tgp_validate_capture(const tgp_capture_header* header,
+                                 const uint8_t*            bytes) {
+    if (header->screen_w <= 0 || header->screen_h <= 0 ||
+        header->num_pipelines == 0 ||
+        header->num_pipelines > TGP_MAX_PIPELINES ||
+        !tgp_capture_array_fits(header, header->command_keys_offset,
+                                header->num_commands,
+                                sizeof(tgp_command_key)) ||
+        !tgp_capture_array_fits(header, header->command_data_offset,
+                                header->num_commands,
+                                sizeof(tgp_command_data)) ||
+        !tgp_capture_array_fits(header, header->userdata_offset,
+                                header->num_commands, header->userdata_size) ||
+        !tgp_capture_array_fits(header, header->vertices_offset,
+                                header->num_vertices, sizeof(tgp_vertex)) ||
+        !tgp_capture_array_fits(header, header->indices_offset,
+                                header->num_indices, sizeof(tgp_index)) ||
+        !tgp_capture_array_fits(header, header->pipelines_offset,
+                                header->num_pipelines, sizeof(tgp_pipeline))) {
+        return false;
+    }
+
+    const tgp_command_key* keys =
+        (const tgp_command_key*)(bytes + header->command_keys_offset);
+    const tgp_command_data* data =
+        (const tgp_command_data*)(bytes + header->command_data_offset);
+    const tgp_index* indices =
+        (const tgp_index*)(bytes + header->indices_offset);
+    const tgp_pipeline* pipelines =
+        (const tgp_pipeline*)(bytes + header->pipelines_offset);
+    for (uint32_t i = 0; i < header->num_pipelines; i++) {
+        if ((uint32_t)pipelines[i].blend > TGP_BLEND_SCREEN ||
+            (uint32_t)pipelines[i].texture_alpha >
+                TGP_TEXTURE_STRAIGHT_ALPHA) {
+            return false;
+        }
+    }
+
+    uint32_t layer_ids[TGP_MAX_LAYERS];
+    uint32_t num_layer_ids = 0;
+    bool     in_layer = false;
+    for (uint32_t i = 0; i < header->num_commands; i++) {
+        const tgp_command_data* d = &data[i];
+        if (keys[i].pipeline >= header->num_pipelines ||
+            !tgp_capture_bool_valid(&keys[i].opaque)) {
+            return false;
+        }
+        switch (keys[i].type) {
+        case TGP_COMMAND_NONE:
+        case TGP_COMMAND_VIEWPORT:
+        case TGP_COMMAND_SCISSOR:
+        case TGP_COMMAND_CLEAR:
+        case TGP_COMMAND_PROJECTION: break;
+        case TGP_COMMAND_BEGIN_LAYER: {
+            // layers do not nest, and every one of them needs a render target
+            if (in_layer || d->layer.w <= 0 || d->layer.h <= 0 ||
+                d->layer.samples > 64) {
+                return false;
+            }
+            uint32_t l = 0;
+            while (l < num_layer_ids && layer_ids[l] != d->layer.id) {
+                l++;
+            }
+            if (l == num_layer_ids) {
+                if (num_layer_ids == TGP_MAX_LAYERS) {
+                    return false;
+                }
+                layer_ids[num_layer_ids++] = d->layer.id;
+            }
+            in_layer = true;
+            break;
+        }
+        case TGP_COMMAND_END_LAYER:
+            if (!in_layer) {
+                return false;
+            }
+            in_layer = false;
+            break;
+        case TGP_COMMAND_DRAW:
+        case TGP_COMMAND_DRAW_LAYER:
+            if (!tgp_capture_draw_fits(header, indices, &d->draw)) {
+                return false;
+            }
+            break;
+        case TGP_COMMAND_DRAW_RECTS: {
+            if (!tgp_capture_bool_valid(&d->draw_rects.antialiased)) {
+                return false;
+            }
+            uint32_t pattern_indices, pattern_vertices;
+            tgp_rect_index_pattern(d->draw_rects.antialiased, &pattern_indices,
+                                   &pattern_vertices);
+            const tgp_draw_command* draw = &d->draw_rects.draw;
+            if ((uint64_t)draw->vtx_offset + draw->num_vertices >
+                    header->num_vertices ||
+                draw->num_vertices % pattern_vertices != 0 ||
+                draw->num_vertices > TGP_MAX_DRAW_VERTICES) {
+                return false;
+            }
+            break;
+        }
+        case TGP_COMMAND_FILL_PATH: {
+            const tgp_draw_command* draw = &d->fill_path.draw;
+            if ((uint64_t)draw->vtx_offset + draw->num_vertices >
+                    header->num_vertices ||
+                draw->num_vertices < 4 ||
+                (uint32_t)d->fill_path.rule > TGP_FILL_EVEN_ODD) {
+                return false;
+            }
+            break;
+        }
+        default: return false;
+        }
+    }
+    return !in_layer;
+}
+
+// sets up a context that renders a capture without copying it. `data` must
+// stay valid (and aligned to TGP_CAPTURE_ALIGN bytes, which mmap() and
+// malloc() guarantee) until the context is destroyed. the context must not
+// be recorded into. the shaders and textures of the pipelines are handles of
+// the recording process, they are replaced by the defaults of the backend
+// until they are mapped with tgp_map_replay_handles(). returns false if the
+// capture is invalid (truncated, or with commands that read outside of it)
+// or was written with an incompatible build (different version, types or
+// byte order)
+TGPDEF bool tgp_init_replay_context(tgp_context* ctx, const void* data,
+                                    size_t size) {
+    TINYGP_ASSERT(ctx != NULL && data != NULL);
+    const uint8_t*     bytes = (const uint8_t*)data;
+    tgp_capture_header header;
+    if (size < sizeof(header) ||
+        ((uintptr_t)bytes & (TGP_CAPTURE_ALIGN - 1)) != 0) {
+        return false;
+    }
+    memcpy(&header, bytes, sizeof(header));
+    if (header.magic != TGP_CAPTURE_MAGIC ||
+        header.version != TGP_CAPTURE_VERSION ||
+        header.byte_order != 0x01020304u ||
+        header.header_size != sizeof(tgp_capture_header) ||
+        header.command_key_size != sizeof(tgp_command_key) ||
+        header.command_data_size != sizeof(tgp_command_data) ||
+#ifdef TINYGP_USERDATA_TYPE
+        header.userdata_size != sizeof(TINYGP_USERDATA_TYPE) ||
+#else
+        header.userdata_size != 0 ||
+#endif
+        header.vertex_size != sizeof(tgp_vertex) ||
+        header.index_size != sizeof(tgp_index) || header.total_size > size ||
+        !tgp_validate_capture(&header, bytes)) {
+        return false;
+    }
+
+    memset(ctx, 0, sizeof(*ctx));
+    ctx->external_buffers = true;
+    ctx->screen_size = TGP_LITERAL(tgp_size){header.screen_w, header.screen_h};
+    ctx->viewport =
+        TGP_LITERAL(tgp_irect){0, 0, header.screen_w, header.screen_h};
+    ctx->scissor = TGP_LITERAL(tgp_irect){0, 0, -1, -1};
+    ctx->commands.keys =
+        (tgp_command_key*)(bytes + header.command_keys_offset);
+    ctx->commands.data =
+        (tgp_command_data*)(bytes + header.command_data_offset);
+#ifdef TINYGP_USERDATA_TYPE
+    ctx->commands.userdata =
+        (TINYGP_USERDATA_TYPE*)(bytes + header.userdata_offset);
+#endif
+    ctx->vertices = (tgp_vertex*)(bytes + header.vertices_offset);
+    ctx->indices = (tgp_index*)(bytes + header.indices_offset);
+    ctx->max_commands = ctx->cur_command = header.num_commands;
+    ctx->max_vertices = ctx->cur_vertex = header.num_vertices;
+    ctx->max_indices = ctx->cur_index = header.num_indices;
+    // the pipelines are small, they are copied so that frames can be
+    // replayed with the same indices and other handles
+    ctx->recorded_pipelines =
+        (const tgp_pipeline*)(bytes + header.pipelines_offset);
+    ctx->num_pipelines = header.num_pipelines;
+    tgp_map_replay_handles(ctx, NULL, 0, NULL, 0);
+    ctx->msaa_samples = header.msaa_samples;
+    ctx->transform = tgp_default_transform;
+    return true;
+}
+
+static uint32_t tgp_map_handle(const tgp_handle_map* map, uint32_t count,
+                               uint32_t handle) {
+    for (uint32_t i = 0; i < count && handle != 0; i++) {
+        if (map[i].recorded == handle) {
+            return map[i].replayed;
+        }
+    }
+    return 0;
+}
+
+// replaces the shaders and textures of the pipelines of a replayed capture
+// (as they were recorded) with ones of this process, for example the
+// textures the recording process had loaded from the same files. handles
+// that are not in the tables become 0, the defaults of the backend. the GL
+// backend caches the applied pipeline, see tgpgl_invalidate_state()
+TGPDEF void tgp_map_replay_handles(tgp_context*          ctx,
+                                   const tgp_handle_map* shaders,
+                                   uint32_t              num_shaders,
+                                   const tgp_handle_map* textures,
+                                   uint32_t              num_textures) {
+    TINYGP_ASSERT(ctx != NULL && ctx->recorded_pipelines != NULL);
+    TINYGP_ASSERT((shaders != NULL || num_shaders == 0) &&
+                  (textures != NULL || num_textures == 0));
+    for (uint32_t i = 0; i < ctx->num_pipelines; i++) {
+        const tgp_pipeline* from = &ctx->recorded_pipelines[i];
+        tgp_pipeline*       to = &ctx->pipelines[i];
+        *to = *from;
+        to->shader = tgp_map_handle(shaders, num_shaders, from->shader);
+        for (uint32_t t = 0; t < TGP_PIPELINE_TEXTURES; t++) {
+            to->textures[t] =
+                tgp_map_handle(textures, num_textures, from->textures[t]);
+        }
+    }
+}
+
+#ifndef TINYGP_NO_STDIO
+// writes the recorded frame into a file, see tgp_capture_header
+TGPDEF bool tgp_capture_frame(tgp_context* ctx, const char* path) {
+    TINYGP_ASSERT(ctx != NULL && path != NULL);
+    const size_t size = tgp_capture_size(ctx);
+    void*        buffer = malloc(size);
+    if (buffer == NULL) {
+        return false;
+    }
+    tgp_capture_frame_to_memory(ctx, buffer, size);
+
+    FILE* f = fopen(path, "wb");
+    bool  ok = f != NULL && fwrite(buffer, 1, size, f) == size;
+    if (f != NULL && fclose(f) != 0) {
+        ok = false;
+    }
+    free(buffer);
+    return ok;
 }
+#endif // TINYGP_NO_STDIO
 
 #ifdef __cplusplus
 } // extern "C"
@@ -0,0 +1,571 @@
+// SEE LICENSING INFORMATION AT THE END OF tinygp.h
+// tinygp.hpp (C++ wrapper for tinygp.h)
+//
+// USAGE
+//   1. Include tinygp.hpp instead of tinygp.h. the C API stays available, the
+//   wrapper only adds the tgp namespace.
+//
+//   2. Create a context. the options that the drawing loops would branch on
+//   are template parameters, so every instantiation gets its own inlined code
+//   for them:
+//
+//     tgp::context<> ctx;                            // antialiased
+//     tgp::context<tgp::aliased, glm::vec2> plot;    // no antialiasing,
+//                                                    // glm::vec2 points
+//
+//   the context is destroyed when it goes out of scope. it can be moved, but
+//   not copied. ctx.get() returns the tgp_context* for the C API and the
+//   backends:
+//
+//     tgpgl_init_context(&tgpgl_ctx, ctx.get());
+//
+//   3. With TINYGP_USERDATA_TYPE, draws are merged if the third template
+//   parameter says their userdata is equal (operator== by default):
+//
+//     struct same_texture {
+//         bool operator()(const my_userdata& a, const my_userdata& b) const {
+//             return a.texture == b.texture;
+//         }
+//     };
+//     tgp::context<tgp::antialiased, tgp_vec2, same_texture> ctx;
+//
+//   the comparison is inlined into the loop that collects which of the last
+//   draws have the same userdata, merging them is left to the C code.
+//
+// the wrapper needs C++11. tinygp.h compiles as standard C++ as well (no
+// compound literals, designated initializers or variable length arrays), so
+// any C++11 compiler works, including MSVC
+
+#ifndef TINYGP_HPP_INCLUDED
+#define TINYGP_HPP_INCLUDED
+
+#include "tinygp.h"
+#include <stdlib.h>
+#include <utility>
+
+#ifndef TGP_FIXNORMAL2F_MAX_INVLEN2
+#define TGP_FIXNORMAL2F_MAX_INVLEN2 100.0f
+#endif
+
+namespace tgp {
+
+const bool antialiased = true;
+const bool aliased = false;
+
+// reads the coordinates of a point type, specialize it for points without
+// public `x` and `y` members
+template <class Point> struct point_traits {
+    static float x(const Point& p) { return (float)p.x; }
+    static float y(const Point& p) { return (float)p.y; }
+};
+
+template <> struct point_traits<tgp_vec2> {
+    static float x(const tgp_vec2& p) { return p.x; }
+    static float y(const tgp_vec2& p) { return p.y; }
+};
+
+// the default userdata comparison
+struct userdata_equal {
+    template <class T> bool operator()(const T& a, const T& b) const {
+        return a == b;
+    }
+};
+
+namespace detail {
+
+inline float rsqrt(float x) {
+#ifdef TINYGP_ENABLE_SSE
+    return _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+#else
+    return 1.0f / sqrtf(x);
+#endif
+}
+
+inline tgp_vec2 mul(const tgp_mat2x3& m, float x, float y) {
+    tgp_vec2 v;
+    v.x = m.v[0][0] * x + m.v[0][1] * y + m.v[0][2];
+    v.y = m.v[1][0] * x + m.v[1][1] * y + m.v[1][2];
+    return v;
+}
+
+// positions are either transformed by the matrix of the context, or written
+// as they are when it would not change them (see tgp_cpu_matrix())
+struct matrix_transform {
+    explicit matrix_transform(const tgp_mat2x3& matrix) : m(matrix) {}
+    tgp_vec2 operator()(float x, float y) const { return mul(m, x, y); }
+    const tgp_mat2x3& m;
+};
+
+struct identity_transform {
+    tgp_vec2 operator()(float x, float y) const {
+        tgp_vec2 v;
+        v.x = x;
+        v.y = y;
+        return v;
+    }
+};
+
+inline void region_add(tgp_region& region, tgp_vec2 pos) {
+    region.x1 = TGP_MIN(region.x1, pos.x);
+    region.y1 = TGP_MIN(region.y1, pos.y);
+    region.x2 = TGP_MAX(region.x2, pos.x);
+    region.y2 = TGP_MAX(region.y2, pos.y);
+}
+
+inline void write_vertex(tgp_vertex& vtx, tgp_vec2 pos,
+                         const tgp_color& color) {
+    vtx.position = pos;
+    vtx.texcoord.x = 0.0f;
+    vtx.texcoord.y = 0.0f;
+    vtx.color = color;
+}
+
+// outward normal of the edge from `a` to `b`
+inline tgp_vec2 edge_normal(tgp_vec2 a, tgp_vec2 b) {
+    float       dx = b.x - a.x;
+    float       dy = b.y - a.y;
+    const float d2 = dx * dx + dy * dy;
+    if (d2 > 0.0f) {
+        const float inv_len = rsqrt(d2);
+        dx *= inv_len;
+        dy *= inv_len;
+    }
+    tgp_vec2 n;
+    n.x = dy;
+    n.y = -dx;
+    return n;
+}
+
+// half of the fringe offset at a corner between two edge normals
+inline tgp_vec2 corner_offset(tgp_vec2 n0, tgp_vec2 n1, float half_fringe) {
+    float       x = (n0.x + n1.x) * 0.5f;
+    float       y = (n0.y + n1.y) * 0.5f;
+    const float d2 = x * x + y * y;
+    if (d2 > 0.000001f) {
+        const float inv_len2 = TGP_MIN(1.0f / d2, TGP_FIXNORMAL2F_MAX_INVLEN2);
+        x *= inv_len2;
+        y *= inv_len2;
+    }
+    tgp_vec2 d;
+    d.x = x * half_fringe;
+    d.y = y * half_fringe;
+    return d;
+}
+
+// tessellation of a convex polygon, the same as the C implementation but
+// without checking the antialiasing mode per polygon
+template <bool Antialiased, class Point> struct convex_polygon;
+
+template <class Point> struct convex_polygon<true, Point> {
+    typedef point_traits<Point> traits;
+
+    static void size(uint32_t num_points, uint32_t& num_vertices,
+                     uint32_t& num_indices) {
+        num_vertices = num_points * 2;
+        num_indices = (num_points - 2) * 3 + num_points * 6;
+    }
+
+    static tgp_vec2 load(const Point* points, uint32_t i) {
+        tgp_vec2 p;
+        p.x = traits::x(points[i]);
+        p.y = traits::y(points[i]);
+        return p;
+    }
+
+    // every even vertex is on the inside of the fringe, every odd one on the
+    // outside
+    template <class Transform>
+    static void write(const Point* points, uint32_t num_points,
+                      float fringe_scale, const tgp_color& color,
+                      const Transform& m, uint32_t base, tgp_vertex* vtx,
+                      tgp_index* idx, tgp_region& region) {
+        for (uint32_t i = 2; i < num_points; i++) {
+            idx[0] = (tgp_index)base;
+            idx[1] = (tgp_index)(base + ((i - 1) << 1));
+            idx[2] = (tgp_index)(base + (i << 1));
+            idx += 3;
+        }
+
+        tgp_color color_trans = color;
+        color_trans.a = 0.0f;
+        const float    half_fringe = fringe_scale * 0.5f;
+        const tgp_vec2 last = load(points, num_points - 1);
+        const tgp_vec2 first = load(points, 0);
+        const tgp_vec2 first_normal = edge_normal(last, first);
+        tgp_vec2       n0 = first_normal;
+        tgp_vec2       p1 = first;
+        for (uint32_t i0 = num_points - 1, i1 = 0; i1 < num_points; i0 = i1++) {
+            // the normals of the edges before and after the point
+            const bool     closing = i1 + 1 == num_points;
+            const tgp_vec2 p2 = closing ? first : load(points, i1 + 1);
+            const tgp_vec2 n1 = closing ? first_normal : edge_normal(p1, p2);
+            const tgp_vec2 dm = corner_offset(n0, n1, half_fringe);
+
+            const tgp_vec2 inner = m(p1.x - dm.x, p1.y - dm.y);
+            const tgp_vec2 outer = m(p1.x + dm.x, p1.y + dm.y);
+            write_vertex(vtx[0], inner, color);
+            write_vertex(vtx[1], outer, color_trans);
+            region_add(region, inner);
+            region_add(region, outer);
+            vtx += 2;
+
+            const uint32_t in0 = base + (i0 << 1), in1 = base + (i1 << 1);
+            idx[0] = (tgp_index)in1;
+            idx[1] = (tgp_index)in0;
+            idx[2] = (tgp_index)(in0 + 1);
+            idx[3] = (tgp_index)(in0 + 1);
+            idx[4] = (tgp_index)(in1 + 1);
+            idx[5] = (tgp_index)in1;
+            idx += 6;
+
+            n0 = n1;
+            p1 = p2;
+        }
+    }
+};
+
+template <class Point> struct convex_polygon<false, Point> {
+    typedef point_traits<Point> traits;
+
+    static void size(uint32_t num_points, uint32_t& num_vertices,
+                     uint32_t& num_indices) {
+        num_vertices = num_points;
+        num_indices = (num_points - 2) * 3;
+    }
+
+    template <class Transform>
+    static void write(const Point* points, uint32_t num_points,
+                      float fringe_scale, const tgp_color& color,
+                      const Transform& m, uint32_t base, tgp_vertex* vtx,
+                      tgp_index* idx, tgp_region& region) {
+        (void)fringe_scale;
+        for (uint32_t i = 0; i < num_points; i++) {
+            const tgp_vec2 pos = m(traits::x(points[i]), traits::y(points[i]));
+            write_vertex(vtx[i], pos, color);
+            region_add(region, pos);
+        }
+        for (uint32_t i = 2; i < num_points; i++) {
+            idx[0] = (tgp_index)base;
+            idx[1] = (tgp_index)(base + i - 1);
+            idx[2] = (tgp_index)(base + i);
+            idx += 3;
+        }
+    }
+};
+
+inline tgp_region empty_region() {
+    tgp_region region = {FLT_MAX, FLT_MAX, -FLT_MAX, -FLT_MAX};
+    return region;
+}
+
+} // namespace detail
+
+// owns a tgp_context. `Antialiased` replaces tgp_options.antialiasing,
+// `Point` is the type of the points that are passed to the draw functions
+// (see point_traits) and `UserdataEqual` decides which draws can be merged
+// when TINYGP_USERDATA_TYPE is defined
+template <bool Antialiased = antialiased, class Point = tgp_vec2,
+          class UserdataEqual = userdata_equal>
+class context {
+  public:
+    typedef Point point_type;
+
+    explicit context(tgp_options opts = tgp_default_options())
+        : ctx_((tgp_context*)malloc(sizeof(tgp_context))) {
+        TINYGP_ASSERT(ctx_ != NULL);
+        opts.antialiasing = Antialiased;
+        tgp_init_context(ctx_, &opts);
+    }
+
+    ~context() {
+        // this frees the context too
+        tgp_destroy_context(ctx_);
+    }
+
+    context(context&& other) : ctx_(other.ctx_) { other.ctx_ = NULL; }
+
+    context& operator=(context&& other) {
+        std::swap(ctx_, other.ctx_);
+        return *this;
+    }
+
+    tgp_context*       get() { return ctx_; }
+    const tgp_context* get() const { return ctx_; }
+    operator tgp_context*() { return ctx_; }
+
+    void begin(int width, int height) { tgp_begin(ctx_, width, height); }
+    void end() { tgp_end(ctx_); }
+    void set_flush_backend(const tgp_backend* backend) {
+        tgp_set_flush_backend(ctx_, backend);
+    }
+    bool flush() { return tgp_flush(ctx_); }
+
+    void set_color(float r, float g, float b, float a = 1.0f) {
+        tgp_set_color(ctx_, r, g, b, a);
+    }
+    void set_color(const tgp_color& color) { ctx_->color = color; }
+    void reset_color() { tgp_reset_color(ctx_); }
+    void clear() { tgp_clear(ctx_); }
+
+    uint32_t intern_pipeline(const tgp_pipeline& pipeline) {
+        return tgp_intern_pipeline(ctx_, &pipeline);
+    }
+    void set_pipeline(uint32_t pipeline) { tgp_set_pipeline(ctx_, pipeline); }
+
+    void push_transform() { tgp_push_transform(ctx_); }
+    void pop_transform() { tgp_pop_transform(ctx_); }
+    void reset_transform() { tgp_reset_transform(ctx_); }
+    void translate(float x, float y) { tgp_translate(ctx_, x, y); }
+    void scale(float sx, float sy) { tgp_scale(ctx_, sx, sy); }
+    void rotate(float theta) { tgp_rotate(ctx_, theta); }
+
+    void viewport(int x, int y, int w, int h) {
+        tgp_viewport(ctx_, x, y, w, h);
+    }
+    void scissor(int x, int y, int w, int h) { tgp_scissor(ctx_, x, y, w, h); }
+    void reset_scissor() { tgp_reset_scissor(ctx_); }
+
+#ifdef TINYGP_USERDATA_TYPE
+    void set_userdata(const TINYGP_USERDATA_TYPE& userdata) {
+        ctx_->current_userdata = userdata;
+    }
+#endif
+
+    // same as tgp_draw_convex_polygon(), clockwise points
+    void draw_convex_polygon(const Point* points, uint32_t num_points) {
+        const tgp_mat2x3* m = tgp_cpu_matrix(ctx_);
+        if (m == NULL) {
+            draw_polygon_with(points, num_points, detail::identity_transform());
+        } else {
+            draw_polygon_with(points, num_points,
+                              detail::matrix_transform(*m));
+        }
+    }
+
+    // same as tgp_draw_convex_polygons(), polygon `i` is made of the points
+    // `points[offsets[i]]` to `points[offsets[i + 1] - 1]`
+    void draw_convex_polygons(const Point* points, const uint32_t* offsets,
+                              const tgp_color* colors, uint32_t num_polygons) {
+        const tgp_mat2x3* m = tgp_cpu_matrix(ctx_);
+        if (m == NULL) {
+            draw_polygons_with(points, offsets, colors, num_polygons,
+                               detail::identity_transform());
+        } else {
+            draw_polygons_with(points, offsets, colors, num_polygons,
+                               detail::matrix_transform(*m));
+        }
+    }
+
+    // same as tgp_draw_vertices(), every 3 points are a triangle
+    void draw_triangles(const Point* points, uint32_t num_points) {
+        if (num_points == 0 || ctx_->color.a <= 0.0f) {
+            return;
+        }
+        tgp_vertex* vtx;
+        tgp_index*  idx;
+        if (!tgp_reserve_draw(ctx_, num_points, num_points, &vtx, &idx)) {
+            return;
+        }
+        const tgp_mat2x3* m = tgp_cpu_matrix(ctx_);
+        tgp_region        region = detail::empty_region();
+        for (uint32_t i = 0; i < num_points; i++) {
+            tgp_vec2 pos;
+            pos.x = traits::x(points[i]);
+            pos.y = traits::y(points[i]);
+            if (m != NULL) {
+                pos = detail::mul(*m, pos.x, pos.y);
+            }
+            detail::write_vertex(vtx[i], pos, ctx_->color);
+            detail::region_add(region, pos);
+            idx[i] = (tgp_index)i;
+        }
+        tgp_submit_draw(ctx_, region, num_points, num_points, userdata_mask());
+    }
+
+    void draw_rect(tgp_rect rect) { tgp_draw_rects(ctx_, &rect, NULL, 1); }
+    void draw_rects(const tgp_rect* rects, const tgp_color* colors,
+                    uint32_t num_rects) {
+        tgp_draw_rects(ctx_, rects, colors, num_rects);
+    }
+    bool use_shared(tgp_shared* shared) { return tgp_use_shared(ctx_, shared); }
+    bool draw_shared(uint64_t key) { return tgp_draw_shared(ctx_, key); }
+#ifdef TINYGP_BOX_SHADOWS
+    void draw_box_shadow(tgp_rect rect, float radius, float blur,
+                         float spread = 0.0f, tgp_vec2 offset = tgp_vec2()) {
+        tgp_draw_box_shadow(ctx_, rect, radius, blur, spread, offset);
+    }
+#endif
+
+    void path_clear() { tgp_path_clear(ctx_); }
+    void path_to(const Point& point) {
+        tgp_vec2 p;
+        p.x = traits::x(point);
+        p.y = traits::y(point);
+        tgp_path_to(ctx_, p);
+    }
+    void fill_path(tgp_fill_rule rule = TGP_FILL_NONZERO) {
+        tgp_fill_path(ctx_, rule);
+    }
+
+  private:
+    typedef detail::convex_polygon<Antialiased, Point> polygon;
+    typedef detail::convex_polygon<false, Point>       aliased_polygon;
+    typedef point_traits<Point>                        traits;
+
+    context(const context&);
+    context& operator=(const context&);
+
+    // the core stops emitting fringes when the target is multisampled
+    bool msaa() const { return Antialiased && !ctx_->antialiasing; }
+
+    template <class Polygon>
+    bool visible(const uint32_t* offsets, const tgp_color* colors, uint32_t i,
+                 uint32_t& num_vertices, uint32_t& num_indices) const {
+        const uint32_t num_points = offsets[i + 1] - offsets[i];
+        if (num_points < 3 || (colors != NULL && colors[i].a <= 0.0f)) {
+            return false;
+        }
+        Polygon::size(num_points, num_vertices, num_indices);
+        return true;
+    }
+
+    template <class Transform>
+    void draw_polygon_with(const Point* points, uint32_t num_points,
+                           const Transform& m) {
+        if (msaa()) {
+            draw_polygon<aliased_polygon>(points, num_points, m);
+        } else {
+            draw_polygon<polygon>(points, num_points, m);
+        }
+    }
+
+    template <class Transform>
+    void draw_polygons_with(const Point* points, const uint32_t* offsets,
+                            const tgp_color* colors, uint32_t num_polygons,
+                            const Transform& m) {
+        if (msaa()) {
+            draw_polygons<aliased_polygon>(points, offsets, colors,
+                                           num_polygons, m);
+        } else {
+            draw_polygons<polygon>(points, offsets, colors, num_polygons, m);
+        }
+    }
+
+    template <class Polygon, class Transform>
+    void draw_polygon(const Point* points, uint32_t num_points,
+                      const Transform& m) {
+        if (num_points < 3 || ctx_->color.a <= 0.0f) {
+            return;
+        }
+        uint32_t num_vertices, num_indices;
+        Polygon::size(num_points, num_vertices, num_indices);
+        tgp_vertex* vtx;
+        tgp_index*  idx;
+        if (!tgp_reserve_draw(ctx_, num_vertices, num_indices, &vtx, &idx)) {
+            return;
+        }
+        tgp_region region = detail::empty_region();
+        Polygon::write(points, num_points, ctx_->fringe_scale, ctx_->color, m,
+                       0, vtx, idx, region);
+        tgp_submit_shape(ctx_, region, num_vertices, num_indices,
+                         userdata_mask());
+    }
+
+    template <class Polygon, class Transform>
+    void draw_polygons(const Point* points, const uint32_t* offsets,
+                       const tgp_color* colors, uint32_t num_polygons,
+                       const Transform& m) {
+        if (colors == NULL && ctx_->color.a <= 0.0f) {
+            return;
+        }
+        const uint32_t mask = userdata_mask();
+
+        uint32_t i = 0;
+        while (i < num_polygons) {
+            // count how many polygons fit into a single command
+            const uint32_t vtx_room =
+                TGP_MIN(ctx_->max_vertices - ctx_->cur_vertex,
+                        TGP_MAX_DRAW_VERTICES);
+            const uint32_t idx_room = ctx_->max_indices - ctx_->cur_index;
+            uint32_t       num_vertices = 0, num_indices = 0;
+            uint32_t       end = i;
+            for (; end < num_polygons; end++) {
+                uint32_t nv, ni;
+                if (!visible<Polygon>(offsets, colors, end, nv, ni)) {
+                    continue;
+                }
+                if (num_vertices + nv > vtx_room ||
+                    num_indices + ni > idx_room) {
+                    break;
+                }
+                num_vertices += nv;
+                num_indices += ni;
+            }
+            tgp_vertex* vtx;
+            tgp_index*  idx;
+            if (end == i) {
+                // not even a single polygon fits, unless the buffers are
+                // flushed
+                if (tgp_flush(ctx_)) {
+                    continue;
+                }
+                ctx_->num_dropped++;
+                return;
+            }
+            if (!tgp_reserve_draw(ctx_, num_vertices, num_indices, &vtx,
+                                  &idx)) {
+                return;
+            }
+
+            tgp_region region = detail::empty_region();
+            uint32_t   base = 0;
+            for (; i < end; i++) {
+                uint32_t nv, ni;
+                if (!visible<Polygon>(offsets, colors, i, nv, ni)) {
+                    continue;
+                }
+                Polygon::write(&points[offsets[i]], offsets[i + 1] - offsets[i],
+                               ctx_->fringe_scale,
+                               colors != NULL ? colors[i] : ctx_->color, m,
+                               base, vtx, idx, region);
+                vtx += nv;
+                idx += ni;
+                base += nv;
+            }
+            if (num_vertices > 0) {
+                tgp_submit_draw(ctx_, region, num_vertices, num_indices, mask);
+            }
+        }
+    }
+
+    // compares the current userdata with the draw commands that the next
+    // draw could be merged with, in the order tgp_submit_draw() expects
+    uint32_t userdata_mask() const {
+#if defined(TINYGP_USERDATA_TYPE) && TGP_BATCH_OPTIMIZER_DEPTH > 0
+        const UserdataEqual equal = UserdataEqual();
+        uint32_t            mask = 0, bit = 0;
+        for (uint32_t i = ctx_->cur_command; i > 0 && bit < 32; i--) {
+            const uint8_t type = ctx_->commands.keys[i - 1].type;
+            if (type == TGP_COMMAND_NONE) {
+                continue;
+            }
+            if (type != TGP_COMMAND_DRAW || bit == TGP_BATCH_OPTIMIZER_DEPTH) {
+                break;
+            }
+            if (equal(ctx_->commands.userdata[i - 1], ctx_->current_userdata)) {
+                mask |= 1u << bit;
+            }
+            bit++;
+        }
+        return mask;
+#else
+        return TGP_MERGE_ANY;
+#endif
+    }
+
+    tgp_context* ctx_;
+};
+
+} // namespace tgp
+
+#endif // TINYGP_HPP_INCLUDED
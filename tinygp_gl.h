@@ -2,7 +2,13 @@
 #define TINYGP_GL_H_INCLUDED
 
 #include "tinygp.h"
+// define TGPGL_USE_GLES3 to use GLES3, or TGPGL_NO_GL_INCLUDE to include the
+// GL headers (or loader) yourself, e.g. for desktop GL
+#if defined(TGPGL_USE_GLES3)
+#include <GLES3/gl3.h>
+#elif !defined(TGPGL_NO_GL_INCLUDE)
 #include <GLES2/gl2.h>
+#endif
 #include <stdbool.h>
 #include <stdio.h>
 
@@ -19,8 +25,201 @@
 #define TGPGL_GLES2
 #endif
 
+#if defined(TGPGL_GLES3) || defined(GL_VERSION_3_0)
+#define TGPGL_HAS_VAO
+// render targets keep the depth and the stencil in a single renderbuffer
+#define TGPGL_HAS_DEPTH_STENCIL
+// multisampled renderbuffers that are resolved with glBlitFramebuffer(), see
+// tgp_options.msaa_samples. with GLES2 the screen is rendered as it is (ask
+// for a multisampled window instead) and layers have no MSAA
+#define TGPGL_HAS_MSAA
+#endif
+
+// from OES_packed_depth_stencil, which GLES2 headers may not define
+#define TGPGL_DEPTH24_STENCIL8_OES 0x88F0
+
+// pixel buffers and fences for tgpgl_readback()
+#if defined(TGPGL_GLES3) || defined(GL_VERSION_3_2)
+#define TGPGL_HAS_ASYNC_READBACK
+#endif
+
+// number of frames tgpgl_readback() can have in flight
+#ifndef TGPGL_READBACK_SLOTS
+#define TGPGL_READBACK_SLOTS 3
+#endif
+
+// default size of the tiles rendered by tgpgl_export()
+#ifndef TGPGL_EXPORT_TILE_SIZE
+#define TGPGL_EXPORT_TILE_SIZE 1024
+#endif
+
 #define TGPGL_GLSL_VERSION_STR_SIZE 32
 
+// maximum number of shaders, including the built-in one. see
+// tgpgl_create_shader()
+#ifndef TGPGL_MAX_SHADERS
+#define TGPGL_MAX_SHADERS 16
+#endif
+
+// with TINYGP_OPAQUE_PASS the vertices have a depth, otherwise everything is
+// drawn at the same depth without depth testing
+#ifdef TINYGP_OPAQUE_PASS
+#define TGPGL_DEPTH_ATTRIBUTE(qualifier) qualifier " float depth;\n"
+#define TGPGL_DEPTH                      "depth"
+#else
+#define TGPGL_DEPTH_ATTRIBUTE(qualifier) ""
+#define TGPGL_DEPTH                      "0.0"
+#endif
+
+// with TINYGP_BOX_SHADOWS the vertices have the parameters of a box shadow,
+// the built-in fragment shader evaluates it the same way as
+// tgp_box_shadow_alpha() instead of sampling the texture
+#ifdef TINYGP_BOX_SHADOWS
+#define TGPGL_SHADOW_ATTRIBUTE(qualifier) qualifier " vec4 shadow;\n"
+#define TGPGL_SHADOW_VARYING(qualifier)   qualifier " vec4 fragShadow;\n"
+#define TGPGL_SHADOW_COPY                 "    fragShadow = shadow;\n"
+#define TGPGL_SHADOW_FUNCTIONS                                                 \
+    "vec2 tgpgl_erf(vec2 x) {\n"                                               \
+    "    vec2 a = abs(x);\n"                                                   \
+    "    vec2 p = (0.230389 + 0.078108 * a * a) * a;\n"                        \
+    "    p = 1.0 + (0.278393 + p) * a;\n"                                      \
+    "    p *= p;\n"                                                            \
+    "    return sign(x) * (1.0 - 1.0 / (p * p));\n"                            \
+    "}\n"                                                                      \
+    "float tgpgl_box_shadow(vec2 point, vec4 box) {\n"                         \
+    "    float low = point.y - box.y, high = point.y + box.y;\n"               \
+    "    float start = clamp(-3.0 * box.w, low, high);\n"                      \
+    "    float dy = (clamp(3.0 * box.w, low, high) - start) * 0.25;\n"         \
+    "    float y = start + dy * 0.5;\n"                                        \
+    "    float alpha = 0.0;\n"                                                 \
+    "    for (int i = 0; i < 4; i++) {\n"                                      \
+    "        float d = min(box.y - box.z - abs(point.y - y), 0.0);\n"          \
+    "        float c = box.x - box.z;\n"                                       \
+    "        c += sqrt(max(box.z * box.z - d * d, 0.0));\n"                    \
+    "        vec2 e = (point.x + vec2(c, -c)) * (0.70710678 / box.w);\n"       \
+    "        e = tgpgl_erf(e);\n"                                              \
+    "        float g = exp(-y * y / (2.0 * box.w * box.w));\n"                 \
+    "        alpha += 0.5 * (e.x - e.y) * g;\n"                                \
+    "        y += dy;\n"                                                       \
+    "    }\n"                                                                  \
+    "    return alpha * dy / (2.5066283 * box.w);\n"                           \
+    "}\n"
+#define TGPGL_SHADOW_TEXEL(texel)                                              \
+    "(fragShadow.w > 0.0 ? vec4(tgpgl_box_shadow(fragUV, fragShadow)) : "      \
+    texel ")"
+#else
+#define TGPGL_SHADOW_ATTRIBUTE(qualifier) ""
+#define TGPGL_SHADOW_VARYING(qualifier)   ""
+#define TGPGL_SHADOW_COPY                 ""
+#define TGPGL_SHADOW_FUNCTIONS            ""
+#define TGPGL_SHADOW_TEXEL(texel)         texel
+#endif
+
+// capabilities tracked by the state cache
+enum {
+    TGPGL_CAP_BLEND = 1 << 0,
+    TGPGL_CAP_CULL_FACE = 1 << 1,
+    TGPGL_CAP_DEPTH_TEST = 1 << 2,
+    TGPGL_CAP_STENCIL_TEST = 1 << 3,
+    TGPGL_CAP_SCISSOR_TEST = 1 << 4,
+};
+
+// shadow copy of the GL state set by the backend, used to skip redundant GL
+// calls. call tgpgl_invalidate_state() if the application changes GL state
+// between tgpgl_render() calls (this includes binding another framebuffer to
+// render the screen into), or between the parts of a flushed frame (see
+// tgp_flush())
+typedef struct {
+    bool      valid;
+    GLuint    program;
+    GLuint    array_buffer, element_buffer;
+    GLuint    textures[TGP_PIPELINE_TEXTURES];
+    uint32_t  active_texture; // texture unit
+    uint32_t  shader;         // index into tgpgl_context.shaders
+    uint32_t  pipeline;       // index of the applied tgp_pipeline
+    uint32_t  caps;
+    GLenum    blend_src_rgb, blend_dst_rgb, blend_src_alpha, blend_dst_alpha;
+    tgp_irect viewport;
+    tgp_irect scissor;
+    tgp_color clear_color;
+    float     projection[4]; // of the frame, shaders get it when used
+    bool      depth_write;
+    bool      attribs_enabled;
+    uint32_t  vertex_base; // first vertex the attributes point at
+} tgpgl_state;
+
+// per-frame statistics, reset by tgpgl_render()
+typedef struct {
+    uint32_t draw_calls;
+    uint32_t state_calls;   // state changing GL calls that were issued
+    uint32_t skipped_calls; // redundant GL calls that were skipped
+} tgpgl_stats;
+
+// a program for tgp_pipeline.shader, see tgpgl_create_shader()
+typedef struct {
+    GLuint program;
+    GLint  proj_location;
+    float  projection[4]; // value of the `proj` uniform
+    bool   projection_set;
+    GLint  straight_location;
+    float  straight; // value of the `straight` uniform, -1 before it is set
+} tgpgl_shader;
+
+// offscreen render target of a layer, see tgp_begin_layer()
+typedef struct {
+    uint32_t id;
+    int      w, h;
+    GLuint   fbo, texture;
+    // renderbuffer with the stencil for tgp_fill_path(), and the depth for
+    // TINYGP_OPAQUE_PASS
+    GLuint depth_stencil;
+    // with MSAA the target is rendered into a multisampled framebuffer that
+    // is resolved into `fbo`. `samples` is 0 without
+    uint32_t samples;
+    GLuint   msaa_fbo, msaa_color, msaa_depth_stencil;
+} tgpgl_layer;
+
+// a frame returned by tgpgl_readback()
+typedef struct {
+    int      w, h;
+    uint64_t sequence; // counts tgpgl_readback() calls, starting at 0
+} tgpgl_readback_info;
+
+typedef struct {
+#ifdef TGPGL_HAS_ASYNC_READBACK
+    GLuint pbo;
+    GLsync fence;
+#endif
+    int      w, h;
+    uint64_t sequence;
+} tgpgl_readback_slot;
+
+// while tgpgl_export() renders a tile, the viewport, scissor and projection of
+// the frame are mapped to the tile (see tgpgl_export_apply())
+typedef struct {
+    bool      enabled; // tgpgl_export() is running
+    bool      active;  // enabled and not rendering a layer
+    double    scale[2]; // image pixels per frame pixel
+    tgp_irect tile;     // in the image, bottom row first like GL
+    tgp_irect viewport, scissor;
+    float     projection[4];
+} tgpgl_export_state;
+
+// receives `num_rows` rows of the image exported by tgpgl_export(), top row
+// first, starting at row `y`. each row is RGBA and `stride` bytes apart.
+// returning false stops the export
+typedef bool (*tgpgl_export_sink)(void* user, int y, int num_rows,
+                                  const uint8_t* rows, size_t stride);
+
+// where the next range of commands continues from, see tgpgl_backend()
+typedef struct {
+    tgp_irect viewport;
+    tgp_irect scissor; // not clipped to the damage
+    float     projection[4];
+    GLuint    fbo; // the layer or the default framebuffer
+    bool      in_layer;
+} tgpgl_exec_state;
+
 typedef struct {
     tgp_context* tgpctx;
     GLuint       gl_version;
@@ -29,15 +228,69 @@ typedef struct {
     GLuint       shader_handle;
 
     GLint  attrib_location_tex;
+    GLint  attrib_location_proj;
     GLint  attrib_location_vtx_pos;
     GLint  attrib_location_vtx_uv;
     GLint  attrib_location_vtx_color;
+    GLint  attrib_location_vtx_depth;
+    GLint  attrib_location_vtx_shadow;
     GLuint white_texture;
+    GLuint vao;
+
+    // shaders[0] is the built-in shader
+    tgpgl_shader shaders[TGPGL_MAX_SHADERS];
+    uint32_t     num_shaders;
+
+    // static index buffers for TGP_COMMAND_DRAW_RECTS, [0] without
+    // antialiasing and [1] with antialiasing
+    GLuint   rect_elements[2];
+    uint32_t rect_elements_capacity[2]; // in rects
+
+    tgpgl_layer layers[TGP_MAX_LAYERS];
+    uint32_t    num_layers;
+    GLint       default_fbo;
+    // the framebuffer the screen is rendered into: default_fbo, or the
+    // multisampled framebuffer of `screen` that is resolved into it at the
+    // end of the frame
+    GLuint      screen_fbo;
+    tgpgl_layer screen;
+    bool        screen_reallocated; // its contents are undefined
+    // the default_fbo whose format `screen` was allocated for. if no
+    // multisampled format matches it, `screen` is resolved into its own RGBA8
+    // `fbo` first, which is then copied into default_fbo
+    GLint       screen_resolve_fbo;
+    GLint       max_samples; // GL_MAX_SAMPLES, looked up once
+
+    // ring of pending readbacks, see tgpgl_readback()
+    tgpgl_readback_slot readback[TGPGL_READBACK_SLOTS];
+    uint32_t            readback_head, readback_count;
+    uint64_t            readback_sequence;
+
+    tgpgl_export_state export_state;
+
+    // state between the ranges of commands of a frame, and the context
+    // that is restored after rendering a frame of another one
+    tgpgl_exec_state exec;
+    tgp_context*     prev_tgpctx;
+
+    tgpgl_state state;
+    tgpgl_stats stats;
 } tgpgl_context;
 
 TGPDEF void tgpgl_init_context(tgpgl_context* ctx, tgp_context* tgpctx);
 TGPDEF void tgpgl_destroy_context(tgpgl_context* ctx);
 TGPDEF void tgpgl_render(tgpgl_context* ctx);
+TGPDEF void tgpgl_render_frame(tgpgl_context* ctx, tgp_context* frame);
+TGPDEF tgp_backend tgpgl_backend(tgpgl_context* ctx);
+TGPDEF void tgpgl_invalidate_state(tgpgl_context* ctx);
+TGPDEF uint32_t tgpgl_create_shader(tgpgl_context* ctx,
+                                    const char*    fragment_source);
+TGPDEF bool tgpgl_readback(tgpgl_context* ctx, void* pixels, size_t size,
+                           tgpgl_readback_info* info);
+TGPDEF bool tgpgl_readback_flush(tgpgl_context* ctx, void* pixels,
+                                 size_t size, tgpgl_readback_info* info);
+TGPDEF bool tgpgl_export(tgpgl_context* ctx, int width, int height,
+                         int tile_size, tgpgl_export_sink sink, void* user);
 
 /**** implementation *****/
 // #ifdef TINYGPGL_IMPLEMENTATION
@@ -54,10 +307,11 @@ static bool tgpgl_check_shader(tgpgl_context* ctx, GLuint handle,
                 "GLSL %s",
                 desc, ctx->glsl_version_str);
     }
-    if (log_length > 1) {
-        char buf[log_length];
+    char* buf = log_length > 1 ? (char*)malloc((size_t)log_length) : NULL;
+    if (buf != NULL) {
         glGetShaderInfoLog(handle, log_length, NULL, buf);
         fprintf(stderr, "%s\n", buf);
+        free(buf);
     }
     return (GLboolean)status == GL_TRUE;
 }
@@ -74,93 +328,283 @@ static bool tgpgl_check_program(tgpgl_context* ctx, GLuint handle,
                 "GLSL %s",
                 desc, ctx->glsl_version_str);
     }
-    if (log_length > 1) {
-        char buf[log_length];
+    char* buf = log_length > 1 ? (char*)malloc((size_t)log_length) : NULL;
+    if (buf != NULL) {
         glGetProgramInfoLog(handle, log_length, NULL, buf);
         fprintf(stderr, "%s\n", buf);
+        free(buf);
     }
     return (GLboolean)status == GL_TRUE;
 }
 
-static void tgpgl_create_device_objects(tgpgl_context* ctx) {
-    TINYGP_ASSERT(ctx != NULL);
+// points the attributes at vertex `base` of the vertex buffer, the indices
+// of a draw are relative to its first vertex
+static void tgpgl_vertex_pointers(tgpgl_context* ctx, uint32_t base) {
+    const size_t offset = sizeof(tgp_vertex) * base;
+    glVertexAttribPointer(
+        ctx->attrib_location_vtx_pos, 2, GL_FLOAT, GL_FALSE, sizeof(tgp_vertex),
+        (GLvoid*)(offset + TGPGL_OFFSETOF(tgp_vertex, position)));
+    glVertexAttribPointer(
+        ctx->attrib_location_vtx_uv, 2, GL_FLOAT, GL_FALSE, sizeof(tgp_vertex),
+        (GLvoid*)(offset + TGPGL_OFFSETOF(tgp_vertex, texcoord)));
+    glVertexAttribPointer(
+        ctx->attrib_location_vtx_color, 4, GL_FLOAT, GL_FALSE,
+        sizeof(tgp_vertex),
+        (GLvoid*)(offset + TGPGL_OFFSETOF(tgp_vertex, color)));
+#ifdef TINYGP_OPAQUE_PASS
+    glVertexAttribPointer(
+        ctx->attrib_location_vtx_depth, 1, GL_FLOAT, GL_FALSE,
+        sizeof(tgp_vertex),
+        (GLvoid*)(offset + TGPGL_OFFSETOF(tgp_vertex, depth)));
+#endif
+#ifdef TINYGP_BOX_SHADOWS
+    glVertexAttribPointer(
+        ctx->attrib_location_vtx_shadow, 4, GL_FLOAT, GL_FALSE,
+        sizeof(tgp_vertex),
+        (GLvoid*)(offset + TGPGL_OFFSETOF(tgp_vertex, shadow)));
+#endif
+}
 
+static void tgpgl_setup_vertex_attribs(tgpgl_context* ctx) {
+    // setup attributes for tgp_vertex
+    glEnableVertexAttribArray(ctx->attrib_location_vtx_pos);
+    glEnableVertexAttribArray(ctx->attrib_location_vtx_uv);
+    glEnableVertexAttribArray(ctx->attrib_location_vtx_color);
+#ifdef TINYGP_OPAQUE_PASS
+    glEnableVertexAttribArray(ctx->attrib_location_vtx_depth);
+#endif
+#ifdef TINYGP_BOX_SHADOWS
+    glEnableVertexAttribArray(ctx->attrib_location_vtx_shadow);
+#endif
+    tgpgl_vertex_pointers(ctx, 0);
+    ctx->state.vertex_base = 0;
+}
+
+// returns the vertex shader for the GLSL version of the context
+static const GLchar* tgpgl_vertex_shader(tgpgl_context* ctx) {
+    // `proj` holds the scale (xy) and the translation (zw) of the projection,
+    // it is the identity unless tgp_options.gpu_projection is enabled
     static const GLchar* vertex_shader_glsl_120 =
+        "uniform vec4 proj;\n"
         "attribute vec2 coord;\n"
         "attribute vec2 uv;\n"
         "attribute vec4 color;\n"
+        TGPGL_DEPTH_ATTRIBUTE("attribute")
+        TGPGL_SHADOW_ATTRIBUTE("attribute")
         "varying vec2 fragUV;\n"
         "varying vec4 fragColor;\n"
+        TGPGL_SHADOW_VARYING("varying")
         "void main() {\n"
         "    fragUV = uv;\n"
         "    fragColor = color;\n"
-        "    gl_Position = vec4(coord.xy, 0.0, 1.0);\n"
+        TGPGL_SHADOW_COPY
+        "    gl_Position = vec4(coord.xy * proj.xy + proj.zw, " TGPGL_DEPTH
+        ", 1.0);\n"
         "}\n";
 
-    static const GLchar* fragment_shader_glsl_120 =
-        "#ifdef GL_ES\n"
-        "precision mediump float;\n"
-        "#endif\n"
-        "uniform sampler2D tex;\n"
-        "varying vec2 fragUV;\n"
-        "varying vec4 fragColor;\n"
+    static const GLchar* vertex_shader_glsl_130 =
+        "uniform vec4 proj;\n"
+        "in vec2 coord;\n"
+        "in vec2 uv;\n"
+        "in vec4 color;\n"
+        TGPGL_DEPTH_ATTRIBUTE("in")
+        TGPGL_SHADOW_ATTRIBUTE("in")
+        "out vec2 fragUV;\n"
+        "out vec4 fragColor;\n"
+        TGPGL_SHADOW_VARYING("out")
         "void main() {\n"
-        "    gl_FragColor = fragColor * texture2D(tex, fragUV.st);\n"
+        "    fragUV = uv;\n"
+        "    fragColor = color;\n"
+        TGPGL_SHADOW_COPY
+        "    gl_Position = vec4(coord.xy * proj.xy + proj.zw, " TGPGL_DEPTH
+        ", 1.0);\n"
         "}\n";
 
-    // parse GLSL version
+    static const GLchar* vertex_shader_glsl_300_es =
+        "precision highp float;\n"
+        "uniform vec4 proj;\n"
+        "in vec2 coord;\n"
+        "in vec2 uv;\n"
+        "in vec4 color;\n"
+        TGPGL_DEPTH_ATTRIBUTE("in")
+        TGPGL_SHADOW_ATTRIBUTE("in")
+        "out vec2 fragUV;\n"
+        "out vec4 fragColor;\n"
+        TGPGL_SHADOW_VARYING("out")
+        "void main() {\n"
+        "    fragUV = uv;\n"
+        "    fragColor = color;\n"
+        TGPGL_SHADOW_COPY
+        "    gl_Position = vec4(coord.xy * proj.xy + proj.zw, " TGPGL_DEPTH
+        ", 1.0);\n"
+        "}\n";
+
+    // select matching GLSL shader (GLSL 150 uses the 130 shader)
     int glsl_version = 130;
     sscanf(ctx->glsl_version_str, "#version %d", &glsl_version);
-
-    // select matching GLSL shader
-    const GLchar* vertex_shader = NULL;
-    const GLchar* fragment_shader = NULL;
     if (glsl_version < 130) {
-        vertex_shader = vertex_shader_glsl_120;
-        fragment_shader = fragment_shader_glsl_120;
-    } else {
-        TINYGP_ASSERT(false && "not implemented");
+        return vertex_shader_glsl_120;
+    } else if (glsl_version == 300) {
+        return vertex_shader_glsl_300_es;
     }
+    return vertex_shader_glsl_130;
+}
 
+// links the vertex shader with `fragment_shader`, returns 0 if that fails.
+// the attributes of other programs are bound to the locations of the
+// built-in one, so that they can share the vertex layout
+static GLuint tgpgl_link_program(tgpgl_context* ctx,
+                                 const GLchar*  fragment_shader) {
     // create shaders
     const GLchar* vertex_shader_with_version[2] = {ctx->glsl_version_str,
-                                                   vertex_shader};
+                                                   tgpgl_vertex_shader(ctx)};
     GLuint        vert_handle = glCreateShader(GL_VERTEX_SHADER);
     glShaderSource(vert_handle, 2, vertex_shader_with_version, NULL);
     glCompileShader(vert_handle);
-    tgpgl_check_shader(ctx, vert_handle, "vertex shader");
+    bool ok = tgpgl_check_shader(ctx, vert_handle, "vertex shader");
 
     const GLchar* fragment_shader_with_version[2] = {ctx->glsl_version_str,
                                                      fragment_shader};
     GLuint        frag_handle = glCreateShader(GL_FRAGMENT_SHADER);
     glShaderSource(frag_handle, 2, fragment_shader_with_version, NULL);
     glCompileShader(frag_handle);
-    tgpgl_check_shader(ctx, frag_handle, "fragment shader");
+    ok = tgpgl_check_shader(ctx, frag_handle, "fragment shader") && ok;
 
     // link shaders
-    ctx->shader_handle = glCreateProgram();
-    glAttachShader(ctx->shader_handle, vert_handle);
-    glAttachShader(ctx->shader_handle, frag_handle);
-    glLinkProgram(ctx->shader_handle);
-    tgpgl_check_program(ctx, ctx->shader_handle, "shader program");
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vert_handle);
+    glAttachShader(program, frag_handle);
+    if (ctx->shader_handle != 0) {
+        glBindAttribLocation(program, ctx->attrib_location_vtx_pos, "coord");
+        glBindAttribLocation(program, ctx->attrib_location_vtx_uv, "uv");
+        glBindAttribLocation(program, ctx->attrib_location_vtx_color,
+                             "color");
+        if (ctx->attrib_location_vtx_depth >= 0) {
+            glBindAttribLocation(program, ctx->attrib_location_vtx_depth,
+                                 "depth");
+        }
+        if (ctx->attrib_location_vtx_shadow >= 0) {
+            glBindAttribLocation(program, ctx->attrib_location_vtx_shadow,
+                                 "shadow");
+        }
+    }
+    glLinkProgram(program);
+    ok = tgpgl_check_program(ctx, program, "shader program") && ok;
 
     // the shaders are now linked into our program, we can get rid of them
-    glDetachShader(ctx->shader_handle, vert_handle);
-    glDetachShader(ctx->shader_handle, frag_handle);
+    glDetachShader(program, vert_handle);
+    glDetachShader(program, frag_handle);
     glDeleteShader(vert_handle);
     glDeleteShader(frag_handle);
+    if (!ok) {
+        glDeleteProgram(program);
+        return 0;
+    }
+    return program;
+}
+
+static void tgpgl_create_device_objects(tgpgl_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL);
+
+    // colors are blended premultiplied, so that every tgp_blend_mode can be
+    // done with the blend function. textures with straight alpha are
+    // premultiplied here (see tgp_texture_alpha)
+    static const GLchar* fragment_shader_glsl_120 =
+        "#ifdef GL_ES\n"
+        "precision mediump float;\n"
+        "#endif\n"
+        "uniform sampler2D tex;\n"
+        "uniform float straight;\n"
+        "varying vec2 fragUV;\n"
+        "varying vec4 fragColor;\n"
+        TGPGL_SHADOW_VARYING("varying")
+        TGPGL_SHADOW_FUNCTIONS
+        "void main() {\n"
+        "    vec4 texel = texture2D(tex, fragUV.st);\n"
+        "    texel.rgb *= mix(1.0, texel.a, straight);\n"
+        "    gl_FragColor = vec4(fragColor.rgb * fragColor.a, fragColor.a) *\n"
+        "                   " TGPGL_SHADOW_TEXEL("texel") ";\n"
+        "}\n";
+
+    static const GLchar* fragment_shader_glsl_130 =
+        "uniform sampler2D tex;\n"
+        "uniform float straight;\n"
+        "in vec2 fragUV;\n"
+        "in vec4 fragColor;\n"
+        TGPGL_SHADOW_VARYING("in")
+        "out vec4 outColor;\n"
+        TGPGL_SHADOW_FUNCTIONS
+        "void main() {\n"
+        "    vec4 texel = texture(tex, fragUV.st);\n"
+        "    texel.rgb *= mix(1.0, texel.a, straight);\n"
+        "    outColor = vec4(fragColor.rgb * fragColor.a, fragColor.a) *\n"
+        "               " TGPGL_SHADOW_TEXEL("texel") ";\n"
+        "}\n";
+
+    static const GLchar* fragment_shader_glsl_300_es =
+        "precision mediump float;\n"
+        "uniform sampler2D tex;\n"
+        "uniform float straight;\n"
+        "in vec2 fragUV;\n"
+        "in vec4 fragColor;\n"
+        TGPGL_SHADOW_VARYING("in")
+        "layout (location = 0) out vec4 outColor;\n"
+        TGPGL_SHADOW_FUNCTIONS
+        "void main() {\n"
+        "    vec4 texel = texture(tex, fragUV.st);\n"
+        "    texel.rgb *= mix(1.0, texel.a, straight);\n"
+        "    outColor = vec4(fragColor.rgb * fragColor.a, fragColor.a) *\n"
+        "               " TGPGL_SHADOW_TEXEL("texel") ";\n"
+        "}\n";
+
+    // select matching GLSL shader (GLSL 150 uses the 130 shader)
+    int glsl_version = 130;
+    sscanf(ctx->glsl_version_str, "#version %d", &glsl_version);
+    const GLchar* fragment_shader = NULL;
+    if (glsl_version < 130) {
+        fragment_shader = fragment_shader_glsl_120;
+    } else if (glsl_version == 300) {
+        fragment_shader = fragment_shader_glsl_300_es;
+    } else {
+        fragment_shader = fragment_shader_glsl_130;
+    }
+    ctx->shader_handle = tgpgl_link_program(ctx, fragment_shader);
 
     // find attributes
     ctx->attrib_location_tex = glGetUniformLocation(ctx->shader_handle, "tex");
+    ctx->attrib_location_proj =
+        glGetUniformLocation(ctx->shader_handle, "proj");
     ctx->attrib_location_vtx_pos =
         glGetAttribLocation(ctx->shader_handle, "coord");
     ctx->attrib_location_vtx_uv = glGetAttribLocation(ctx->shader_handle, "uv");
     ctx->attrib_location_vtx_color =
         glGetAttribLocation(ctx->shader_handle, "color");
+    ctx->attrib_location_vtx_depth =
+        glGetAttribLocation(ctx->shader_handle, "depth");
+    ctx->attrib_location_vtx_shadow =
+        glGetAttribLocation(ctx->shader_handle, "shadow");
+    ctx->shaders[0].program = ctx->shader_handle;
+    ctx->shaders[0].proj_location = ctx->attrib_location_proj;
+    ctx->shaders[0].straight_location =
+        glGetUniformLocation(ctx->shader_handle, "straight");
+    ctx->shaders[0].straight = -1.0f;
+    ctx->num_shaders = 1;
 
     // create buffers
     glGenBuffers(1, &ctx->vbo);
     glGenBuffers(1, &ctx->elements);
+    glGenBuffers(2, ctx->rect_elements);
+
+#ifdef TGPGL_HAS_VAO
+    // the vertex layout never changes, so it is recorded in a VAO once. only
+    // the offset of the attributes changes, see tgpgl_vertex_base()
+    glGenVertexArrays(1, &ctx->vao);
+    glBindVertexArray(ctx->vao);
+    glBindBuffer(GL_ARRAY_BUFFER, ctx->vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ctx->elements);
+    tgpgl_setup_vertex_attribs(ctx);
+    glBindVertexArray(0);
+#endif
 
     // create a white texture
     uint8_t data[4 * 4 * 4];
@@ -174,13 +618,59 @@ static void tgpgl_create_device_objects(tgpgl_context* ctx) {
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
     glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 4, 4, 0, GL_RGBA, GL_UNSIGNED_BYTE,
                  data);
+
+#ifdef TGPGL_HAS_MSAA
+    glGetIntegerv(GL_MAX_SAMPLES, &ctx->max_samples);
+#endif
+}
+
+// render targets are used for layers and for the tiles of tgpgl_export()
+static void tgpgl_create_target(tgpgl_layer* target) {
+    glGenFramebuffers(1, &target->fbo);
+    glGenTextures(1, &target->texture);
+    glGenRenderbuffers(1, &target->depth_stencil);
+}
+
+static void tgpgl_delete_target(tgpgl_layer* target) {
+    glDeleteFramebuffers(1, &target->fbo);
+    glDeleteTextures(1, &target->texture);
+    glDeleteRenderbuffers(1, &target->depth_stencil);
+#ifdef TGPGL_HAS_MSAA
+    glDeleteFramebuffers(1, &target->msaa_fbo);
+    glDeleteRenderbuffers(1, &target->msaa_color);
+    glDeleteRenderbuffers(1, &target->msaa_depth_stencil);
+#endif
 }
 
 static inline void tgpgl_destroy_device_objects(tgpgl_context* ctx) {
     glDeleteBuffers(1, &ctx->vbo);
     glDeleteBuffers(1, &ctx->elements);
-    glDeleteProgram(ctx->shader_handle);
+    for (uint32_t i = 0; i < ctx->num_shaders; i++) {
+        glDeleteProgram(ctx->shaders[i].program);
+    }
+    ctx->num_shaders = 0;
     glDeleteTextures(1, &ctx->white_texture);
+#ifdef TGPGL_HAS_VAO
+    glDeleteVertexArrays(1, &ctx->vao);
+#endif
+    glDeleteBuffers(2, ctx->rect_elements);
+    for (uint32_t i = 0; i < ctx->num_layers; i++) {
+        tgpgl_delete_target(&ctx->layers[i]);
+    }
+    ctx->num_layers = 0;
+    tgpgl_delete_target(&ctx->screen);
+    memset(&ctx->screen, 0, sizeof(ctx->screen));
+#ifdef TGPGL_HAS_ASYNC_READBACK
+    for (uint32_t i = 0; i < TGPGL_READBACK_SLOTS; i++) {
+        tgpgl_readback_slot* slot = &ctx->readback[i];
+        if (slot->fence != 0) {
+            glDeleteSync(slot->fence);
+        }
+        glDeleteBuffers(1, &slot->pbo);
+    }
+#endif
+    memset(ctx->readback, 0, sizeof(ctx->readback));
+    ctx->readback_count = 0;
 }
 
 TGPDEF void tgpgl_init_context(tgpgl_context* ctx, tgp_context* tgpctx) {
@@ -230,99 +720,1369 @@ TGPDEF void tgpgl_destroy_context(tgpgl_context* ctx) {
     }
 }
 
+TGPDEF void tgpgl_invalidate_state(tgpgl_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL);
+    ctx->state.valid = false;
+}
+
+// compiles a fragment shader for tgp_pipeline.shader, returns 0 if it fails
+// to compile or there are TGPGL_MAX_SHADERS already. the source is compiled
+// after the `#version` line of the context and gets `fragUV` and
+// `fragColor` from the vertex shader (`varying` before GLSL 130, `in`
+// after). the textures of the pipeline are in `uniform sampler2D tex`,
+// `tex1`, `tex2` and `tex3`. like the built-in shader it has to output
+// premultiplied colors, e.g. vec4(fragColor.rgb * fragColor.a, fragColor.a).
+// `uniform float straight` is 1.0 if the pipeline has straight alpha
+// textures (see tgp_texture_alpha) and 0.0 otherwise
+TGPDEF uint32_t tgpgl_create_shader(tgpgl_context* ctx,
+                                    const char*    fragment_source) {
+    TINYGP_ASSERT(ctx != NULL && fragment_source != NULL);
+    if (ctx->num_shaders >= TGPGL_MAX_SHADERS) {
+        return 0;
+    }
+    const GLuint program = tgpgl_link_program(ctx, fragment_source);
+    if (program == 0) {
+        return 0;
+    }
+
+    // samplers are program state and never change
+    static const char* samplers[TGP_PIPELINE_TEXTURES] = {"tex", "tex1",
+                                                          "tex2", "tex3"};
+    glUseProgram(program);
+    for (GLint i = 0; i < TGP_PIPELINE_TEXTURES; i++) {
+        glUniform1i(glGetUniformLocation(program, samplers[i]), i);
+    }
+    glUseProgram(ctx->state.program);
+
+    tgpgl_shader* shader = &ctx->shaders[ctx->num_shaders];
+    memset(shader, 0, sizeof(*shader));
+    shader->program = program;
+    shader->proj_location = glGetUniformLocation(program, "proj");
+    shader->straight_location = glGetUniformLocation(program, "straight");
+    shader->straight = -1.0f;
+    return ctx->num_shaders++;
+}
+
+static inline void tgpgl_set_cap(tgpgl_context* ctx, uint32_t cap, GLenum glcap,
+                                 bool enable) {
+    const bool enabled = (ctx->state.caps & cap) != 0;
+    if (ctx->state.valid && enabled == enable) {
+        ctx->stats.skipped_calls++;
+        return;
+    }
+    if (enable) {
+        glEnable(glcap);
+        ctx->state.caps |= cap;
+    } else {
+        glDisable(glcap);
+        ctx->state.caps &= ~cap;
+    }
+    ctx->stats.state_calls++;
+}
+
+static inline void tgpgl_blend_func(tgpgl_context* ctx, GLenum src_rgb,
+                                    GLenum dst_rgb, GLenum src_alpha,
+                                    GLenum dst_alpha) {
+    tgpgl_state* st = &ctx->state;
+    if (st->valid && st->blend_src_rgb == src_rgb &&
+        st->blend_dst_rgb == dst_rgb && st->blend_src_alpha == src_alpha &&
+        st->blend_dst_alpha == dst_alpha) {
+        ctx->stats.skipped_calls++;
+        return;
+    }
+    glBlendFuncSeparate(src_rgb, dst_rgb, src_alpha, dst_alpha);
+    st->blend_src_rgb = src_rgb;
+    st->blend_dst_rgb = dst_rgb;
+    st->blend_src_alpha = src_alpha;
+    st->blend_dst_alpha = dst_alpha;
+    ctx->stats.state_calls++;
+}
+
+static inline void tgpgl_use_program(tgpgl_context* ctx, GLuint program) {
+    if (ctx->state.valid && ctx->state.program == program) {
+        ctx->stats.skipped_calls++;
+        return;
+    }
+    glUseProgram(program);
+    ctx->state.program = program;
+    ctx->stats.state_calls++;
+}
+
+static inline void tgpgl_bind_buffer(tgpgl_context* ctx, GLenum target,
+                                     GLuint buffer) {
+    GLuint* bound = target == GL_ARRAY_BUFFER ? &ctx->state.array_buffer
+                                              : &ctx->state.element_buffer;
+    if (ctx->state.valid && *bound == buffer) {
+        ctx->stats.skipped_calls++;
+        return;
+    }
+    glBindBuffer(target, buffer);
+    *bound = buffer;
+    ctx->stats.state_calls++;
+}
+
+static inline void tgpgl_bind_texture_unit(tgpgl_context* ctx, uint32_t unit,
+                                           GLuint texture) {
+    if (ctx->state.valid && ctx->state.textures[unit] == texture) {
+        ctx->stats.skipped_calls++;
+        return;
+    }
+    if (!ctx->state.valid || ctx->state.active_texture != unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        ctx->state.active_texture = unit;
+        ctx->stats.state_calls++;
+    }
+    glBindTexture(GL_TEXTURE_2D, texture);
+    ctx->state.textures[unit] = texture;
+    ctx->stats.state_calls++;
+}
+
+static inline void tgpgl_bind_texture(tgpgl_context* ctx, GLuint texture) {
+    tgpgl_bind_texture_unit(ctx, 0, texture);
+}
+
+static inline void tgpgl_vertex_base(tgpgl_context* ctx, uint32_t base) {
+    if (ctx->state.valid && ctx->state.vertex_base == base) {
+        ctx->stats.skipped_calls++;
+        return;
+    }
+    tgpgl_bind_buffer(ctx, GL_ARRAY_BUFFER, ctx->vbo);
+    tgpgl_vertex_pointers(ctx, base);
+    ctx->state.vertex_base = base;
+    ctx->stats.state_calls++;
+}
+
+static inline bool tgpgl_irects_equal(tgp_irect a, tgp_irect b) {
+    return a.x == b.x && a.y == b.y && a.w == b.w && a.h == b.h;
+}
+
+static inline void tgpgl_set_viewport(tgpgl_context* ctx,
+                                      tgp_irect      viewport) {
+    if (ctx->state.valid && tgpgl_irects_equal(ctx->state.viewport, viewport)) {
+        ctx->stats.skipped_calls++;
+        return;
+    }
+    glViewport(viewport.x, viewport.y, viewport.w, viewport.h);
+    ctx->state.viewport = viewport;
+    ctx->stats.state_calls++;
+}
+
+static inline void tgpgl_set_scissor(tgpgl_context* ctx, tgp_irect scissor) {
+    if (ctx->state.valid && tgpgl_irects_equal(ctx->state.scissor, scissor)) {
+        ctx->stats.skipped_calls++;
+        return;
+    }
+    glScissor(scissor.x, scissor.y, scissor.w, scissor.h);
+    ctx->state.scissor = scissor;
+    ctx->stats.state_calls++;
+}
+
+static inline void tgpgl_clear(tgpgl_context* ctx, tgp_color color) {
+    tgp_color* cur = &ctx->state.clear_color;
+    if (!ctx->state.valid || cur->r != color.r || cur->g != color.g ||
+        cur->b != color.b || cur->a != color.a) {
+        glClearColor(color.r, color.g, color.b, color.a);
+        *cur = color;
+        ctx->stats.state_calls++;
+    } else {
+        ctx->stats.skipped_calls++;
+    }
+    glClear(GL_COLOR_BUFFER_BIT);
+}
+
+static inline void tgpgl_depth_mask(tgpgl_context* ctx, bool write) {
+    if (ctx->state.valid && ctx->state.depth_write == write) {
+        ctx->stats.skipped_calls++;
+        return;
+    }
+    glDepthMask(write ? GL_TRUE : GL_FALSE);
+    ctx->state.depth_write = write;
+    ctx->stats.state_calls++;
+}
+
+// clears the depth buffer inside of the scissor
+static inline void tgpgl_clear_depth(tgpgl_context* ctx) {
+    tgpgl_depth_mask(ctx, true);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    tgpgl_depth_mask(ctx, false);
+}
+
+// clears the stencil buffer inside of the scissor. path fills expect it to
+// be 0 and leave it that way
+static inline void tgpgl_clear_stencil(void) {
+    glStencilMask(0xff);
+    glClear(GL_STENCIL_BUFFER_BIT);
+}
+
+// uniforms are per program, every shader remembers the projection it has
+static inline void tgpgl_set_projection(tgpgl_context* ctx,
+                                        const float    projection[4]) {
+    tgpgl_shader* shader = &ctx->shaders[ctx->state.shader];
+    memcpy(ctx->state.projection, projection, sizeof(float) * 4);
+    if (ctx->state.valid && shader->projection_set &&
+        memcmp(shader->projection, projection, sizeof(float) * 4) == 0) {
+        ctx->stats.skipped_calls++;
+        return;
+    }
+    glUniform4fv(shader->proj_location, 1, projection);
+    memcpy(shader->projection, projection, sizeof(float) * 4);
+    shader->projection_set = true;
+    ctx->stats.state_calls++;
+}
+
+// tells the current shader whether texture 0 has straight alpha
+static inline void tgpgl_set_straight_alpha(tgpgl_context* ctx,
+                                            bool           straight) {
+    tgpgl_shader* shader = &ctx->shaders[ctx->state.shader];
+    const float   value = straight ? 1.0f : 0.0f;
+    if (shader->straight == value || shader->straight_location < 0) {
+        ctx->stats.skipped_calls++;
+        return;
+    }
+    glUniform1f(shader->straight_location, value);
+    shader->straight = value;
+    ctx->stats.state_calls++;
+}
+
+static inline void tgpgl_use_shader(tgpgl_context* ctx, uint32_t shader) {
+    tgpgl_use_program(ctx, ctx->shaders[shader].program);
+    if (ctx->state.shader != shader) {
+        ctx->state.shader = shader;
+        tgpgl_set_projection(ctx, ctx->state.projection);
+    }
+}
+
 static void tgpgl_setup_render_state(tgpgl_context* ctx) {
     TINYGP_ASSERT(ctx != NULL);
+    if (!ctx->state.valid) {
+        // the blend equation and depth function are not tracked, set them
+        // whenever the cache is rebuilt
+        glBlendEquation(GL_FUNC_ADD);
+#ifdef TINYGP_OPAQUE_PASS
+        // triangles of the same draw have the same depth and must be drawn
+        // in order
+        glDepthFunc(GL_LEQUAL);
+#endif
+        ctx->state.attribs_enabled = false;
+        ctx->state.vertex_base = UINT32_MAX;
+        // values that never match, so that they are set again when used
+        ctx->state.viewport = ctx->state.scissor =
+            TGP_LITERAL(tgp_irect){0, 0, -1, -1};
+        ctx->state.clear_color.a = -1.0f;
+        memset(ctx->state.textures, 0xff, sizeof(ctx->state.textures));
+        ctx->state.active_texture = UINT32_MAX;
+        for (uint32_t i = 0; i < ctx->num_shaders; i++) {
+            ctx->shaders[i].projection_set = false;
+        }
+    }
 
-    // enable alpha blending, disable face culling, disable depth testing,
-    // enable scissor
-    glEnable(GL_BLEND);
-    glBlendEquation(GL_FUNC_ADD);
-    glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_ONE,
-                        GL_ONE_MINUS_SRC_ALPHA);
-    glDisable(GL_CULL_FACE);
-    glDisable(GL_DEPTH_TEST);
-    glDisable(GL_STENCIL_TEST);
-    glEnable(GL_SCISSOR_TEST);
+    // enable alpha blending, disable face culling, enable depth testing only
+    // for the opaque pass, enable scissor
+    tgpgl_set_cap(ctx, TGPGL_CAP_BLEND, GL_BLEND, true);
+    tgpgl_blend_func(ctx, GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_ONE,
+                     GL_ONE_MINUS_SRC_ALPHA);
+    tgpgl_set_cap(ctx, TGPGL_CAP_CULL_FACE, GL_CULL_FACE, false);
+#ifdef TINYGP_OPAQUE_PASS
+    tgpgl_set_cap(ctx, TGPGL_CAP_DEPTH_TEST, GL_DEPTH_TEST, true);
+#else
+    tgpgl_set_cap(ctx, TGPGL_CAP_DEPTH_TEST, GL_DEPTH_TEST, false);
+#endif
+    tgpgl_set_cap(ctx, TGPGL_CAP_STENCIL_TEST, GL_STENCIL_TEST, false);
+    tgpgl_set_cap(ctx, TGPGL_CAP_SCISSOR_TEST, GL_SCISSOR_TEST, true);
     // TODO: set glPolygonMode() and GL_PRIMITIVE_RESTART
 
-    glUseProgram(ctx->shader_handle);
-    glUniform1i(ctx->attrib_location_tex, 0);
+    if (!ctx->state.valid) {
+        // the sampler uniform is program state, it never changes
+        tgpgl_use_program(ctx, ctx->shader_handle);
+        glUniform1i(ctx->attrib_location_tex, 0);
+        ctx->state.shader = 0;
+    } else {
+        ctx->stats.skipped_calls += 2;
+    }
+    // the frame may have other pipelines, the first draw applies its own
+    ctx->state.pipeline = UINT32_MAX;
 
     // bind vertex and index buffers
-    glBindBuffer(GL_ARRAY_BUFFER, ctx->vbo);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ctx->elements);
+#ifdef TGPGL_HAS_VAO
+    // the element buffer binding is part of the VAO, the cache keeps track
+    // of it across frames
+    glBindVertexArray(ctx->vao);
+    tgpgl_bind_buffer(ctx, GL_ARRAY_BUFFER, ctx->vbo);
+    tgpgl_bind_buffer(ctx, GL_ELEMENT_ARRAY_BUFFER, ctx->elements);
+#else
+    tgpgl_bind_buffer(ctx, GL_ARRAY_BUFFER, ctx->vbo);
+    tgpgl_bind_buffer(ctx, GL_ELEMENT_ARRAY_BUFFER, ctx->elements);
+    if (!ctx->state.attribs_enabled) {
+        tgpgl_setup_vertex_attribs(ctx);
+        ctx->state.attribs_enabled = true;
+    }
+#endif
+    ctx->state.valid = true;
+}
 
-    // setup attributes for tgp_vertex
-    glEnableVertexAttribArray(ctx->attrib_location_vtx_pos);
-    glEnableVertexAttribArray(ctx->attrib_location_vtx_uv);
-    glEnableVertexAttribArray(ctx->attrib_location_vtx_color);
-    glVertexAttribPointer(ctx->attrib_location_vtx_pos, 2, GL_FLOAT, GL_FALSE,
-                          sizeof(tgp_vertex),
-                          (GLvoid*)TGPGL_OFFSETOF(tgp_vertex, position));
-    glVertexAttribPointer(ctx->attrib_location_vtx_uv, 2, GL_FLOAT, GL_FALSE,
-                          sizeof(tgp_vertex),
-                          (GLvoid*)TGPGL_OFFSETOF(tgp_vertex, texcoord));
-    glVertexAttribPointer(ctx->attrib_location_vtx_color, 4, GL_FLOAT, GL_FALSE,
-                          sizeof(tgp_vertex),
-                          (GLvoid*)TGPGL_OFFSETOF(tgp_vertex, color));
+static inline tgp_irect tgpgl_intersect(tgp_irect a, tgp_irect b) {
+    const int x1 = TGP_MAX(a.x, b.x);
+    const int y1 = TGP_MAX(a.y, b.y);
+    const int x2 = TGP_MIN(a.x + a.w, b.x + b.w);
+    const int y2 = TGP_MIN(a.y + a.h, b.y + b.h);
+    return TGP_LITERAL(tgp_irect){x1, y1, TGP_MAX(x2 - x1, 0),
+                                  TGP_MAX(y2 - y1, 0)};
 }
 
-TGPDEF void tgpgl_render(tgpgl_context* ctx) {
-    TINYGP_ASSERT(ctx != NULL);
-    tgp_context* tgpctx = ctx->tgpctx;
+// maps a rect of the frame to the tile that is being exported
+static tgp_irect tgpgl_export_rect(const tgpgl_export_state* e,
+                                   tgp_irect                 rect) {
+    const double sx = e->scale[0], sy = e->scale[1];
+    const int    x1 = (int)floor(rect.x * sx + 0.5);
+    const int    y1 = (int)floor(rect.y * sy + 0.5);
+    const int    x2 = (int)floor((rect.x + rect.w) * sx + 0.5);
+    const int    y2 = (int)floor((rect.y + rect.h) * sy + 0.5);
+    return TGP_LITERAL(tgp_irect){x1 - e->tile.x, y1 - e->tile.y, x2 - x1,
+                                  y2 - y1};
+}
 
-    // setup desired GL state
-    tgpgl_setup_render_state(ctx);
+// the GL viewport stays on the whole tile, huge images would not fit in it.
+// instead the projection moves clip space to where the viewport of the
+// frame is in the tile, and the scissor clips to it like the viewport would
+static void tgpgl_export_apply(tgpgl_context* ctx) {
+    const tgpgl_export_state* e = &ctx->export_state;
+    const tgp_irect           tile = {0, 0, e->tile.w, e->tile.h};
+    const tgp_irect           viewport = tgpgl_export_rect(e, e->viewport);
+    const float               sx = (float)viewport.w / (float)tile.w;
+    const float               sy = (float)viewport.h / (float)tile.h;
+    const float tx = (float)(2 * viewport.x + viewport.w) / tile.w - 1.0f;
+    const float ty = (float)(2 * viewport.y + viewport.h) / tile.h - 1.0f;
+    const float projection[4] = {
+        e->projection[0] * sx, e->projection[1] * sy,
+        e->projection[2] * sx + tx, e->projection[3] * sy + ty};
+    tgpgl_set_viewport(ctx, tile);
+    tgpgl_set_projection(ctx, projection);
+    tgpgl_set_scissor(
+        ctx, tgpgl_intersect(tgpgl_export_rect(e, e->scissor),
+                             tgpgl_intersect(viewport, tile)));
+}
 
-    // render draw commands
-    uint32_t    i = 0;
-    tgp_command cmd;
-    int         num_drawcalls = 0;
-
-    while (tgp_get_command_p(tgpctx, &cmd, i++)) {
-        switch (cmd.type) {
-        case TGP_COMMAND_CLEAR:
-            glClearColor(cmd.data.clear.r, cmd.data.clear.g, cmd.data.clear.b,
-                         cmd.data.clear.a);
-            glClear(GL_COLOR_BUFFER_BIT);
+// the state of the frame is kept even when it is not mapped, so that it can
+// be mapped again after a layer
+static inline void tgpgl_viewport(tgpgl_context* ctx, tgp_irect viewport) {
+    ctx->export_state.viewport = viewport;
+    if (ctx->export_state.active) {
+        tgpgl_export_apply(ctx);
+    } else {
+        tgpgl_set_viewport(ctx, viewport);
+    }
+}
+
+static inline void tgpgl_scissor(tgpgl_context* ctx, tgp_irect scissor) {
+    ctx->export_state.scissor = scissor;
+    if (ctx->export_state.active) {
+        tgpgl_export_apply(ctx);
+    } else {
+        tgpgl_set_scissor(ctx, scissor);
+    }
+}
+
+static inline void tgpgl_projection(tgpgl_context* ctx,
+                                    const float    projection[4]) {
+    memcpy(ctx->export_state.projection, projection, sizeof(float) * 4);
+    if (ctx->export_state.active) {
+        tgpgl_export_apply(ctx);
+    } else {
+        tgpgl_set_projection(ctx, projection);
+    }
+}
+
+// the viewport does not clip clears, only the scissor does
+static void tgpgl_clear_frame(tgpgl_context* ctx, tgp_color color) {
+    const tgpgl_export_state* e = &ctx->export_state;
+    if (!e->active) {
+        tgpgl_clear(ctx, color);
+        return;
+    }
+    const tgp_irect tile = {0, 0, e->tile.w, e->tile.h};
+    tgpgl_set_scissor(ctx,
+                      tgpgl_intersect(tgpgl_export_rect(e, e->scissor), tile));
+    tgpgl_clear(ctx, color);
+    tgpgl_export_apply(ctx);
+}
+
+// allocates the storage of a render target and binds its framebuffer, returns
+// false if the framebuffer is incomplete
+static bool tgpgl_alloc_target(tgpgl_context* ctx, tgpgl_layer* target, int w,
+                               int h) {
+    target->w = w;
+    target->h = h;
+    tgpgl_bind_texture(ctx, target->texture);
+    ctx->state.pipeline = UINT32_MAX; // it had another texture
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE,
+                 NULL);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           target->texture, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, target->depth_stencil);
+#if defined(TGPGL_HAS_DEPTH_STENCIL)
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, target->depth_stencil);
+#elif defined(TINYGP_OPAQUE_PASS)
+    // GLES2 needs OES_packed_depth_stencil for both, separate depth and
+    // stencil renderbuffers are not supported by most drivers
+    glRenderbufferStorage(GL_RENDERBUFFER, TGPGL_DEPTH24_STENCIL8_OES, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, target->depth_stencil);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, target->depth_stencil);
+#else
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_STENCIL_INDEX8, w, h);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, target->depth_stencil);
+#endif
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+// the framebuffer that is rendered into for a render target
+static inline GLuint tgpgl_render_fbo(const tgpgl_layer* target) {
+    return target->samples != 0 ? target->msaa_fbo : target->fbo;
+}
+
+#ifdef TGPGL_HAS_MSAA
+// allocates the multisampled framebuffer of a render target of target->w x
+// target->h pixels with a color buffer of `format` and binds it, or frees it
+// if `samples` is 0. returns false if the framebuffer is incomplete
+static bool tgpgl_alloc_msaa(tgpgl_context* ctx, tgpgl_layer* target,
+                             uint32_t samples, GLenum format) {
+    target->samples = samples;
+    if (samples == 0) {
+        glDeleteFramebuffers(1, &target->msaa_fbo);
+        glDeleteRenderbuffers(1, &target->msaa_color);
+        glDeleteRenderbuffers(1, &target->msaa_depth_stencil);
+        target->msaa_fbo = target->msaa_color = target->msaa_depth_stencil = 0;
+        return true;
+    }
+    if (target->msaa_fbo == 0) {
+        glGenFramebuffers(1, &target->msaa_fbo);
+        glGenRenderbuffers(1, &target->msaa_color);
+        glGenRenderbuffers(1, &target->msaa_depth_stencil);
+    }
+    const GLsizei n = (GLsizei)TGP_MIN(samples, (uint32_t)ctx->max_samples);
+    glBindRenderbuffer(GL_RENDERBUFFER, target->msaa_color);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, n, format, target->w,
+                                     target->h);
+    glBindRenderbuffer(GL_RENDERBUFFER, target->msaa_depth_stencil);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, n, GL_DEPTH24_STENCIL8,
+                                     target->w, target->h);
+    glBindFramebuffer(GL_FRAMEBUFFER, target->msaa_fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, target->msaa_color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, target->msaa_depth_stencil);
+    return glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+}
+
+// copies w x h pixels from the framebuffer `from` into `to` and binds `to`
+static void tgpgl_blit(tgpgl_context* ctx, GLuint from, GLuint to, int w,
+                       int h) {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, from);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, to);
+    // blits are clipped by the scissor
+    tgpgl_set_cap(ctx, TGPGL_CAP_SCISSOR_TEST, GL_SCISSOR_TEST, false);
+    glBlitFramebuffer(0, 0, w, h, 0, 0, w, h, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    tgpgl_set_cap(ctx, TGPGL_CAP_SCISSOR_TEST, GL_SCISSOR_TEST, true);
+    glBindFramebuffer(GL_FRAMEBUFFER, to);
+}
+
+// resolves the multisampled framebuffer of a render target into `fbo` and
+// binds `fbo`. both must have the same color format
+static void tgpgl_resolve(tgpgl_context* ctx, const tgpgl_layer* target,
+                          GLuint fbo) {
+    tgpgl_blit(ctx, target->msaa_fbo, fbo, target->w, target->h);
+}
+
+// resolves the layer that is rendered into `fbo` if it is multisampled
+static void tgpgl_resolve_layer(tgpgl_context* ctx, GLuint fbo) {
+    for (uint32_t i = 0; i < ctx->num_layers; i++) {
+        const tgpgl_layer* layer = &ctx->layers[i];
+        if (layer->samples != 0 && layer->msaa_fbo == fbo) {
+            tgpgl_resolve(ctx, layer, layer->fbo);
+            return;
+        }
+    }
+}
+
+// the color format of a multisampled renderbuffer that can be resolved into
+// `fbo` (windows are often RGB565 or RGB8 on GLES), or 0 if there is none
+static GLenum tgpgl_resolve_format(GLint fbo) {
+#ifdef TGPGL_GLES3
+    const GLenum attachment = fbo == 0 ? GL_BACK : GL_COLOR_ATTACHMENT0;
+#else
+    const GLenum attachment = fbo == 0 ? GL_BACK_LEFT : GL_COLOR_ATTACHMENT0;
+#endif
+    GLint r = 0, g = 0, b = 0, a = 0, encoding = GL_LINEAR;
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)fbo);
+    glGetFramebufferAttachmentParameteriv(
+        GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_RED_SIZE, &r);
+    glGetFramebufferAttachmentParameteriv(
+        GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_GREEN_SIZE, &g);
+    glGetFramebufferAttachmentParameteriv(
+        GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_BLUE_SIZE, &b);
+    glGetFramebufferAttachmentParameteriv(
+        GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_ALPHA_SIZE, &a);
+    glGetFramebufferAttachmentParameteriv(
+        GL_FRAMEBUFFER, attachment, GL_FRAMEBUFFER_ATTACHMENT_COLOR_ENCODING,
+        &encoding);
+    if (encoding == GL_SRGB) {
+        return r == 8 && g == 8 && b == 8 && a == 8 ? GL_SRGB8_ALPHA8 : 0;
+    }
+    if (r == 8 && g == 8 && b == 8 && (a == 8 || a == 0)) {
+        return a == 8 ? GL_RGBA8 : GL_RGB8;
+    }
+    if (r == 5 && g == 6 && b == 5 && a == 0) {
+        return GL_RGB565;
+    }
+    if (r == 10 && g == 10 && b == 10 && a == 2) {
+        return GL_RGB10_A2;
+    }
+    return 0;
+}
+
+// renders the screen into a multisampled framebuffer if the frame has
+// tgp_options.msaa_samples, (re)allocating it if needed
+static void tgpgl_begin_screen(tgpgl_context* ctx) {
+    const tgp_context* frame = ctx->tgpctx;
+    const uint32_t     samples = frame->msaa_samples > 1 ? frame->msaa_samples
+                                                         : 0;
+    tgpgl_layer*       screen = &ctx->screen;
+    ctx->screen_reallocated = false;
+    if (screen->samples != samples ||
+        (screen->samples != 0 &&
+         (screen->w != frame->screen_size.w ||
+          screen->h != frame->screen_size.h ||
+          ctx->screen_resolve_fbo != ctx->default_fbo))) {
+        screen->w = frame->screen_size.w;
+        screen->h = frame->screen_size.h;
+        ctx->screen_resolve_fbo = ctx->default_fbo;
+        // a multisample resolve needs the same color format on both sides,
+        // the format of the window is only looked up here
+        GLenum format =
+            samples != 0 ? tgpgl_resolve_format(ctx->default_fbo) : GL_RGBA8;
+        bool complete = true;
+        if (format == 0) {
+            // resolved into an RGBA8 framebuffer, the copy into the window
+            // converts the format
+            if (screen->fbo == 0) {
+                tgpgl_create_target(screen);
+            }
+            complete = tgpgl_alloc_target(ctx, screen, screen->w, screen->h);
+            format = GL_RGBA8;
+        } else if (screen->fbo != 0) {
+            glDeleteFramebuffers(1, &screen->fbo);
+            glDeleteTextures(1, &screen->texture);
+            glDeleteRenderbuffers(1, &screen->depth_stencil);
+            screen->fbo = screen->texture = screen->depth_stencil = 0;
+        }
+        if (!tgpgl_alloc_msaa(ctx, screen, samples, format) || !complete) {
+            fprintf(stderr, "error: tgpgl_begin_screen(): multisampled "
+                            "framebuffer is incomplete\n");
+            tgpgl_alloc_msaa(ctx, screen, 0, 0);
+        }
+        ctx->screen_reallocated = true;
+        glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)ctx->default_fbo);
+    }
+    if (screen->samples != 0) {
+        ctx->screen_fbo = screen->msaa_fbo;
+        glBindFramebuffer(GL_FRAMEBUFFER, ctx->screen_fbo);
+    }
+}
+
+// resolves the multisampled screen into default_fbo
+static void tgpgl_end_screen(tgpgl_context* ctx) {
+    const tgpgl_layer* screen = &ctx->screen;
+    if (screen->fbo == 0) {
+        tgpgl_resolve(ctx, screen, (GLuint)ctx->default_fbo);
+        return;
+    }
+    tgpgl_resolve(ctx, screen, screen->fbo);
+    tgpgl_blit(ctx, screen->fbo, (GLuint)ctx->default_fbo, screen->w,
+               screen->h);
+}
+#endif
+
+// true if the frame still knows the layer `id` (tgp_release_layer() was not
+// called), so that its contents may be drawn again
+static bool tgpgl_layer_in_use(const tgp_context* frame, uint32_t id) {
+    for (uint32_t i = 0; i < TGP_MAX_LAYERS; i++) {
+        if (frame->layers[i].used && frame->layers[i].id == id) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// returns the render target of a layer, (re)creating it if needed
+static tgpgl_layer* tgpgl_get_layer(tgpgl_context* ctx, uint32_t id, int w,
+                                    int h, uint32_t samples) {
+#ifndef TGPGL_HAS_MSAA
+    samples = 0; // the layer is rendered without MSAA
+#endif
+    tgpgl_layer* layer = NULL;
+    for (uint32_t i = 0; i < ctx->num_layers; i++) {
+        if (ctx->layers[i].id == id) {
+            layer = &ctx->layers[i];
             break;
+        }
+    }
+    if (layer == NULL && ctx->num_layers == TGP_MAX_LAYERS) {
+        // reuse the target of a released layer. the frame has at most
+        // TGP_MAX_LAYERS layers, one of them is this one
+        for (uint32_t i = 0; i < ctx->num_layers; i++) {
+            if (!tgpgl_layer_in_use(ctx->tgpctx, ctx->layers[i].id)) {
+                tgpgl_delete_target(&ctx->layers[i]);
+                ctx->layers[i] = ctx->layers[--ctx->num_layers];
+                break;
+            }
+        }
+        TINYGP_ASSERT(ctx->num_layers < TGP_MAX_LAYERS);
+    }
+    if (layer == NULL) {
+        layer = &ctx->layers[ctx->num_layers++];
+        memset(layer, 0, sizeof(*layer));
+        layer->id = id;
+        tgpgl_create_target(layer);
+    }
+    if (layer->w == w && layer->h == h && layer->samples == samples) {
+        return layer;
+    }
+
+    bool complete = tgpgl_alloc_target(ctx, layer, w, h);
+#ifdef TGPGL_HAS_MSAA
+    complete = tgpgl_alloc_msaa(ctx, layer, samples, GL_RGBA8) && complete;
+#endif
+    if (!complete) {
+        fprintf(stderr, "error: tgpgl_get_layer(): framebuffer of layer %u "
+                        "is incomplete\n",
+                id);
+    }
+    return layer;
+}
+
+// uploads all vertices and indices of the frame at once, draws only point
+// into the buffers
+static void tgpgl_upload(tgpgl_context* ctx) {
+    const tgp_context* tgpctx = ctx->tgpctx;
+    tgpgl_bind_buffer(ctx, GL_ARRAY_BUFFER, ctx->vbo);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(tgp_vertex) * tgpctx->cur_vertex,
+                 tgpctx->vertices, GL_STREAM_DRAW);
+    tgpgl_bind_buffer(ctx, GL_ELEMENT_ARRAY_BUFFER, ctx->elements);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(tgp_index) * tgpctx->cur_index,
+                 tgpctx->indices, GL_STREAM_DRAW);
+}
+
+// sets the blend function, shader and textures of a pipeline. consecutive
+// draws mostly have the same pipeline, so that is a single comparison, and
+// otherwise only the parts that differ are changed
+static void tgpgl_apply_pipeline(tgpgl_context* ctx, uint32_t index) {
+    if (ctx->state.valid && ctx->state.pipeline == index) {
+        ctx->stats.skipped_calls++;
+        return;
+    }
+    TINYGP_ASSERT(index < ctx->tgpctx->num_pipelines);
+    const tgp_pipeline* pipeline = &ctx->tgpctx->pipelines[index];
+    switch (pipeline->blend) {
+    case TGP_BLEND_NORMAL:
+        tgpgl_blend_func(ctx, GL_ONE, GL_ONE_MINUS_SRC_ALPHA, GL_ONE,
+                         GL_ONE_MINUS_SRC_ALPHA);
+        break;
+    case TGP_BLEND_ADDITIVE:
+        tgpgl_blend_func(ctx, GL_ONE, GL_ONE, GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+        break;
+    case TGP_BLEND_MULTIPLY:
+        tgpgl_blend_func(ctx, GL_DST_COLOR, GL_ONE_MINUS_SRC_ALPHA, GL_ONE,
+                         GL_ONE_MINUS_SRC_ALPHA);
+        break;
+    case TGP_BLEND_SCREEN:
+        tgpgl_blend_func(ctx, GL_ONE, GL_ONE_MINUS_SRC_COLOR, GL_ONE,
+                         GL_ONE_MINUS_SRC_ALPHA);
+        break;
+    }
+    tgpgl_use_shader(ctx, pipeline->shader < ctx->num_shaders
+                              ? pipeline->shader
+                              : 0);
+    tgpgl_set_straight_alpha(ctx, pipeline->texture_alpha ==
+                                      TGP_TEXTURE_STRAIGHT_ALPHA);
+    // texture 0 defaults to white, the other units are only used by custom
+    // shaders and are left alone if they are not set
+    tgpgl_bind_texture(ctx, pipeline->textures[0] != 0 ? pipeline->textures[0]
+                                                       : ctx->white_texture);
+    for (uint32_t i = 1; i < TGP_PIPELINE_TEXTURES; i++) {
+        if (pipeline->textures[i] != 0) {
+            tgpgl_bind_texture_unit(ctx, i, pipeline->textures[i]);
+        }
+    }
+    ctx->state.pipeline = index;
+}
+
+// draws with the pipeline that was applied last
+static void tgpgl_draw(tgpgl_context* ctx, const tgp_draw_command* draw) {
+    tgpgl_vertex_base(ctx, draw->vtx_offset);
+    tgpgl_bind_buffer(ctx, GL_ELEMENT_ARRAY_BUFFER, ctx->elements);
+    ctx->stats.draw_calls++;
+    glDrawElements(GL_TRIANGLES, draw->num_indices,
+                   sizeof(tgp_index) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                   (void*)(sizeof(tgp_index) * draw->idx_offset));
+}
+
+static void tgpgl_draw_rects(tgpgl_context*                ctx,
+                             const tgp_draw_rects_command* rects) {
+    const tgp_draw_command* draw = &rects->draw;
+    const int               aa = rects->antialiased ? 1 : 0;
+    uint32_t                pattern_indices, pattern_vertices;
+    const tgp_index*        pattern = tgp_rect_index_pattern(
+        rects->antialiased, &pattern_indices, &pattern_vertices);
+    const uint32_t num_rects = draw->num_vertices / pattern_vertices;
+
+    tgpgl_bind_buffer(ctx, GL_ELEMENT_ARRAY_BUFFER, ctx->rect_elements[aa]);
+    if (ctx->rect_elements_capacity[aa] < num_rects) {
+        // (re)build the static index buffer, it only ever grows
+        uint32_t capacity = TGP_MAX(ctx->rect_elements_capacity[aa], 256u);
+        while (capacity < num_rects) {
+            capacity *= 2;
+        }
+        capacity = TGP_MIN(capacity, TGP_MAX_DRAW_VERTICES / pattern_vertices);
+        tgp_index* indices = (tgp_index*)malloc(sizeof(tgp_index) *
+                                                pattern_indices * capacity);
+        TINYGP_ASSERT(indices != NULL);
+        for (uint32_t r = 0; r < capacity; r++) {
+            for (uint32_t i = 0; i < pattern_indices; i++) {
+                indices[r * pattern_indices + i] =
+                    (tgp_index)(pattern[i] + r * pattern_vertices);
+            }
+        }
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                     sizeof(tgp_index) * pattern_indices * capacity, indices,
+                     GL_STATIC_DRAW);
+        free(indices);
+        ctx->rect_elements_capacity[aa] = capacity;
+    }
+
+    tgpgl_vertex_base(ctx, draw->vtx_offset);
+    ctx->stats.draw_calls++;
+    glDrawElements(GL_TRIANGLES, num_rects * pattern_indices,
+                   sizeof(tgp_index) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
+                   (void*)0);
+}
+
+// fills a path with the stencil buffer, see tgp_fill_path_command
+static void tgpgl_fill_path(tgpgl_context*               ctx,
+                            const tgp_fill_path_command* fill) {
+    const tgp_draw_command* draw = &fill->draw;
+    const GLsizei           num_points = (GLsizei)draw->num_vertices - 4;
+    tgpgl_vertex_base(ctx, draw->vtx_offset);
+
+    // count how often the fan covers every pixel. pixels inside of the path
+    // are covered an odd number of times (even-odd), or a different number
+    // of times by clockwise and counterclockwise triangles (nonzero)
+    tgpgl_set_cap(ctx, TGPGL_CAP_STENCIL_TEST, GL_STENCIL_TEST, true);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glStencilMask(0xff);
+    glStencilFunc(GL_ALWAYS, 0, 0xff);
+    if (fill->rule == TGP_FILL_EVEN_ODD) {
+        glStencilOp(GL_KEEP, GL_KEEP, GL_INVERT);
+    } else {
+        glStencilOpSeparate(GL_FRONT, GL_KEEP, GL_KEEP, GL_INCR_WRAP);
+        glStencilOpSeparate(GL_BACK, GL_KEEP, GL_KEEP, GL_DECR_WRAP);
+    }
+    ctx->stats.draw_calls++;
+    glDrawArrays(GL_TRIANGLE_FAN, 0, num_points);
+
+    // cover the pixels with a count that is not 0, resetting it for the
+    // next fill
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glStencilFunc(GL_NOTEQUAL, 0, 0xff);
+    glStencilOp(GL_ZERO, GL_ZERO, GL_ZERO);
+    ctx->stats.draw_calls++;
+    glDrawArrays(GL_TRIANGLE_FAN, num_points, 4);
+    tgpgl_set_cap(ctx, TGPGL_CAP_STENCIL_TEST, GL_STENCIL_TEST, false);
+}
+
+static inline bool tgpgl_is_damaged(const tgp_command_key* key,
+                                    tgp_irect              viewport,
+                                    const tgp_irect*       damage) {
+    if (damage == NULL) {
+        return true;
+    }
+    const tgp_irect rect =
+        tgpgl_intersect(tgp_region_to_irect(key->region, viewport), *damage);
+    return rect.w != 0 && rect.h != 0;
+}
+
+#ifdef TINYGP_OPAQUE_PASS
+static inline bool tgpgl_is_draw(uint8_t type) {
+    return type == TGP_COMMAND_DRAW || type == TGP_COMMAND_DRAW_LAYER ||
+           type == TGP_COMMAND_DRAW_RECTS || type == TGP_COMMAND_FILL_PATH ||
+           type == TGP_COMMAND_NONE;
+}
+
+// draws the opaque commands of the run of draw commands that starts at
+// `start` front-to-back, writing depth. the translucent ones are drawn in
+// order afterwards and are hidden by the opaque ones that come after them.
+// the run ends at `limit` at the latest, returns the index of the first
+// command after it
+static uint32_t tgpgl_render_opaque(tgpgl_context* ctx, uint32_t start,
+                                    uint32_t limit, tgp_irect viewport,
+                                    const tgp_irect* damage) {
+    const tgp_commands* commands = &ctx->tgpctx->commands;
+    uint32_t            end = start;
+    while (end < limit && tgpgl_is_draw(commands->keys[end].type)) {
+        end++;
+    }
+
+    tgpgl_depth_mask(ctx, true);
+    for (uint32_t i = end; i-- > start;) {
+        const tgp_command_key* key = &commands->keys[i];
+        if (!key->opaque || !tgpgl_is_damaged(key, viewport, damage)) {
+            continue;
+        }
+        tgpgl_apply_pipeline(ctx, key->pipeline);
+        if (key->type == TGP_COMMAND_DRAW_RECTS) {
+            tgpgl_draw_rects(ctx, &commands->data[i].draw_rects);
+        } else {
+            tgpgl_draw(ctx, &commands->data[i].draw);
+        }
+    }
+    tgpgl_depth_mask(ctx, false);
+    return end;
+}
+#endif
+
+// the state at the start of a frame: the scissor covers the whole screen and
+// the projection is the identity
+static void tgpgl_reset_exec(tgpgl_context* ctx) {
+    const tgp_irect screen = {0, 0, ctx->tgpctx->screen_size.w,
+                              ctx->tgpctx->screen_size.h};
+    ctx->exec.viewport = screen;
+    ctx->exec.scissor = screen;
+    memset(ctx->exec.projection, 0, sizeof(ctx->exec.projection));
+    ctx->exec.projection[0] = ctx->exec.projection[1] = 1.0f;
+    ctx->exec.fbo = ctx->screen_fbo;
+    ctx->exec.in_layer = false;
+}
+
+// renders the commands [first, end) starting from the state in `start`. if
+// `damage` is not NULL, rendering is clipped to it and draw commands that do
+// not intersect it are skipped. layers are only rendered if `render_layers`
+// is true, in that case the state after the commands is stored in ctx->exec
+static void tgpgl_render_commands(tgpgl_context*          ctx,
+                                  const tgpgl_exec_state* start,
+                                  uint32_t first, uint32_t end,
+                                  const tgp_irect* damage,
+                                  bool             render_layers) {
+    tgp_context*     tgpctx = ctx->tgpctx;
+    tgp_irect        viewport = start->viewport;
+    tgp_irect        scissor = start->scissor;
+    const tgp_irect* screen_damage = damage;
+    GLuint           fbo = start->fbo;
+    bool             in_layer = start->in_layer;
+    bool             skip_layer = in_layer && !render_layers;
+
+    // continue where the previous range stopped. the damage is in screen
+    // space, it does not apply to layers
+    if (in_layer) {
+        damage = NULL;
+    }
+    ctx->export_state.active = ctx->export_state.enabled && !in_layer;
+    if (!skip_layer) {
+        if (first != 0) {
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+        }
+        tgpgl_viewport(ctx, viewport);
+        tgpgl_scissor(ctx, damage != NULL ? tgpgl_intersect(scissor, *damage)
+                                          : scissor);
+        tgpgl_projection(ctx, start->projection);
+    }
+    if (first == 0) {
+        tgpgl_clear_stencil();
+#ifdef TINYGP_OPAQUE_PASS
+        tgpgl_clear_depth(ctx);
+#endif
+    }
+#ifdef TINYGP_OPAQUE_PASS
+    uint32_t opaque_end = first;
+#endif
+
+    // the data of a command is only read when it is executed
+    tgp_command_iter it = tgp_command_range(tgpctx, first, end - first);
+    while (tgp_range_next(&it)) {
+        const tgp_command_key*  key = it.key;
+        const tgp_command_data* data = it.data;
+        if (skip_layer && key->type != TGP_COMMAND_END_LAYER) {
+            continue;
+        }
+#ifdef TINYGP_OPAQUE_PASS
+        if (it.index >= opaque_end && tgpgl_is_draw(key->type)) {
+            opaque_end =
+                tgpgl_render_opaque(ctx, it.index, end, viewport, damage);
+        }
+#endif
+
+        switch (key->type) {
+        case TGP_COMMAND_CLEAR: tgpgl_clear_frame(ctx, data->clear); break;
         case TGP_COMMAND_VIEWPORT:
-            glViewport(cmd.data.viewport.x, cmd.data.viewport.y,
-                       cmd.data.viewport.w, cmd.data.viewport.h);
+            viewport = data->viewport;
+            tgpgl_viewport(ctx, viewport);
             break;
         case TGP_COMMAND_SCISSOR:
-            glScissor(cmd.data.scissor.x, cmd.data.scissor.y,
-                      cmd.data.scissor.w, cmd.data.scissor.h);
+            scissor = data->scissor;
+            tgpgl_scissor(ctx, damage != NULL
+                                   ? tgpgl_intersect(scissor, *damage)
+                                   : scissor);
             break;
-        case TGP_COMMAND_DRAW: {
-            tgp_draw_command draw = cmd.data.draw;
-            printf("drawcall %d: ", ++num_drawcalls);
-
-            // upload vertex/index buffers
-            GLsizeiptr vtxbuf_size = sizeof(tgp_vertex) * draw.num_vertices;
-            GLsizeiptr idxbuf_size = sizeof(tgp_index) * draw.num_indices;
+        case TGP_COMMAND_PROJECTION: {
+            const tgp_mat2x3* m = &data->projection;
+            const float       projection[4] = {m->v[0][0], m->v[1][1],
+                                               m->v[0][2], m->v[1][2]};
+            tgpgl_projection(ctx, projection);
+            break;
+        }
+        case TGP_COMMAND_BEGIN_LAYER: {
+            in_layer = true;
+            if (!render_layers) {
+                skip_layer = true;
+                break;
+            }
+            const tgp_layer_command* lc = &data->layer;
+            const tgpgl_layer*       layer =
+                tgpgl_get_layer(ctx, lc->id, lc->w, lc->h, lc->samples);
+            fbo = tgpgl_render_fbo(layer);
+            glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+            // layers are rendered at their own size when exporting too
+            if (ctx->export_state.active) {
+                ctx->export_state.active = false;
+                tgpgl_set_projection(ctx, ctx->export_state.projection);
+            }
 
-            glBufferData(GL_ARRAY_BUFFER, vtxbuf_size,
-                         &tgpctx->vertices[draw.vtx_offset], GL_STREAM_DRAW);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER, idxbuf_size,
-                         &tgpctx->indices[draw.idx_offset], GL_STREAM_DRAW);
+            // layers start out transparent
+            static const tgp_color transparent = {0.0f, 0.0f, 0.0f, 0.0f};
+            damage = NULL;
+            scissor = TGP_LITERAL(tgp_irect){0, 0, lc->w, lc->h};
+            tgpgl_scissor(ctx, scissor);
+            tgpgl_clear(ctx, transparent);
+            tgpgl_clear_stencil();
+#ifdef TINYGP_OPAQUE_PASS
+            tgpgl_clear_depth(ctx);
+#endif
+            break;
+        }
+        case TGP_COMMAND_END_LAYER:
+            if (!skip_layer) {
+#ifdef TGPGL_HAS_MSAA
+                tgpgl_resolve_layer(ctx, fbo);
+#endif
+                glBindFramebuffer(GL_FRAMEBUFFER, ctx->screen_fbo);
+            }
+            fbo = ctx->screen_fbo;
+            in_layer = false;
+            skip_layer = false;
+            damage = screen_damage;
+            ctx->export_state.active = ctx->export_state.enabled;
+            break;
+        case TGP_COMMAND_DRAW:
+        case TGP_COMMAND_DRAW_LAYER:
+        case TGP_COMMAND_DRAW_RECTS:
+        case TGP_COMMAND_FILL_PATH: {
+            if (key->opaque) {
+                // already drawn by tgpgl_render_opaque()
+                break;
+            }
+            if (!tgpgl_is_damaged(key, viewport, damage)) {
+                break;
+            }
+            // draw_layer.draw, draw_rects.draw and fill_path.draw alias draw
+            const tgp_draw_command* draw = &data->draw;
+            tgpgl_apply_pipeline(ctx, key->pipeline);
+            if (key->type == TGP_COMMAND_DRAW) {
+                tgpgl_draw(ctx, draw);
+                break;
+            }
+            if (key->type == TGP_COMMAND_DRAW_RECTS) {
+                tgpgl_draw_rects(ctx, &data->draw_rects);
+                break;
+            }
+            if (key->type == TGP_COMMAND_FILL_PATH) {
+                tgpgl_fill_path(ctx, &data->fill_path);
+                break;
+            }
 
-            for (int i = 0; i < draw.num_indices; i++) {
-                printf("%d ", tgpctx->indices[draw.idx_offset + i]);
+            // the layer replaces texture 0 of the pipeline
+            const tgpgl_layer* layer = NULL;
+            for (uint32_t l = 0; l < ctx->num_layers; l++) {
+                if (ctx->layers[l].id == data->draw_layer.id) {
+                    layer = &ctx->layers[l];
+                }
+            }
+            if (layer == NULL) {
+                // never rendered by this backend
+                break;
             }
-            printf("\n");
-
-            // draw
-            glBindTexture(GL_TEXTURE_2D, ctx->white_texture);
-            glDrawElements(
-                GL_TRIANGLES, draw.num_indices,
-                sizeof(tgp_index) == 2 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT,
-                (void*)(intptr_t)(draw.idx_offset * sizeof(tgp_index)));
+            // layers are premultiplied whatever the pipeline says
+            tgpgl_bind_texture(ctx, layer->texture);
+            tgpgl_set_straight_alpha(ctx, false);
+            ctx->state.pipeline = UINT32_MAX;
+            tgpgl_draw(ctx, draw);
             break;
         }
         case TGP_COMMAND_NONE: break;
         }
     }
+
+    if (render_layers) {
+        ctx->exec.viewport = viewport;
+        ctx->exec.scissor = scissor;
+        memcpy(ctx->exec.projection, ctx->export_state.projection,
+               sizeof(ctx->exec.projection));
+        ctx->exec.fbo = fbo;
+        ctx->exec.in_layer = in_layer;
+    }
+}
+
+static void tgpgl_backend_begin_frame(void* user, tgp_context* frame) {
+    tgpgl_context* ctx = (tgpgl_context*)user;
+    ctx->prev_tgpctx = ctx->tgpctx;
+    ctx->tgpctx = frame;
+
+    // setup desired GL state
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    // layers are rendered into their own framebuffers, remember where to go
+    // back to. querying GL stalls, the framebuffer is only looked up again
+    // after tgpgl_invalidate_state()
+    if (!ctx->state.valid) {
+        glGetIntegerv(GL_FRAMEBUFFER_BINDING, &ctx->default_fbo);
+    }
+    tgpgl_setup_render_state(ctx);
+    ctx->screen_fbo = (GLuint)ctx->default_fbo;
+#ifdef TGPGL_HAS_MSAA
+    tgpgl_begin_screen(ctx);
+#endif
+    tgpgl_reset_exec(ctx);
+}
+
+static void tgpgl_backend_upload(void* user, tgp_context* frame) {
+    tgpgl_context* ctx = (tgpgl_context*)user;
+    if (frame->num_flushes > 0) {
+        // continues a flushed frame, the application may have used GL (and
+        // called tgpgl_invalidate_state()) since the previous part
+        tgpgl_setup_render_state(ctx);
+        glBindFramebuffer(GL_FRAMEBUFFER, ctx->exec.fbo);
+    }
+    tgpgl_upload(ctx);
+}
+
+static void tgpgl_backend_execute(void* user, tgp_context* frame,
+                                  uint32_t first, uint32_t count) {
+    tgpgl_context*         ctx = (tgpgl_context*)user;
+    const uint32_t         end = first + count;
+    const tgpgl_exec_state start = ctx->exec;
+    if (!frame->damage_tracking || ctx->screen_reallocated) {
+        tgpgl_render_commands(ctx, &start, first, end, NULL, true);
+        return;
+    }
+
+    // only redraw the damaged parts of the screen, the framebuffer contents
+    // must be preserved between frames for this to work (call
+    // tgp_invalidate_damage() if they were not)
+    uint32_t         num_damage;
+    const tgp_irect* damage = tgp_get_damage(frame, &num_damage);
+    for (uint32_t i = 0; i < num_damage; i++) {
+        tgpgl_render_commands(ctx, &start, first, end, &damage[i], i == 0);
+    }
+    if (num_damage == 0) {
+        // nothing on the screen changed, but layers may still need updating
+        const tgp_irect none = {0, 0, 0, 0};
+        tgpgl_render_commands(ctx, &start, first, end, &none, true);
+    }
+}
+
+static void tgpgl_backend_end_frame(void* user, tgp_context* frame) {
+    tgpgl_context* ctx = (tgpgl_context*)user;
+    (void)frame;
+#ifdef TGPGL_HAS_MSAA
+    if (ctx->screen_fbo != (GLuint)ctx->default_fbo) {
+        tgpgl_end_screen(ctx);
+    }
+#endif
+    ctx->tgpctx = ctx->prev_tgpctx;
+}
+
+// the backend interface of the GL backend, for tgp_render()
+TGPDEF tgp_backend tgpgl_backend(tgpgl_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL);
+    tgp_backend backend;
+    backend.user = ctx;
+    backend.begin_frame = tgpgl_backend_begin_frame;
+    backend.upload = tgpgl_backend_upload;
+    backend.execute = tgpgl_backend_execute;
+    backend.end_frame = tgpgl_backend_end_frame;
+    return backend;
+}
+
+TGPDEF void tgpgl_render(tgpgl_context* ctx) {
+    TINYGP_ASSERT(ctx != NULL);
+    const tgp_backend backend = tgpgl_backend(ctx);
+    tgp_render(&backend, ctx->tgpctx);
+}
+
+// renders a frame returned by tgp_acquire_frame() instead of the context
+// given to tgpgl_init_context()
+TGPDEF void tgpgl_render_frame(tgpgl_context* ctx, tgp_context* frame) {
+    TINYGP_ASSERT(ctx != NULL && frame != NULL);
+    const tgp_backend backend = tgpgl_backend(ctx);
+    tgp_render(&backend, frame);
+}
+
+#ifdef TGPGL_HAS_ASYNC_READBACK
+// copies the oldest pending readback to `pixels` if the GPU is done with it,
+// or after waiting for it if `wait` is true
+static bool tgpgl_readback_take(tgpgl_context* ctx, bool wait, void* pixels,
+                                size_t size, tgpgl_readback_info* info) {
+    if (ctx->readback_count == 0) {
+        return false;
+    }
+    const uint32_t tail =
+        (ctx->readback_head + TGPGL_READBACK_SLOTS - ctx->readback_count) %
+        TGPGL_READBACK_SLOTS;
+    tgpgl_readback_slot* slot = &ctx->readback[tail];
+    GLenum               status = glClientWaitSync(slot->fence, 0, 0);
+    while (wait && status == GL_TIMEOUT_EXPIRED) {
+        status = glClientWaitSync(slot->fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                  1000000000);
+    }
+    if (status == GL_TIMEOUT_EXPIRED) {
+        return false;
+    }
+
+    const size_t num_bytes = (size_t)slot->w * (size_t)slot->h * 4;
+    TINYGP_ASSERT(size >= num_bytes);
+    (void)size;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    const void* data = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                                        (GLsizeiptr)num_bytes, GL_MAP_READ_BIT);
+    if (data != NULL) {
+        memcpy(pixels, data, num_bytes);
+        glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    glDeleteSync(slot->fence);
+    slot->fence = 0;
+    ctx->readback_count--;
+
+    if (info != NULL) {
+        info->w = slot->w;
+        info->h = slot->h;
+        info->sequence = slot->sequence;
+    }
+    return data != NULL;
+}
+#endif
+
+// reads back the frame that was just rendered, for recording video or
+// making thumbnails. the pixels are RGBA with the bottom row first, `size`
+// is the size of `pixels` in bytes and must fit 4 * w * h of the frame.
+//
+// with GLES3 or desktop GL 3.2 the copy goes into a ring of pixel buffers
+// and this call does not wait for the GPU: it writes the oldest frame that
+// is ready to `pixels` and returns true, or returns false if none is ready
+// yet. frames come back in order, at most TGPGL_READBACK_SLOTS - 1 frames
+// late (this only waits if every pixel buffer is still in use), `info`
+// tells which frame it was. call tgpgl_readback_flush() to get the frames
+// that are still pending. with GLES2 the pixels are read right away
+TGPDEF bool tgpgl_readback(tgpgl_context* ctx, void* pixels, size_t size,
+                           tgpgl_readback_info* info) {
+    TINYGP_ASSERT(ctx != NULL && pixels != NULL);
+    const int w = ctx->tgpctx->screen_size.w;
+    const int h = ctx->tgpctx->screen_size.h;
+#ifdef TGPGL_HAS_ASYNC_READBACK
+    // a ring full of frames the GPU is still working on has to wait for the
+    // oldest one
+    const bool taken =
+        tgpgl_readback_take(ctx, ctx->readback_count == TGPGL_READBACK_SLOTS,
+                            pixels, size, info);
+
+    tgpgl_readback_slot* slot = &ctx->readback[ctx->readback_head];
+    if (slot->pbo == 0) {
+        glGenBuffers(1, &slot->pbo);
+    }
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot->pbo);
+    if (slot->w != w || slot->h != h) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, (GLsizeiptr)w * h * 4, NULL,
+                     GL_STREAM_READ);
+        slot->w = w;
+        slot->h = h;
+    }
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    // make sure the fence reaches the GPU, otherwise polling it might never
+    // see it signaled
+    slot->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    glFlush();
+    slot->sequence = ctx->readback_sequence++;
+    ctx->readback_head = (ctx->readback_head + 1) % TGPGL_READBACK_SLOTS;
+    ctx->readback_count++;
+    return taken;
+#else
+    TINYGP_ASSERT(size >= (size_t)w * (size_t)h * 4);
+    (void)size;
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+    if (info != NULL) {
+        info->w = w;
+        info->h = h;
+        info->sequence = ctx->readback_sequence;
+    }
+    ctx->readback_sequence++;
+    return true;
+#endif
+}
+
+// waits for the oldest pending readback and writes it to `pixels`, returns
+// false if there is none. call this until it returns false to get every
+// frame tgpgl_readback() has not returned yet
+TGPDEF bool tgpgl_readback_flush(tgpgl_context* ctx, void* pixels,
+                                 size_t size, tgpgl_readback_info* info) {
+    TINYGP_ASSERT(ctx != NULL && pixels != NULL);
+#ifdef TGPGL_HAS_ASYNC_READBACK
+    return tgpgl_readback_take(ctx, true, pixels, size, info);
+#else
+    (void)ctx;
+    (void)pixels;
+    (void)size;
+    (void)info;
+    return false;
+#endif
+}
+
+// renders the frame at `width` x `height` pixels one tile at a time and
+// passes the image to `sink` in bands of rows, top to bottom, so images far
+// larger than the GPU (or memory) allows can be written straight to an
+// encoder. the frame is scaled to the image, record it at the size of the
+// image (tgp_begin() with that screen size) for results that match
+// tgpgl_render() exactly. draws are skipped on the tiles their region does
+// not touch, and layers are rendered once, at their own size.
+//
+// tiles are `tile_size` pixels square, TGPGL_EXPORT_TILE_SIZE if it is 0.
+// memory use is one tile on the GPU and 4 * width * tile_size bytes for the
+// band of rows, whatever the height of the image. returns false if `sink`
+// stopped the export or the tile could not be allocated
+TGPDEF bool tgpgl_export(tgpgl_context* ctx, int width, int height,
+                         int tile_size, tgpgl_export_sink sink, void* user) {
+    TINYGP_ASSERT(ctx != NULL && width > 0 && height > 0 && sink != NULL);
+    tgp_context* tgpctx = ctx->tgpctx;
+    GLint        max_size = 0;
+    glGetIntegerv(GL_MAX_TEXTURE_SIZE, &max_size);
+    if (tile_size <= 0) {
+        tile_size = TGPGL_EXPORT_TILE_SIZE;
+    }
+    tile_size = TGP_MIN(tile_size, (int)max_size);
+    const int tile_w = TGP_MIN(tile_size, width);
+    const int tile_h = TGP_MIN(tile_size, height);
+
+    // the band of rows that is passed to the sink, followed by the pixels of
+    // one tile
+    const size_t stride = (size_t)width * 4;
+    uint8_t*     band = (uint8_t*)malloc(stride * (size_t)tile_h +
+                                         (size_t)tile_w * (size_t)tile_h * 4);
+    if (band == NULL) {
+        return false;
+    }
+    uint8_t* pixels = band + stride * (size_t)tile_h;
+
+    // setup desired GL state, and remember what to go back to
+    memset(&ctx->stats, 0, sizeof(ctx->stats));
+    tgpgl_setup_render_state(ctx);
+    tgpgl_upload(ctx);
+    GLint prev_fbo = 0, prev_viewport[4];
+    glGetIntegerv(GL_FRAMEBUFFER_BINDING, &prev_fbo);
+    glGetIntegerv(GL_VIEWPORT, prev_viewport);
+
+    tgpgl_layer target;
+    memset(&target, 0, sizeof(target));
+    tgpgl_create_target(&target);
+    bool ok = tgpgl_alloc_target(ctx, &target, tile_w, tile_h);
+#ifdef TGPGL_HAS_MSAA
+    ok = tgpgl_alloc_msaa(ctx, &target, tgpctx->msaa_samples, GL_RGBA8) && ok;
+#endif
+    if (!ok) {
+        fprintf(stderr, "error: tgpgl_export(): framebuffer of the tile is "
+                        "incomplete\n");
+    }
+    ctx->default_fbo = (GLint)target.fbo;
+    ctx->screen_fbo = tgpgl_render_fbo(&target);
+
+    tgpgl_export_state* e = &ctx->export_state;
+    const tgp_irect screen = {0, 0, tgpctx->screen_size.w,
+                              tgpctx->screen_size.h};
+    e->enabled = true;
+    e->scale[0] = (double)width / (double)screen.w;
+    e->scale[1] = (double)height / (double)screen.h;
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    for (int y = 0; ok && y < height; y += tile_h) {
+        const int num_rows = TGP_MIN(tile_h, height - y);
+        for (int x = 0; x < width; x += tile_w) {
+            const int w = TGP_MIN(tile_w, width - x);
+            e->tile = TGP_LITERAL(tgp_irect){x, height - y - num_rows, tile_w,
+                                             tile_h};
+
+            // tiles start out transparent
+            static const tgp_color transparent = {0.0f, 0.0f, 0.0f, 0.0f};
+            e->active = false;
+            glBindFramebuffer(GL_FRAMEBUFFER, ctx->screen_fbo);
+            tgpgl_set_scissor(ctx,
+                              TGP_LITERAL(tgp_irect){0, 0, tile_w, tile_h});
+            tgpgl_clear(ctx, transparent);
+
+            // the part of the frame that is visible in the tile, rounded out
+            // so that draws touching it are not skipped
+            const int fx1 = (int)floor(e->tile.x / e->scale[0]) - 1;
+            const int fy1 = (int)floor(e->tile.y / e->scale[1]) - 1;
+            const int fx2 = (int)ceil((e->tile.x + tile_w) / e->scale[0]) + 1;
+            const int fy2 = (int)ceil((e->tile.y + tile_h) / e->scale[1]) + 1;
+            const tgp_irect visible = {fx1, fy1, fx2 - fx1, fy2 - fy1};
+
+            e->active = true;
+            tgpgl_reset_exec(ctx);
+            const tgpgl_exec_state start = ctx->exec;
+            tgpgl_render_commands(ctx, &start, 0, tgpctx->cur_command,
+                                  &visible, x == 0 && y == 0);
+#ifdef TGPGL_HAS_MSAA
+            if (target.samples != 0) {
+                tgpgl_resolve(ctx, &target, target.fbo);
+            }
+#endif
+
+            // GL has the bottom row first
+            glReadPixels(0, 0, w, num_rows, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+            for (int row = 0; row < num_rows; row++) {
+                memcpy(&band[stride * (size_t)row + (size_t)x * 4],
+                       &pixels[(size_t)(num_rows - 1 - row) * w * 4],
+                       (size_t)w * 4);
+            }
+        }
+        ok = sink(user, y, num_rows, band, stride);
+    }
+    memset(e, 0, sizeof(*e));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, (GLuint)prev_fbo);
+    ctx->default_fbo = prev_fbo;
+    ctx->screen_fbo = (GLuint)prev_fbo;
+    tgpgl_set_viewport(ctx, TGP_LITERAL(tgp_irect){
+                                prev_viewport[0], prev_viewport[1],
+                                prev_viewport[2], prev_viewport[3]});
+    tgpgl_delete_target(&target);
+    free(band);
+    return ok;
 }
 
 // #endif // TINYGPGL_IMPLEMENTATION